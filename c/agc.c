@@ -67,7 +67,6 @@ struct agc
     int id;
     struct agc *host;       /* points to self or partner for stereo implementation */
     struct agc *partner;
-    float input;
     float ratio;
     float limit;
     float nr_gain;
@@ -75,11 +74,18 @@ struct agc
     float nr_offthres;
     float gain_interval_amount; /* agc gain can move by this amount each interval */
     int nr_state;
-    float *buffer;          /* eventual buffer size depends on sample rate */
-    int buffer_len;
+    float *buffer;          /* lookahead ring - a power of two in size */
+    int buffer_mask;
+    int buffer_len;         /* the lookahead length which depends on sample rate */
+    int block_size;         /* the largest number of frames processed per call */
+    float *xbuf;            /* block of filtered input - also the sidechain source */
+    float *gbuf;            /* block of gain values computed by the host */
+    float *dfbuf;           /* block of ducking factors */
     int sRate;              /* the sample rate in use by JACK */
     int in_pos;
     int out_pos;
+    int rr_phase;           /* phase for use by all of the envelope-followers */
+    unsigned meter_count;
     float gain;
     float DC;
     float ds_bias;
@@ -106,70 +112,109 @@ struct agc
 static GHashTable *control_ht;  /* used for looking up control functions */
 
 
-static float agc_12db_hpfilter(struct agc_RC_Coe *c, struct agc_RC_Var *v, float input)
+/* the filters run one stage at a time over the whole block
+ * the state is held in locals for the duration of the loop
+ */
+static void agc_12db_hpfilter(struct agc_RC_Coe *c, struct agc_RC_Var *v, float *x, int n)
     {
-    input += c->q * v->bp;
-    v->hp = c->c * (v->hp + input - v->last_in);
-    v->bp = v->bp * c->a + v->hp * c->b;
-    v->last_in = input;
-    return v->hp;
+    const float a = c->a, b = c->b, cc = c->c, q = c->q;
+    float hp = v->hp, bp = v->bp, last_in = v->last_in, input;
+
+    for (int i = 0; i < n; ++i)
+        {
+        input = x[i] + q * bp;
+        hp = cc * (hp + input - last_in);
+        bp = bp * a + hp * b;
+        last_in = input;
+        x[i] = hp;
+        }
+    v->hp = hp;
+    v->bp = bp;
+    v->last_in = last_in;
     }
 
-static float agc_6db_hpfilter(float detail, struct agc_RC_Coe *c, struct agc_RC_Var *v, float input)
+static void agc_6db_hpfilter(float detail, struct agc_RC_Coe *c, struct agc_RC_Var *v, float *x, int n)
     {
-    v->hp = c->c * (v->hp + input - v->last_in);
-    v->last_in = input;
-    return input + v->hp * detail;
+    const float cc = c->c;
+    float hp = v->hp, last_in = v->last_in, input;
+
+    for (int i = 0; i < n; ++i)
+        {
+        input = x[i];
+        hp = cc * (hp + input - last_in);
+        last_in = input;
+        x[i] = input + hp * detail;
+        }
+    v->hp = hp;
+    v->last_in = last_in;
     }
 
-static float agc_6db_lpfilter(float detail, struct agc_RC_Coe *c, struct agc_RC_Var *v, float input)
+static void agc_6db_lpfilter(float detail, struct agc_RC_Coe *c, struct agc_RC_Var *v, float *x, int n)
     {
-    v->lp = v->lp * c->a + input * c->b;
-    return input + v->lp * detail;
+    const float a = c->a, b = c->b;
+    float lp = v->lp;
+
+    for (int i = 0; i < n; ++i)
+        {
+        lp = lp * a + x[i] * b;
+        x[i] += lp * detail;
+        }
+    v->lp = lp;
     }
 
-static float agc_phaserotate(struct agc_RC_Filter *f, float input)
+static void agc_phaserotate(struct agc_RC_Filter *f, float *x, int n)
     {
-    struct agc_RC_Coe *c = &f->coe;
+    const float a = f->coe.a, b = f->coe.b, cc = f->coe.c;
     struct agc_RC_Var *v = &f->var;
-        
-    v->hp = c->c * (v->hp + input - v->last_in);
-    v->lp = v->lp * c->a + input * c->b;
-    v->last_in = input;
-    return v->lp - v->hp;
+    float hp = v->hp, lp = v->lp, last_in = v->last_in, input;
+
+    for (int i = 0; i < n; ++i)
+        {
+        input = x[i];
+        hp = cc * (hp + input - last_in);
+        lp = lp * a + input * b;
+        last_in = input;
+        x[i] = lp - hp;
+        }
+    v->hp = hp;
+    v->lp = lp;
+    v->last_in = last_in;
     }
 
-void agc_process_stage1(struct agc *s, float input)
+void agc_process_stage1(struct agc *s, const float *input, int n)
     {
+    float *x = s->xbuf;
+    int pos = s->in_pos;
+
+    memcpy(x, input, n * sizeof (float));
+
     /* An analog active RC-Highpassfilter network to remove DC and subsonic sounds
      * each stage has 12dB/octave of attenuation.
      */
     for (int i = 0, q = s->host->hpstages; i < q; ++i)
-        input = agc_12db_hpfilter(&s->host->filters.RC_HPF_initial[i].coe, &s->filters.RC_HPF_initial[i].var, input);
+        agc_12db_hpfilter(&s->host->filters.RC_HPF_initial[i].coe, &s->filters.RC_HPF_initial[i].var, x, n);
 
     /* RC-Network (but with only one stage and without resonance/feedback (->6dB/octave))
      * used as HF-Detail-Filter 
      */
-    input = agc_6db_hpfilter(s->host->hf_detail, &s->host->filters.RC_HPF_detail.coe, &s->filters.RC_HPF_detail.var, input);
+    agc_6db_hpfilter(s->host->hf_detail, &s->host->filters.RC_HPF_detail.coe, &s->filters.RC_HPF_detail.var, x, n);
 
     /* RC-Network (but with only one stage and without resonance/feedback)
      * used as LF-Detail-Filter 
      */
-    input = agc_6db_lpfilter(s->host->lf_detail, &s->host->filters.RC_LPF_detail.coe, &s->filters.RC_LPF_detail.var, input); 
+    agc_6db_lpfilter(s->host->lf_detail, &s->host->filters.RC_LPF_detail.coe, &s->filters.RC_LPF_detail.var, x, n); 
 
     /* Phase-rotator done with RC-simulation
      * for good reasons doesn't use Q/resonance either...
      */
     if (s->host->use_phaserotator)
         for (int i = 0; i < 4; ++i)
-            input = agc_phaserotate(s->filters.RC_PHR + i, input);
+            agc_phaserotate(s->filters.RC_PHR + i, x, n);
 
-    /* feed input into ring-buffer, store input */
-    s->buffer[s->in_pos % s->buffer_len] = s->input = input;
-    
-    /* update pointers of the ring-buffer */  
-    s->in_pos++;
-    s->out_pos++;
+    /* feed input into the lookahead ring-buffer */
+    for (int i = 0; i < n; ++i)
+        s->buffer[pos++ & s->buffer_mask] = x[i];
+    s->in_pos = pos;
     }
 
 static float agc_quad_rr(float *storage, int *reset_point, int phase, float input)
@@ -190,12 +235,10 @@ static float agc_quad_rr(float *storage, int *reset_point, int phase, float inpu
     return highest;
     }
 
-void agc_process_stage2(struct agc *s, int mic_is_mute)
+const float *agc_process_stage2(struct agc *s, const float *mute, int n)
     {
     /* audio signal for sidechain use - possibly combined */
     float input;
-    /* phase for use by all of the envelope-followers */
-    float phase;
     /* de-esser values */
     float ds_amph, ds_ampl;
     /* the input signal level as computed by the envelope follower */
@@ -204,11 +247,20 @@ void agc_process_stage2(struct agc *s, int mic_is_mute)
     float factor, orig_factor;
     /* the computed ducker amplification factor - used externally */
     float duck_amp;
+    /* sidechain sources */
+    const float *x = s->xbuf, *px = s->partner->xbuf;
+    const int paired = (s->partner->host == s);
+
+    if (s != s->host)
+        return NULL;
 
-    if (s == s->host)
+    for (int i = 0; i < n; ++i)
         {
-        input = (s->partner->host == s) ? (s->input + s->partner->input) * 0.5 : s->input;
-        phase = s->in_pos % (2 * s->buffer_len);   
+        input = paired ? (x[i] + px[i]) * 0.5f : x[i];
+
+        /* phase for use by all of the envelope-followers */
+        if (++s->rr_phase == 2 * s->buffer_len)
+            s->rr_phase = 0;
       
         /* De-Esser sidechain-filter - does high and low pass filtering
          */
@@ -226,11 +278,11 @@ void agc_process_stage2(struct agc *s, int mic_is_mute)
         }
         
         /* follow the envelope of the de-esser high and low pass filtered signal */
-        ds_amph = agc_quad_rr(s->RR_DS_high, s->RR_reset_point, phase, s->filters.RC_F_DS.var.hp);
-        ds_ampl = agc_quad_rr(s->RR_DS_low, s->RR_reset_point, phase, s->filters.RC_F_DS.var.lp);
+        ds_amph = agc_quad_rr(s->RR_DS_high, s->RR_reset_point, s->rr_phase, s->filters.RC_F_DS.var.hp);
+        ds_ampl = agc_quad_rr(s->RR_DS_low, s->RR_reset_point, s->rr_phase, s->filters.RC_F_DS.var.lp);
         
         /* round-robin-4-peak-envelope-follower tracking the general signal level */
-        amp = agc_quad_rr(s->RR_signal, s->RR_reset_point, phase, input);
+        amp = agc_quad_rr(s->RR_signal, s->RR_reset_point, s->rr_phase, input);
 
         /* raw-amplification-factor limited to maximum allowed ratio */
         factor = s->limit / (amp + 0.0001f);
@@ -267,8 +319,10 @@ void agc_process_stage2(struct agc *s, int mic_is_mute)
         if (s->gain > factor)
             s->gain -= s->gain_interval_amount;
 
+        s->gbuf[i] = s->gain;
+
         /* ducking is optional and must not work when the mic is closed */
-        if (mic_is_mute || s->use_ducker == 0)
+        if (mute[i] < 0.75f || s->use_ducker == 0)
             {
             if (s->df < 1.0f)
                 s->df += s->ducker_release;
@@ -313,22 +367,33 @@ void agc_process_stage2(struct agc *s, int mic_is_mute)
                 }
             }
 
+        s->dfbuf[i] = s->df;
+
         /* maintain a peak hold gain figure for the GUI compression meter
          * essentially this is metadata 
          */
-        if ((s->out_pos & 0x7) == 0)
+        if ((++s->meter_count & 0x7) == 0)
             {
             s->meter_signal_cap = orig_factor / s->ratio;
             s->meter_de_ess = s->ds_state ? s->ds_gain : 1.0f;
             s->meter_noise_gate = s->nr_state ? s->nr_gain : 1.0f;
             }
         }
+
+    return s->dfbuf;
     }
 
-float agc_process_stage3(struct agc *s)
+void agc_process_stage3(struct agc *s, float *output, int n)
     {
+    const float *g = s->host->gbuf;
+    const float *buffer = s->buffer;
+    const int mask = s->buffer_mask;
+    int pos = s->out_pos;
+
     /* modulate delayed signal with gain */
-    return s->buffer[s->out_pos % s->buffer_len] * s->host->gain;
+    for (int i = 0; i < n; ++i)
+        output[i] = buffer[pos++ & mask] * g[i];
+    s->out_pos = pos;
     }
 
 void agc_get_meter_levels(struct agc *s, int *signal_cap, int *de_ess, int *noise_gate)
@@ -360,7 +425,7 @@ void agc_reset(struct agc *s)
         }
 
     /* wipe audio buffer */
-    memset(s->buffer, 0, s->buffer_len);
+    memset(s->buffer, 0, (s->buffer_mask + 1) * sizeof (float));
  
     /* wipe indicator settings */
     s->df = s->meter_signal_cap = s->meter_de_ess = s->meter_noise_gate = 1.0f;
@@ -559,6 +624,50 @@ void agc_set_partnered_mode(struct agc *s, int boolean)
         s->host = s;
     }
 
+int agc_set_block_size(struct agc *s, int n_frames)
+    {
+    const int delay = s->buffer_len - 3;
+    int ring_size;
+    float *xbuf, *gbuf, *dfbuf, *buffer;
+
+    if (n_frames <= s->block_size)
+        return 1;
+
+    xbuf = realloc(s->xbuf, n_frames * sizeof (float));
+    gbuf = realloc(s->gbuf, n_frames * sizeof (float));
+    dfbuf = realloc(s->dfbuf, n_frames * sizeof (float));
+    if (xbuf)
+        s->xbuf = xbuf;
+    if (gbuf)
+        s->gbuf = gbuf;
+    if (dfbuf)
+        s->dfbuf = dfbuf;
+    if (!(xbuf && gbuf && dfbuf))
+        {
+        fprintf(stderr, "agc_set_block_size: malloc failure\n");
+        return 0;
+        }
+
+    /* a whole block is written to the ring before any of it is read back */
+    for (ring_size = 1; ring_size < delay + n_frames; ring_size <<= 1);
+    if (ring_size > s->buffer_mask + 1)
+        {
+        if (!(buffer = calloc(ring_size, sizeof (float))))
+            {
+            fprintf(stderr, "agc_set_block_size: malloc failure\n");
+            return 0;
+            }
+        free(s->buffer);
+        s->buffer = buffer;
+        s->buffer_mask = ring_size - 1;
+        s->in_pos = delay;
+        s->out_pos = 0;
+        }
+
+    s->block_size = n_frames;
+    return 1;
+    }
+
 struct agc *agc_init(int sRate, float lookahead, int id)
     {
     struct agc *s;
@@ -573,10 +682,11 @@ struct agc *agc_init(int sRate, float lookahead, int id)
         return NULL;
         }
 
-    if (!(s->buffer = calloc((s->buffer_len = (s->sRate = sRate) * lookahead), sizeof (float))))
+    s->buffer_len = (s->sRate = sRate) * lookahead;
+    if (!agc_set_block_size(s, 1024))
         {
         fprintf(stderr, "agc_init: malloc failure\n");
-        free(s);
+        agc_free(s);
         return NULL;
         }
 
@@ -595,8 +705,7 @@ struct agc *agc_init(int sRate, float lookahead, int id)
 
     setup_ratio(s, 3.0f);/* 3:1 "compression" */
     s->limit = 0.707f;   /* signal level to top out at */
-    s->in_pos = s->buffer_len - 1;
-    s->out_pos = 1;
+    s->rr_phase = s->buffer_len - 1;
     s->gain = 0.0f;
     s->nr_onthres = 0.1f;      /* silence detection level */
     s->nr_offthres = 0.1001f;  /* non-silence detection level */
@@ -649,5 +758,8 @@ struct agc *agc_init(int sRate, float lookahead, int id)
 void agc_free(struct agc *s)
     {
     free(s->buffer);
+    free(s->xbuf);
+    free(s->gbuf);
+    free(s->dfbuf);
     free(s);
     }
@@ -30,12 +30,18 @@ void agc_set_as_partners(struct agc *agc1, struct agc *agc2);
 /* initiate or cancel stereo mode - called on subordinate */
 void agc_set_partnered_mode(struct agc *self, int boolean);
 
-/* run each of these in turn, intersperse paired mics
- * parameter mic_is_mute toggles ducker operation
+/* size the work buffers for blocks of up to n_frames - returns zero on failure
+ * not to be called concurrently with processing
  */
-void agc_process_stage1(struct agc *self, float input);
-void agc_process_stage2(struct agc *self, int mic_is_mute);
-float agc_process_stage3(struct agc *self);
+int agc_set_block_size(struct agc *self, int n_frames);
+
+/* run each of these in turn over a block of samples, intersperse paired mics
+ * stage2 parameter mute holds the mic's soft mute level which toggles ducker operation
+ * and it returns the per-sample ducking factors or NULL on a subordinate
+ */
+void agc_process_stage1(struct agc *self, const float *input, int n);
+const float *agc_process_stage2(struct agc *self, const float *mute, int n);
+void agc_process_stage3(struct agc *self, float *output, int n);
 
 /* the amount of attenuation broken down into three parts */
 void agc_get_meter_levels(struct agc *self, int *signal_cap, int *de_ess, int *noise_gate);
@@ -21,77 +21,516 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <jack/jack.h>
-#include <jack/ringbuffer.h>
+#include <samplerate.h>
 #include "sourceclient.h"
 #include "main.h"
 
+#define FEED_SECONDS 20         /* the least backlog a consumer may build up */
+#define RESAMPLE_SECONDS 2      /* the same for readers of a resampler */
+#define RESAMPLE_CHUNK 1024     /* frames taken from the jack feed at a time for resampling */
+
 typedef jack_default_audio_sample_t sample_t;
+typedef float v4sf __attribute__ ((vector_size (16)));
+
+/* a fade as the gains for the next four frames */
+struct audio_feed_ramp
+    {
+    v4sf g;
+    v4sf step4;         /* applied every four frames */
+    float step;         /* applied every frame */
+    };
+
+/* audio_feed_resampler: a conversion shared by encoders of the same target rate and quality
+ *
+ * Whichever reader finds the output ring short tops it up from the jack
+ * feed so the conversion happens once however many encoders read it.
+ */
+struct audio_feed_resampler
+    {
+    struct audio_feed_resampler *next;
+    long target_rate;
+    int quality;
+    int users;
+    double ratio;
+    pthread_mutex_t mutex;              /* held by the reader doing the resampling */
+    SRC_STATE *src_state[2];
+    struct audio_feed_cursor source;    /* position in the jack feed */
+    sample_t *in[2];                    /* audio taken from the jack feed */
+    size_t in_frames, in_offset;        /* and how far through it the resampler is */
+    struct audio_feed_ring ring;        /* the resampled audio */
+    };
 
 static struct audio_feed *audio_feed;
 
+/* audio_feed_notify: make an armed consumer ready once its audio has arrived */
+static void audio_feed_notify(struct audio_feed_cursor *c, unsigned long wp)
+    {
+    /* the compare and swap ensures exactly one of us or the consumer ends the wait */
+    if (c->waiting && (long)(wp - c->wake_pos) >= 0 && __sync_bool_compare_and_swap(&c->waiting, 1, 0))
+        audio_feed_wake(c);
+    }
+
+static void audio_feed_stamp_set(struct audio_feed_ring *r, unsigned long pos, jack_nframes_t frame_time)
+    {
+    struct audio_feed_stamp *s = &r->stamp;
+
+    s->seq++;
+    __sync_synchronize();
+    s->pos = pos;
+    s->frame_time = frame_time;
+    __sync_synchronize();
+    s->seq++;
+    }
+
+/* audio_feed_stamp_at: when the audio at pos was captured, the stamp being the latest
+ * anchor of ring position to frame time and the frames between them counted at the ring's rate */
+static jack_nframes_t audio_feed_stamp_at(struct audio_feed_ring *r, unsigned long pos)
+    {
+    struct audio_feed_stamp *s = &r->stamp;
+    unsigned seq;
+    unsigned long spos;
+    jack_nframes_t frame_time;
+
+    do {
+        seq = s->seq;
+        __sync_synchronize();
+        spos = s->pos;
+        frame_time = s->frame_time;
+        __sync_synchronize();
+        } while ((seq & 1) || seq != s->seq);
+
+    return frame_time - (jack_nframes_t)((double)(long)(spos - pos) / r->rate);
+    }
+
+/* the JACK thread writes each period once into a ring shared by all the
+ * encoders and recorders, each of which keeps its own read position
+ */
 int audio_feed_process_audio(jack_nframes_t n_frames, void *arg)
     {
     struct audio_feed *self = audio_feed;
-    struct threads_info *ti = self->threads_info;
-    struct encoder *e;
-    struct recorder *r;
+    const unsigned long mask = self->ring.mask, wp = self->ring.write_pos;
     sample_t *input_port_buffer[2];
-    int i;
+    jack_nframes_t first;
     
     input_port_buffer[0] = jack_port_get_buffer(g.port.output_in_l, n_frames);
     input_port_buffer[1] = jack_port_get_buffer(g.port.output_in_r, n_frames);
-    
-    /* feed pcm audio data to all encoders that request it */
-    for (i = 0; i < ti->n_encoders; i++)
+
+    /* written in up to two pieces either side of the wrap point */
+    if ((first = mask + 1 - (wp & mask)) > n_frames)
+        first = n_frames;
+    for (int ch = 0; ch < 2; ++ch)
+        {
+        memcpy(self->ring.buf[ch] + (wp & mask), input_port_buffer[ch], first * sizeof (sample_t));
+        memcpy(self->ring.buf[ch], input_port_buffer[ch] + first, (n_frames - first) * sizeof (sample_t));
+        }
+
+    /* this period's audio was captured over the course of the last one */
+    audio_feed_stamp_set(&self->ring, wp, jack_last_frame_time(g.client) - n_frames);
+
+    /* the audio must be in place before the readers can see the new position */
+    __sync_synchronize();
+    self->ring.write_pos = wp + n_frames;
+
+    /* a check per encoder, no copying */
+    for (int i = 0; i < self->threads_info->n_encoders; ++i)
+        audio_feed_notify(&self->threads_info->encoder[i]->feed, wp + n_frames);
+    return 0;
+    }
+
+/* audio_feed_ring_alloc: a power of two in size for cheap wrapping with room for max_lag twice over */
+static int audio_feed_ring_alloc(struct audio_feed_ring *r, unsigned long max_lag)
+    {
+    unsigned long size;
+
+    for (size = 1; size < max_lag * 2; size <<= 1);
+    r->mask = size - 1;
+    r->write_pos = 0;
+    if (!(r->buf[0] = calloc(size, sizeof (sample_t))) || !(r->buf[1] = calloc(size, sizeof (sample_t))))
+        {
+        free(r->buf[0]);
+        return FAILED;
+        }
+    return SUCCEEDED;
+    }
+
+static void audio_feed_ring_free(struct audio_feed_ring *r)
+    {
+    free(r->buf[0]);
+    free(r->buf[1]);
+    }
+
+static unsigned long audio_feed_ring_write_pos(struct audio_feed_ring *r)
+    {
+    unsigned long wp = r->write_pos;
+
+    __sync_synchronize();
+    return wp;
+    }
+
+/* audio_feed_overrun: true when the writer lapped the reader during a copy */
+static int audio_feed_overrun(struct audio_feed_ring *r, unsigned long pos)
+    {
+    __sync_synchronize();
+    return r->write_pos - pos > r->mask + 1;
+    }
+
+static void audio_feed_copy(struct audio_feed_ring *r, int channel, unsigned long pos, float *dest, size_t frames)
+    {
+    const unsigned long offset = pos & r->mask;
+    size_t first = r->mask + 1 - offset;
+
+    if (first > frames)
+        first = frames;
+    memcpy(dest, r->buf[channel] + offset, first * sizeof (sample_t));
+    memcpy(dest + first, r->buf[channel], (frames - first) * sizeof (sample_t));
+    }
+
+/* audio_feed_resample: convert all the jack feed audio the resampler has yet to see */
+static void audio_feed_resample(struct audio_feed_resampler *r)
+    {
+    SRC_DATA data[2];
+    unsigned long wp;
+
+    pthread_mutex_lock(&r->mutex);
+    for (;;)
         {
-        e = ti->encoder[i];
-        switch (e->jack_dataflow_control)
+        if (r->in_offset == r->in_frames)
             {
-            case JD_OFF:
-                break;
-            case JD_ON:
-                while (jack_ringbuffer_write_space(e->input_rb[1]) < n_frames * sizeof (sample_t))
-                    nanosleep(&(struct timespec){0, 10000000}, NULL);
-                    
-                jack_ringbuffer_write(e->input_rb[0], (char *)input_port_buffer[0], n_frames * sizeof (sample_t));
-                jack_ringbuffer_write(e->input_rb[1], (char *)input_port_buffer[1], n_frames * sizeof (sample_t));
+            r->in_offset = 0;
+            if (!(r->in_frames = audio_feed_read_stereo(&r->source, r->in[0], r->in[1], RESAMPLE_CHUNK)))
                 break;
-            case JD_FLUSH:
-                jack_ringbuffer_reset(e->input_rb[0]);
-                jack_ringbuffer_reset(e->input_rb[1]);
-                e->jack_dataflow_control = JD_OFF;
-                break;
-            default:
-                fprintf(stderr, "jack_process_callback: unhandled jack_dataflow_control parameter\n");
             }
+
+        /* the output goes straight into the ring up to the wrap point */
+        wp = r->ring.write_pos;
+        for (int ch = 0; ch < 2; ++ch)
+            {
+            data[ch].data_in = r->in[ch] + r->in_offset;
+            data[ch].input_frames = r->in_frames - r->in_offset;
+            data[ch].data_out = r->ring.buf[ch] + (wp & r->ring.mask);
+            data[ch].output_frames = r->ring.mask + 1 - (wp & r->ring.mask);
+            data[ch].end_of_input = 0;
+            data[ch].src_ratio = r->ratio;
+            if (src_process(r->src_state[ch], &data[ch]))
+                {
+                fprintf(stderr, "audio_feed_resample: %s\n", src_strerror(src_error(r->src_state[ch])));
+                r->in_offset = r->in_frames;
+                goto unlock;
+                }
+            }
+
+        /* both channels are set up alike and so stay in step */
+        if (!data[0].input_frames_used && !data[0].output_frames_gen)
+            break;
+        r->in_offset += data[0].input_frames_used;
+        /* the filter delay of a few milliseconds is not counted */
+        audio_feed_stamp_set(&r->ring, wp + data[0].output_frames_gen,
+                    audio_feed_stamp_at(r->source.ring, r->source.pos - r->in_frames + r->in_offset));
+        __sync_synchronize();
+        r->ring.write_pos = wp + data[0].output_frames_gen;
         }
-        
-    for (i = 0; i < ti->n_recorders; i++)
+    unlock:
+    pthread_mutex_unlock(&r->mutex);
+    }
+
+static void audio_feed_resampler_free(struct audio_feed_resampler *r)
+    {
+    for (int ch = 0; ch < 2; ++ch)
         {
-        r = ti->recorder[i];
-        switch (r->jack_dataflow_control)
+        if (r->src_state[ch])
+            src_delete(r->src_state[ch]);
+        free(r->in[ch]);
+        }
+    audio_feed_ring_free(&r->ring);
+    pthread_mutex_destroy(&r->mutex);
+    free(r);
+    }
+
+static struct audio_feed_resampler *audio_feed_resampler_new(long target_rate, int quality)
+    {
+    struct audio_feed_resampler *r;
+    int error;
+
+    if (!(r = calloc(1, sizeof (struct audio_feed_resampler))))
+        goto failed;
+    pthread_mutex_init(&r->mutex, NULL);
+    if (!audio_feed_ring_alloc(&r->ring, target_rate * RESAMPLE_SECONDS))
+        {
+        audio_feed_resampler_free(r);
+        goto failed;
+        }
+    for (int ch = 0; ch < 2; ++ch)
+        {
+        if (!(r->in[ch] = malloc(RESAMPLE_CHUNK * sizeof (sample_t))))
             {
-            case JD_OFF:
-                break;
-            case JD_ON:
-                while (jack_ringbuffer_write_space(r->input_rb[1]) < n_frames * sizeof (sample_t))
-                    nanosleep(&(struct timespec){0, 10000000}, NULL);                
+            audio_feed_resampler_free(r);
+            goto failed;
+            }
+        if (!(r->src_state[ch] = src_new(quality, 1, &error)))
+            {
+            fprintf(stderr, "audio_feed_resampler_new: %s\n", src_strerror(error));
+            audio_feed_resampler_free(r);
+            return NULL;
+            }
+        }
+    r->target_rate = target_rate;
+    r->quality = quality;
+    r->ratio = (double)target_rate / (double)audio_feed->sample_rate;
+    r->ring.rate = r->ratio;
+    audio_feed_cursor_attach(&r->source, audio_feed_max_lag(), NULL);
+    return r;
 
-                jack_ringbuffer_write(r->input_rb[0], (char *)input_port_buffer[0], n_frames * sizeof (sample_t));
-                jack_ringbuffer_write(r->input_rb[1], (char *)input_port_buffer[1], n_frames * sizeof (sample_t));
-                break;
-            case JD_FLUSH:
-                jack_ringbuffer_reset(r->input_rb[0]);
-                jack_ringbuffer_reset(r->input_rb[1]);
-                r->jack_dataflow_control = JD_OFF;
-                break;
-            default:
-                fprintf(stderr, "jack_process_callback: unhandled jack_dataflow_control parameter\n");
-            }   
+    failed:
+    fprintf(stderr, "audio_feed_resampler_new: malloc failure\n");
+    return NULL;
+    }
+
+unsigned long audio_feed_max_lag()
+    {
+    return (audio_feed->ring.mask + 1) / 2;
+    }
+
+static void audio_feed_cursor_start(struct audio_feed_cursor *c, unsigned long max_lag, enum performance_warning *pw)
+    {
+    const unsigned long limit = (c->ring->mask + 1) / 2;
+
+    c->pos = audio_feed_ring_write_pos(c->ring);
+    c->max_lag = (max_lag < limit) ? max_lag : limit;
+    c->frames_dropped = 0;
+    c->pw = pw;
+    }
+
+void audio_feed_cursor_attach(struct audio_feed_cursor *c, unsigned long max_lag, enum performance_warning *pw)
+    {
+    c->ring = &audio_feed->ring;
+    c->resampler = NULL;
+    audio_feed_cursor_start(c, max_lag, pw);
+    }
+
+int audio_feed_cursor_attach_resampled(struct audio_feed_cursor *c, unsigned long max_lag, enum performance_warning *pw, long target_rate, int quality)
+    {
+    struct audio_feed_resampler *r;
+
+    pthread_mutex_lock(&audio_feed->resampler_mutex);
+    for (r = audio_feed->resamplers; r; r = r->next)
+        if (r->target_rate == target_rate && r->quality == quality)
+            break;
+    if (!r && (r = audio_feed_resampler_new(target_rate, quality)))
+        {
+        r->next = audio_feed->resamplers;
+        audio_feed->resamplers = r;
         }
-      
-    return 0;
+    if (r)
+        {
+        r->users++;
+        c->ring = &r->ring;
+        c->resampler = r;
+        audio_feed_cursor_start(c, max_lag, pw);
+        }
+    pthread_mutex_unlock(&audio_feed->resampler_mutex);
+    return r ? SUCCEEDED : FAILED;
+    }
+
+void audio_feed_cursor_detach(struct audio_feed_cursor *c)
+    {
+    struct audio_feed_resampler *r = c->resampler, **rp;
+
+    if (!r)
+        return;
+    pthread_mutex_lock(&audio_feed->resampler_mutex);
+    if (!--r->users)
+        {
+        for (rp = &audio_feed->resamplers; *rp != r; rp = &(*rp)->next);
+        *rp = r->next;
+        audio_feed_resampler_free(r);
+        }
+    pthread_mutex_unlock(&audio_feed->resampler_mutex);
+    c->resampler = NULL;
+    c->ring = &audio_feed->ring;
+    }
+
+size_t audio_feed_available(struct audio_feed_cursor *c)
+    {
+    unsigned long wp, lag;
+
+    if (c->resampler)
+        audio_feed_resample(c->resampler);
+
+    wp = audio_feed_ring_write_pos(c->ring);
+    if ((lag = wp - c->pos) > c->max_lag)
+        {
+        c->pos += lag;
+        c->frames_dropped += lag;
+        if (c->pw)
+            *c->pw = PW_AUDIO_DATA_DROPPED;
+        }
+
+    return wp - c->pos;
+    }
+
+size_t audio_feed_read_stereo(struct audio_feed_cursor *c, float *left, float *right, size_t frames)
+    {
+    size_t available = audio_feed_available(c);
+
+    if (frames > available)
+        frames = available;
+    audio_feed_copy(c->ring, 0, c->pos, left, frames);
+    audio_feed_copy(c->ring, 1, c->pos, right, frames);
+    if (audio_feed_overrun(c->ring, c->pos))
+        return 0;       /* audio_feed_available will skip the reader forward */
+    c->pos += frames;
+    return frames;
+    }
+
+size_t audio_feed_read_mono(struct audio_feed_cursor *c, float *dest, size_t frames)
+    {
+    struct audio_feed_gain unity = { 1.0F, 1.0F, 1.0F };
+
+    return audio_feed_read_conditioned(c, &unity, dest, NULL, frames);
+    }
+
+/* audio_feed_ramp_run: dest = (a + b) * k * fade for n frames, b may be NULL
+ *
+ * The fade is kept as the gains of the next four frames so four frames are
+ * done at once.  Any leftover frames are done singly by shifting the ramp.
+ */
+static void audio_feed_ramp_run(struct audio_feed_ramp *rp, float k, float *dest, const sample_t *a, const sample_t *b, size_t n)
+    {
+    const v4sf kv = { k, k, k, k };
+    v4sf g = rp->g, x, y;
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+        {
+        memcpy(&x, a + i, sizeof x);
+        if (b)
+            {
+            memcpy(&y, b + i, sizeof y);
+            x += y;
+            }
+        x *= kv * g;
+        memcpy(dest + i, &x, sizeof x);
+        g *= rp->step4;
+        }
+    for (; i < n; ++i)
+        {
+        dest[i] = (b ? a[i] + b[i] : a[i]) * k * g[0];
+        g = (v4sf){ g[1], g[2], g[3], g[3] * rp->step };
+        }
+    rp->g = g;
+    }
+
+size_t audio_feed_read_conditioned(struct audio_feed_cursor *c, struct audio_feed_gain *gain, float *left, float *right, size_t frames)
+    {
+    struct audio_feed_ring *ring = c->ring;
+    const unsigned long offset = c->pos & ring->mask;
+    const sample_t *l = ring->buf[0], *r = ring->buf[1];
+    const float s = gain->fadescale, s2 = s * s;
+    /* the original fade multiplied in the scale before use hence the extra s */
+    const float k = gain->pregain * s * (right ? 1.0F : 0.5F);
+    size_t available = audio_feed_available(c), first;
+    struct audio_feed_ramp ramp, rramp;
+
+    if (frames > available)
+        frames = available;
+    if ((first = ring->mask + 1 - offset) > frames)
+        first = frames;
+
+    ramp.g = (v4sf){ 1.0F, s, s2, s2 * s } * gain->fadegain;
+    ramp.step = s;
+    ramp.step4 = (v4sf){ s2 * s2, s2 * s2, s2 * s2, s2 * s2 };
+
+    if (right)
+        {
+        rramp = ramp;
+        audio_feed_ramp_run(&ramp, k, left, l + offset, NULL, first);
+        audio_feed_ramp_run(&ramp, k, left + first, l, NULL, frames - first);
+        audio_feed_ramp_run(&rramp, k, right, r + offset, NULL, first);
+        audio_feed_ramp_run(&rramp, k, right + first, r, NULL, frames - first);
+        }
+    else
+        {
+        audio_feed_ramp_run(&ramp, k, left, l + offset, r + offset, first);
+        audio_feed_ramp_run(&ramp, k, left + first, l, r, frames - first);
+        }
+
+    if (audio_feed_overrun(ring, c->pos))
+        return 0;
+    gain->fadegain = ramp.g[0];
+    c->pos += frames;
+    return frames;
+    }
+
+void audio_feed_cursor_init(struct audio_feed_cursor *c, sem_t *wake)
+    {
+    c->wake = wake;
+    c->waiting = c->ready = 0;
+    }
+
+void audio_feed_arm(struct audio_feed_cursor *c, size_t frames)
+    {
+    struct audio_feed_resampler *r = c->resampler;
+    unsigned long have;
+
+    if (r)
+        {
+        /* the jack feed must deliver enough input to make up the shortfall */
+        have = audio_feed_ring_write_pos(&r->ring) - c->pos;
+        c->wake_pos = r->source.pos + (unsigned long)(((frames > have) ? frames - have : 1) / r->ratio) + 1;
+        }
+    else
+        c->wake_pos = c->pos + frames;
+    __sync_synchronize();
+    c->waiting = 1;
+    /* the audio may have arrived before the jack thread saw that we wait */
+    if ((long)(audio_feed_ring_write_pos(&audio_feed->ring) - c->wake_pos) >= 0 && __sync_bool_compare_and_swap(&c->waiting, 1, 0))
+        audio_feed_wake(c);
+    }
+
+void audio_feed_wake(struct audio_feed_cursor *c)
+    {
+    /* the flag is raised first so whoever the post wakes can see it */
+    c->ready = 1;
+    __sync_synchronize();
+    sem_post(c->wake);
+    }
+
+jack_nframes_t audio_feed_capture_time(struct audio_feed_cursor *c)
+    {
+    return audio_feed_stamp_at(c->ring, c->pos - 1);
+    }
+
+jack_nframes_t audio_feed_frame_time()
+    {
+    return jack_frame_time(g.client);
+    }
+
+unsigned long audio_feed_interval_ms(jack_nframes_t from, jack_nframes_t to)
+    {
+    /* the frame clock wraps so the difference is taken before the sign */
+    long frames = (int32_t)(to - from);
+
+    return (frames > 0) ? (unsigned long)frames * 1000UL / audio_feed->sample_rate : 0;
+    }
+
+unsigned long audio_feed_age_ms(jack_nframes_t frame_time)
+    {
+    return audio_feed_interval_ms(frame_time, audio_feed_frame_time());
+    }
+
+unsigned long audio_feed_deadline(struct audio_feed_cursor *c)
+    {
+    struct audio_feed_resampler *r = c->resampler;
+    unsigned long have;
+
+    if (!r)
+        return c->pos + c->max_lag;
+    /* converted audio not yet read counts against the time left */
+    if ((have = audio_feed_ring_write_pos(&r->ring) - c->pos) > c->max_lag)
+        have = c->max_lag;
+    return r->source.pos + (unsigned long)((c->max_lag - have) / r->ratio);
     }
 
 int audio_feed_jack_samplerate_request(struct threads_info *ti, struct universal_vars *uv, void *param)
@@ -115,12 +554,30 @@ struct audio_feed *audio_feed_init(struct threads_info *ti)
 
     self->threads_info = ti;      
     self->sample_rate = jack_get_sample_rate(g.client);
+    pthread_mutex_init(&self->resampler_mutex, NULL);
+    if (!audio_feed_ring_alloc(&self->ring, self->sample_rate * FEED_SECONDS))
+        {
+        fprintf(stderr, "audio_feed_init: malloc failure\n");
+        pthread_mutex_destroy(&self->resampler_mutex);
+        free(self);
+        return audio_feed = NULL;
+        }
+    self->ring.rate = 1.0;
     return self;
     }
 
 
 void audio_feed_destroy(struct audio_feed *self)
     {
+    struct audio_feed_resampler *r;
+
+    while ((r = self->resamplers))
+        {
+        self->resamplers = r->next;
+        audio_feed_resampler_free(r);
+        }
     self->threads_info->audio_feed = NULL;
+    audio_feed_ring_free(&self->ring);
+    pthread_mutex_destroy(&self->resampler_mutex);
     free(self);
     }
@@ -20,13 +20,59 @@
 #ifndef AUDIO_FEED_H
 #define AUDIO_FEED_H
 
+#include <semaphore.h>
+#include <pthread.h>
 #include <jack/jack.h>
+
+enum performance_warning { PW_OK, PW_AUDIO_DATA_DROPPED };
+
+/* when the audio at a ring position was captured, by the jack frame clock
+ * the writer makes seq odd while it changes the rest */
+struct audio_feed_stamp
+    {
+    volatile unsigned seq;
+    unsigned long pos;
+    jack_nframes_t frame_time;
+    };
+
+/* a ring with one writer and any number of readers each of their own position */
+struct audio_feed_ring
+    {
+    jack_default_audio_sample_t *buf[2];
+    unsigned long mask;                 /* ring size in frames less one */
+    volatile unsigned long write_pos;   /* frames written since the ring began */
+    struct audio_feed_stamp stamp;      /* renewed with each write */
+    double rate;                        /* ring frames per jack frame */
+    };
+
+/* a consumer's read position in the jack feed or in a resampled copy of it
+ *
+ * Positions count frames since the ring began and wrap.
+ */
+struct audio_feed_cursor
+    {
+    struct audio_feed_ring *ring;       /* what is read */
+    struct audio_feed_resampler *resampler;     /* the ring's owner or NULL for the jack feed */
+    unsigned long pos;
+    unsigned long max_lag;          /* tolerated backlog in frames after which audio is skipped */
+    volatile unsigned long frames_dropped;
+    enum performance_warning *pw;   /* the consumer's warning indicator */
+    sem_t *wake;                    /* posted when the consumer is made ready */
+    volatile int waiting;           /* set while armed for wake_pos */
+    volatile int ready;             /* the consumer has audio or was woken */
+    unsigned long wake_pos;         /* the jack feed write position that ends the wait */
+    };
+
+/* placed here so the cursor is defined however the headers are first included */
 #include "sourceclient.h"
 
 struct audio_feed
     {
     struct threads_info *threads_info;
     jack_nframes_t sample_rate;
+    struct audio_feed_ring ring;            /* one ring for all consumers, written once per period */
+    struct audio_feed_resampler *resamplers;    /* one per target rate and quality in use */
+    pthread_mutex_t resampler_mutex;        /* guards the above list */
     };
 
 struct audio_feed *audio_feed_init(struct threads_info *ti);
@@ -35,4 +81,52 @@ void audio_feed_destroy(struct audio_feed *self);
 int audio_feed_jack_samplerate_request(struct threads_info *ti, struct universal_vars *uv, void *param);
 int audio_feed_process_audio(jack_nframes_t n_frames, void *arg);
 
+/* audio_feed_max_lag: the largest usable max_lag, about half the ring */
+unsigned long audio_feed_max_lag();
+/* audio_feed_cursor_attach: start reading from the current write position */
+void audio_feed_cursor_attach(struct audio_feed_cursor *c, unsigned long max_lag, enum performance_warning *pw);
+/* audio_feed_cursor_attach_resampled: as above at target_rate
+ * the resampler for target_rate and quality is shared with any other cursor using it
+ * returns FAILED if the resampler could not be made */
+int audio_feed_cursor_attach_resampled(struct audio_feed_cursor *c, unsigned long max_lag, enum performance_warning *pw, long target_rate, int quality);
+/* audio_feed_cursor_detach: lets go of the resampler if any, reading must have stopped */
+void audio_feed_cursor_detach(struct audio_feed_cursor *c);
+/* audio_feed_available: frames ready to read
+ * a consumer lagging more than max_lag is moved forward and the skipped audio counted */
+size_t audio_feed_available(struct audio_feed_cursor *c);
+/* gain applied in the course of reading, the fade is multiplied by fadescale every frame */
+struct audio_feed_gain
+    {
+    float pregain;
+    float fadegain;                 /* advanced to where the fade got to */
+    float fadescale;
+    };
+
+/* the read functions return the number of frames read which may be less than asked for */
+size_t audio_feed_read_stereo(struct audio_feed_cursor *c, float *left, float *right, size_t frames);
+size_t audio_feed_read_mono(struct audio_feed_cursor *c, float *dest, size_t frames);
+/* audio_feed_read_conditioned: reads with the gain applied, downmixed into left when right is NULL
+ * this is the one pass over the audio between the ring and the encoder */
+size_t audio_feed_read_conditioned(struct audio_feed_cursor *c, struct audio_feed_gain *gain, float *left, float *right, size_t frames);
+
+/* audio_feed_capture_time: the jack frame time at which the last frame read was captured */
+jack_nframes_t audio_feed_capture_time(struct audio_feed_cursor *c);
+/* audio_feed_frame_time: the jack frame time now, for any thread */
+jack_nframes_t audio_feed_frame_time();
+/* audio_feed_interval_ms: milliseconds between jack frame times, 0 if to is the earlier */
+unsigned long audio_feed_interval_ms(jack_nframes_t from, jack_nframes_t to);
+/* audio_feed_age_ms: milliseconds since a jack frame time */
+unsigned long audio_feed_age_ms(jack_nframes_t frame_time);
+
+/* the waking side is only available to encoders, whom the jack thread knows to notify */
+void audio_feed_cursor_init(struct audio_feed_cursor *c, sem_t *wake);
+/* audio_feed_arm: have the consumer made ready once frames can be read
+ * which may be straight away, the wakeups may be spurious */
+void audio_feed_arm(struct audio_feed_cursor *c, size_t frames);
+/* audio_feed_wake: make the consumer ready now */
+void audio_feed_wake(struct audio_feed_cursor *c);
+/* audio_feed_deadline: the jack feed write position at which the consumer
+ * will start to lose audio, for the consumer itself to call */
+unsigned long audio_feed_deadline(struct audio_feed_cursor *c);
+
 #endif
@@ -155,15 +155,7 @@ static void live_avcodec_encoder_main(struct encoder *encoder)
                 switch (s->c->sample_fmt) {
                     case AV_SAMPLE_FMT_S16:
                         // todo: add dither
-                        {
-                            float *lp = id->buffer[0], *rp = id->buffer[1];
-                            int16_t *op = (int16_t *)s->inbuf;
-                            for (int i = 0; i < in_samples; ++i) {
-                                *op++ = (int16_t)(*lp++ * 32767.0);
-                                if (id->channels == 2)
-                                    *op++ = (int16_t)(*rp++ * 32767.0);
-                            }
-                        }
+                        encoder_ip_data_s16(id, (int16_t *)s->inbuf);
                         break;
                     case AV_SAMPLE_FMT_FLT:
                         {
@@ -468,6 +468,7 @@ int avcodecdecode_reg(struct xlplayer *xlplayer)
         nanosleep(&time_delay, NULL);
     if ((self->stream = av_find_best_stream(self->ic, AVMEDIA_TYPE_AUDIO, -1, -1, &self->codec, 0)) < 0)
         {
+        pthread_mutex_unlock(&g.avc_mutex);
         fprintf(stderr, "Cannot find an audio stream in the input file\n");
         avformat_close_input(&self->ic);
         free(self);
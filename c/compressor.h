@@ -17,6 +17,9 @@
 #   If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
 #include <jack/jack.h>
 
 typedef jack_default_audio_sample_t compaudio_t;
@@ -51,3 +54,5 @@ struct normalizer
 compaudio_t compressor(struct compressor *self, compaudio_t signal, int skip_rms);
 compaudio_t limiter(struct compressor *self, compaudio_t left, compaudio_t right);
 compaudio_t normalizer(struct normalizer *self, compaudio_t left, compaudio_t right);
+
+#endif /* COMPRESSOR_H */
@@ -0,0 +1,392 @@
+/*
+#   decprobe.c: content sniffing decoder selection for xlplayer
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../config.h"
+
+#include "gnusource.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "xlplayer.h"
+#include "mp3dec.h"
+#include "oggdec.h"
+#include "flacdecode.h"
+#include "sndfiledecode.h"
+#include "avcodecdecode.h"
+#include "httpsource.h"
+#include "decprobe.h"
+
+#define TRUE 1
+#define FALSE 0
+#define ACCEPTED 1
+#define REJECTED 0
+
+#define CACHE_SIZE 512              /* must be a power of two */
+#define EXTENSION_PENALTY 50        /* priority adjustment for decoders matched only by file extension */
+
+struct cache_entry
+    {
+    char *pathname;
+    time_t mtime;
+    off_t size;
+    const struct decprobe_entry *entry;
+    };
+
+static struct cache_entry cache[CACHE_SIZE];
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* magic byte tests */
+
+static int probe_ogg(const uint8_t *hdr, size_t len)
+    {
+    return len >= 4 && !memcmp(hdr, "OggS", 4);
+    }
+
+#ifdef HAVE_FLAC
+static int probe_flac(const uint8_t *hdr, size_t len)
+    {
+    return len >= 4 && !memcmp(hdr, "fLaC", 4);
+    }
+#endif
+
+static int probe_sndfile(const uint8_t *hdr, size_t len)
+    {
+    if (len < 12)
+        return FALSE;
+    return (!memcmp(hdr, "RIFF", 4) && !memcmp(hdr + 8, "WAVE", 4)) ||
+           (!memcmp(hdr, "RF64", 4) && !memcmp(hdr + 8, "WAVE", 4)) ||
+           (!memcmp(hdr, "riff", 4)) ||
+           (!memcmp(hdr, "FORM", 4) && (!memcmp(hdr + 8, "AIFF", 4) || !memcmp(hdr + 8, "AIFC", 4))) ||
+           (!memcmp(hdr, ".snd", 4));
+    }
+
+#ifdef HAVE_LIBAV
+static int probe_avcodec(const uint8_t *hdr, size_t len)
+    {
+    static const uint8_t asf_guid[] = { 0x30, 0x26, 0xB2, 0x75, 0x8E, 0x66, 0xCF, 0x11 };
+
+    if (len < 12)
+        return FALSE;
+    return (!memcmp(hdr + 4, "ftyp", 4)) ||                             /* MP4, M4A */
+           (!memcmp(hdr, asf_guid, sizeof asf_guid)) ||                 /* WMA */
+           (!memcmp(hdr, "RIFF", 4) && !memcmp(hdr + 8, "AVI ", 4)) ||
+           (!memcmp(hdr, "MPCK", 4) || !memcmp(hdr, "MP+", 3)) ||       /* musepack */
+           (!memcmp(hdr, "MAC ", 4)) ||                                 /* monkey's audio */
+           (hdr[0] == 0xFF && (hdr[1] & 0xF6) == 0xF0);                 /* ADTS AAC */
+    }
+
+/* libav gets to have a go at anything the other decoders could not handle */
+static int probe_any(const uint8_t *hdr, size_t len)
+    {
+    return TRUE;
+    }
+#endif /* HAVE_LIBAV */
+
+/* mpeg_frame_length: validate an mpeg audio frame header and return the frame length or 0 */
+static size_t mpeg_frame_length(const uint8_t *h)
+    {
+    static const int bitrates[5][15] = {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },   /* mpeg 1 layer 1 */
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },      /* mpeg 1 layer 2 */
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },       /* mpeg 1 layer 3 */
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },      /* mpeg 2 layer 1 */
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }};          /* mpeg 2 layers 2, 3 */
+    static const int samplerates[3] = { 44100, 48000, 32000 };
+    int version, layer, br_index, sr_index, padding, bitrate, samplerate, mpeg1;
+
+    if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0)
+        return 0;
+    version = (h[1] >> 3) & 0x3;        /* 0 = 2.5, 2 = 2, 3 = 1 */
+    layer = 4 - ((h[1] >> 1) & 0x3);
+    br_index = h[2] >> 4;
+    sr_index = (h[2] >> 2) & 0x3;
+    padding = (h[2] >> 1) & 0x1;
+    if (version == 1 || layer == 4 || br_index == 0 || br_index == 15 || sr_index == 3)
+        return 0;
+
+    mpeg1 = (version == 3);
+    bitrate = bitrates[mpeg1 ? layer - 1 : (layer == 1 ? 3 : 4)][br_index] * 1000;
+    samplerate = samplerates[sr_index] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+
+    if (layer == 1)
+        return (12 * bitrate / samplerate + padding) * 4;
+    if (layer == 3 && !mpeg1)
+        return 72 * bitrate / samplerate + padding;
+    return 144 * bitrate / samplerate + padding;
+    }
+
+static int probe_mpeg(const uint8_t *hdr, size_t len)
+    {
+    size_t i, flen;
+
+    /* tolerate some junk or padding ahead of the first frame, requiring a second frame to follow */
+    for (i = 0; i + 4 <= len; ++i)
+        if ((flen = mpeg_frame_length(hdr + i)))
+            {
+            if (i + flen + 4 > len)
+                return i == 0;
+            if (mpeg_frame_length(hdr + i + flen))
+                return TRUE;
+            }
+    return FALSE;
+    }
+
+static int mp3_reg(struct xlplayer *xlplayer)
+    {
+    return mpg123ok && mp3decode_reg(xlplayer);
+    }
+
+/* the registry of decoders */
+
+static const char * const ogg_ext[] = { "ogg", "oga",
+#ifdef HAVE_SPEEX
+    "spx",
+#endif
+#ifdef HAVE_OPUS
+    "opus",
+#endif
+    NULL };
+#ifdef HAVE_FLAC
+static const char * const flac_ext[] = { "flac", NULL };
+#endif
+static const char * const sndfile_ext[] = { "wav", "au", "aiff", NULL };
+#ifdef HAVE_LIBAV
+static const char * const avcodec_ext[] = { "aac", "m4a", "mp4", "m4b", "m4p", "wma", "avi", "mpc", "ape", NULL };
+#endif
+static const char * const mp3_ext[] = { "mp3", "mp2", NULL };
+
+static const struct decprobe_entry registry[] = {
+    { "ogg",        10, probe_ogg,      ogg_ext,        oggdecode_reg },
+#ifdef HAVE_FLAC
+    { "flac",       10, probe_flac,     flac_ext,       flacdecode_reg },
+#endif
+    { "sndfile",    20, probe_sndfile,  sndfile_ext,    sndfiledecode_reg },
+#ifdef HAVE_LIBAV
+    { "avcodec",    30, probe_avcodec,  avcodec_ext,    avcodecdecode_reg },
+#endif
+    { "mpg123",     40, probe_mpeg,     mp3_ext,        mp3_reg },
+#ifdef HAVE_LIBAV
+    { "avcodec",   100, probe_any,      NULL,           avcodecdecode_reg },
+#endif
+    };
+
+#define N_ENTRIES (sizeof registry / sizeof (struct decprobe_entry))
+
+/* probe cache */
+
+static unsigned cache_hash(const char *pathname)
+    {
+    unsigned h = 5381;
+
+    while (*pathname)
+        h = h * 33 ^ (unsigned char)*pathname++;
+    return h & (CACHE_SIZE - 1);
+    }
+
+static const struct decprobe_entry *cache_lookup(const char *pathname, struct stat *sb)
+    {
+    struct cache_entry *ce = &cache[cache_hash(pathname)];
+    const struct decprobe_entry *entry = NULL;
+
+    pthread_mutex_lock(&cache_mutex);
+    if (ce->pathname && !strcmp(ce->pathname, pathname) && ce->mtime == sb->st_mtime && ce->size == sb->st_size)
+        entry = ce->entry;
+    pthread_mutex_unlock(&cache_mutex);
+    return entry;
+    }
+
+static void cache_store(const char *pathname, struct stat *sb, const struct decprobe_entry *entry)
+    {
+    struct cache_entry *ce = &cache[cache_hash(pathname)];
+
+    pthread_mutex_lock(&cache_mutex);
+    if (!ce->pathname || strcmp(ce->pathname, pathname))
+        {
+        free(ce->pathname);
+        ce->pathname = strdup(pathname);
+        }
+    ce->mtime = sb->st_mtime;
+    ce->size = sb->st_size;
+    ce->entry = ce->pathname ? entry : NULL;
+    pthread_mutex_unlock(&cache_mutex);
+    }
+
+void decprobe_cache_flush()
+    {
+    pthread_mutex_lock(&cache_mutex);
+    for (int i = 0; i < CACHE_SIZE; ++i)
+        {
+        free(cache[i].pathname);
+        cache[i].pathname = NULL;
+        cache[i].entry = NULL;
+        }
+    pthread_mutex_unlock(&cache_mutex);
+    }
+
+/* id3v2_length: the number of bytes taken by an ID3v2 tag at the start of hdr or 0 */
+static long id3v2_length(const uint8_t *hdr, size_t len)
+    {
+    long length;
+
+    if (len < 10 || memcmp(hdr, "ID3", 3) || hdr[3] == 0xFF || (hdr[6] | hdr[7] | hdr[8] | hdr[9]) & 0x80)
+        return 0;
+    length = 10 + ((long)hdr[6] << 21 | (long)hdr[7] << 14 | (long)hdr[8] << 7 | (long)hdr[9]);
+    if (hdr[5] & 0x10)
+        length += 10;                       /* tag footer */
+    return length;
+    }
+
+/* read_header: fill hdr with the start of the file skipping over any ID3v2 tag */
+static size_t read_header(struct xlplayer *xlplayer, uint8_t *hdr)
+    {
+    FILE *fp;
+    size_t len;
+    long offset;
+
+    /* remote data is peeked at on the connection the decoder will be handed */
+    if (httpsource_is_url(xlplayer->pathname))
+        {
+        len = httpsource_probe(xlplayer, hdr, 0, DECPROBE_HEADER_SIZE);
+        if ((offset = id3v2_length(hdr, len)))
+            len = httpsource_probe(xlplayer, hdr, offset, DECPROBE_HEADER_SIZE);
+        return len;
+        }
+
+    if (!(fp = fopen(xlplayer->pathname, "r")))
+        return 0;
+    len = fread(hdr, 1, DECPROBE_HEADER_SIZE, fp);
+    if ((offset = id3v2_length(hdr, len)))
+        len = fseek(fp, offset, SEEK_SET) ? 0 : fread(hdr, 1, DECPROBE_HEADER_SIZE, fp);
+    fclose(fp);
+    return len;
+    }
+
+/* get_extension: copy the file extension into buf, empty when there is none
+ * a URL's query and fragment are not part of its path so are left out
+ */
+static char *get_extension(const char *pathname, int remote, char *buf, size_t size)
+    {
+    size_t end = remote ? strcspn(pathname, "?#") : strlen(pathname);
+    const char *p = pathname + end;
+
+    while (p > pathname && p[-1] != '.' && p[-1] != '/')
+        --p;
+    if (p == pathname || p[-1] != '.' || (size_t)(pathname + end - p) >= size)
+        *buf = '\0';
+    else
+        {
+        memcpy(buf, p, pathname + end - p);
+        buf[pathname + end - p] = '\0';
+        }
+    return buf;
+    }
+
+static int has_extension(const struct decprobe_entry *entry, const char *extension)
+    {
+    const char * const *ext;
+
+    if (entry->extensions)
+        for (ext = entry->extensions; *ext; ++ext)
+            if (!strcasecmp(*ext, extension))
+                return TRUE;
+    return FALSE;
+    }
+
+/* add_candidate: insertion sort by priority */
+static void add_candidate(const struct decprobe_entry **candidates, int *priorities, int *n_cand, const struct decprobe_entry *entry, int priority)
+    {
+    int i;
+
+    for (i = (*n_cand)++; i > 0 && priorities[i - 1] > priority; --i)
+        {
+        candidates[i] = candidates[i - 1];
+        priorities[i] = priorities[i - 1];
+        }
+    candidates[i] = entry;
+    priorities[i] = priority;
+    }
+
+/* try_reg: attempt registration with a decoder unless that decoder was tried already */
+static int try_reg(struct xlplayer *xlplayer, const struct decprobe_entry *entry, int (**tried)(struct xlplayer *), int *n_tried)
+    {
+    for (int i = 0; i < *n_tried; ++i)
+        if (tried[i] == entry->reg)
+            return REJECTED;
+    tried[(*n_tried)++] = entry->reg;
+    return entry->reg(xlplayer);
+    }
+
+int decprobe_reg(struct xlplayer *xlplayer)
+    {
+    struct stat sb;
+    uint8_t hdr[DECPROBE_HEADER_SIZE];
+    const struct decprobe_entry *entry, *candidates[N_ENTRIES * 2];
+    int priorities[N_ENTRIES * 2];
+    int (*tried[N_ENTRIES + 1])(struct xlplayer *);
+    int n_tried = 0, n_cand = 0, i, remote;
+    size_t len;
+    char *extension, extbuf[16];
+
+    /* remote resources are not cached since their content can change at any time */
+    if (!(remote = httpsource_is_url(xlplayer->pathname)) && stat(xlplayer->pathname, &sb))
+        {
+        fprintf(stderr, "decprobe_reg: unable to stat %s\n", xlplayer->pathname);
+        return REJECTED;
+        }
+
+    if (!remote && (entry = cache_lookup(xlplayer->pathname, &sb)))
+        {
+        if (try_reg(xlplayer, entry, tried, &n_tried))
+            return ACCEPTED;
+        fprintf(stderr, "decprobe_reg: cached decoder %s rejected %s\n", entry->name, xlplayer->pathname);
+        }
+
+    /* decoders whose magic bytes match are tried first, those matching
+     * only the file extension are the backstop for formats lacking a signature
+     */
+    len = read_header(xlplayer, hdr);
+    extension = get_extension(xlplayer->pathname, remote, extbuf, sizeof extbuf);
+    for (i = 0; i < (int)N_ENTRIES; ++i)
+        {
+        if (registry[i].probe(hdr, len))
+            add_candidate(candidates, priorities, &n_cand, &registry[i], registry[i].priority);
+        if (has_extension(&registry[i], extension))
+            add_candidate(candidates, priorities, &n_cand, &registry[i], registry[i].priority + EXTENSION_PENALTY);
+        }
+
+    for (i = 0; i < n_cand; ++i)
+        if (try_reg(xlplayer, candidates[i], tried, &n_tried))
+            {
+            if (remote)
+                httpsource_probe_done(xlplayer);
+            else
+                cache_store(xlplayer->pathname, &sb, candidates[i]);
+            return ACCEPTED;
+            }
+
+    if (remote)
+        httpsource_probe_done(xlplayer);
+    fprintf(stderr, "decprobe_reg: no decoder accepted %s\n", xlplayer->pathname);
+    return REJECTED;
+    }
@@ -0,0 +1,47 @@
+/*
+#   decprobe.h: content sniffing decoder selection for xlplayer
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DECPROBE_H
+#define DECPROBE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "xlplayer.h"
+
+#define DECPROBE_HEADER_SIZE 4096   /* amount of the file read for magic byte tests */
+
+struct decprobe_entry
+    {
+    const char *name;               /* used for diagnostics */
+    int priority;                   /* lower value is tried first when several probes match */
+    /* probe: returns true when the header block looks like something this decoder can play */
+    int (*probe)(const uint8_t *hdr, size_t len);
+    const char * const *extensions; /* NULL terminated list used when no probe matches */
+    int (*reg)(struct xlplayer *);  /* the decoder's registration function */
+    };
+
+/* decprobe_reg: select and register a decoder for xlplayer->pathname
+ * return value: ACCEPTED or REJECTED as per the individual decoder _reg functions */
+int decprobe_reg(struct xlplayer *xlplayer);
+
+/* decprobe_cache_flush: forget all remembered format detection results
+ * called at shutdown once no player can be probing */
+void decprobe_cache_flush();
+
+#endif /* DECPROBE_H */
@@ -49,6 +49,8 @@ static int (*format_none)(mpg123_handle *);
 static int (*param)(mpg123_handle *, enum mpg123_parms, long, double);
 static int (*init)();
 static int (*decode_frame)(mpg123_handle *, off_t *, unsigned char **, size_t *);
+static int (*open_handle)(mpg123_handle *, void *);
+static int (*replace_reader_handle)(mpg123_handle *, ssize_t (*)(void *, void *, size_t), off_t (*)(void *, off_t, int), void (*)(void *));
 
 static void dyn_mpg123_close()
     {
@@ -84,6 +86,10 @@ int dyn_mpg123_init()
         return 0;
         }
 
+    /* optional: used for http sources */
+    open_handle = dlsym(handle, "mpg123_open_handle");
+    replace_reader_handle = dlsym(handle, "mpg123_replace_reader_handle");
+
     atexit(dyn_mpg123_close);
     return 1;
     }
@@ -152,5 +158,15 @@ int mpg123_decode_frame(mpg123_handle *mh, off_t *num, unsigned char **audio, si
     {
     return decode_frame(mh, num, audio, bytes);
     }
+
+int mpg123_open_handle(mpg123_handle *mh, void *iohandle)
+    {
+    return open_handle ? open_handle(mh, iohandle) : MPG123_ERR;
+    }
+
+int mpg123_replace_reader_handle(mpg123_handle *mh, ssize_t (*r_read)(void *, void *, size_t), off_t (*r_lseek)(void *, off_t, int), void (*cleanup)(void *))
+    {
+    return replace_reader_handle ? replace_reader_handle(mh, r_read, r_lseek, cleanup) : MPG123_ERR;
+    }
     
 #endif /* DYN_MPG123 */
@@ -25,9 +25,9 @@
 #include <string.h>
 #include <time.h>
 #include <stdint.h>
+#include <unistd.h>
 #include <jack/ringbuffer.h>
 #include "sourceclient.h"
-#include "sig.h"
 #include "live_ogg_encoder.h"
 #include "live_mp3_encoder.h"
 #include "live_mp2_encoder.h"
@@ -36,16 +36,24 @@
 #include "live_oggopus_encoder.h"
 #include "avcodec_encoder.h"
 #include "bsdcompat.h"
+#include "packetpool.h"
+#include "encoderpool.h"
 #include "main.h"
 #ifdef DYN_LAME
 #include "dyn_lame.h"
 #endif
 
-#define RS_INPUT_SAMPLES 512
+#define IP_BUFFER_SAMPLES 8192          /* the most any of the codecs asks for at once */
+#define IP_BUFFER_ALIGN 32              /* suits the widest vector loads */
+#define OP_QUEUE_BYTES 65536            /* a client falling this far behind skips the oldest audio */
+#define OP_QUEUE_LIMIT (16 * OP_QUEUE_BYTES) /* a client that stops reading loses the newest */
+#define OP_QUEUE_RESERVE 64             /* queue slots kept for the stream markers */
+#define OP_MARKER_FLAGS (PF_INITIAL | PF_FINAL | PF_HEADER | PF_METADATA)
+#define DISPATCH_RUNS 8                 /* encoder passes before a worker looks for a more urgent one */
 
 typedef jack_default_audio_sample_t sample_t;
 
-static const size_t rb_n_samples = 53000;       /* maximum number of samples to hold in the ring buffer */
+static const size_t max_lag_samples = 53000;   /* the backlog beyond which the feed skips us forward */
 static uint32_t encoder_packet_magic_number = 'I' << 24 | 'D' << 16 | 'J' << 8 | 'C';
 static const float fade_floor = 0.0003f;
 
@@ -137,32 +145,11 @@ static int encoder_get_resample_mode(char *rm_string)
     return -1;
     }
 
-static void encoder_free_input_ringbuffers(struct encoder *self)
+/* encoder_headers_clear: call with encoder.mutex held */
+static void encoder_headers_clear(struct encoder *encoder)
     {
-    struct timespec ms10 = { 0, 10000000 };
-    
-    if (self->jack_dataflow_control == JD_ON)
-        self->jack_dataflow_control = JD_FLUSH;
-    while (self->jack_dataflow_control != JD_OFF)
-        nanosleep(&ms10, NULL);
-    
-    if (self->input_rb[0])
-        jack_ringbuffer_free(self->input_rb[0]);
-    if (self->input_rb[1])
-        jack_ringbuffer_free(self->input_rb[1]);
-    self->input_rb[0] = self->input_rb[1] = NULL;
-    }
-
-static void encoder_free_resampler(struct encoder *self)
-    {
-    int i;
-    
-    for (i = 0; i < 2; i++)
-        if (self->src_state[i])
-            {
-            src_delete(self->src_state[i]);
-            self->src_state[i] = NULL;
-            }
+    while (encoder->n_headers)
+        packet_pool_unref(encoder->headers[--encoder->n_headers]);
     }
 
 static void encoder_plugin_terminate(struct encoder *self)
@@ -170,6 +157,7 @@ static void encoder_plugin_terminate(struct encoder *self)
     struct timespec ms10 = { 0, 10000000 };
         
     self->run_request_f = FALSE;
+    audio_feed_wake(&self->feed);
     if (self->encoder_state != ES_STOPPED)
         fprintf(stderr, "encoder_plugin_terminate: waiting for encoder to finish\n");
     while (self->encoder_state != ES_STOPPED)
@@ -179,273 +167,252 @@ static void encoder_plugin_terminate(struct encoder *self)
 static void encoder_unlink(struct encoder *self)
     {
     encoder_plugin_terminate(self);
-    encoder_free_input_ringbuffers(self);
-    encoder_free_resampler(self);
+    audio_feed_cursor_detach(&self->feed);
+    pthread_mutex_lock(&self->mutex);
+    encoder_headers_clear(self);
+    pthread_mutex_unlock(&self->mutex);
     }
 
-static long encoder_input_rb_mono_downmix(jack_ringbuffer_t **rb, float *bptr, int max_samples)
-    {
-    jack_ringbuffer_data_t rbvec0[2], rbvec1[2];
-    sample_t *ch0, *ch1;
-    int transition, i;
-    long n_samples;
-
-    jack_ringbuffer_get_read_vector(rb[0], rbvec0);
-    jack_ringbuffer_get_read_vector(rb[1], rbvec1);
-    n_samples = (rbvec1[0].len + rbvec1[1].len) / sizeof (sample_t);
-    if (n_samples > max_samples)
-        n_samples = max_samples;
-    /* transition is the point at the end of the ringbuffer where we must wrap around */
-    if((transition = rbvec0[0].len / sizeof (sample_t)) > n_samples)
-        transition = n_samples;
-    ch0 = (sample_t *)rbvec0[0].buf;     /* set channel 0 and 1 pointers */
-    ch1 = (sample_t *)rbvec1[0].buf;
-    for (i = 0; i < transition; i++)
-        *bptr++ = (*ch0++ + *ch1++) * 0.5F;       /* copy up to the transition */
-    ch0 = (sample_t *)rbvec0[1].buf;     /* set pointers for segment 2 */
-    ch1 = (sample_t *)rbvec1[1].buf;
-    for (i = transition; i < n_samples; i++)     /* do the second segment if relevant */
-        *bptr++ = (*ch0++ + *ch1++) * 0.5F;
-    jack_ringbuffer_read_advance(rb[0], n_samples * sizeof (sample_t));
-    jack_ringbuffer_read_advance(rb[1], n_samples * sizeof (sample_t));
-    return n_samples;
-    }
-    
-static long encoder_input_rb_stereo(jack_ringbuffer_t **rb, float **dest, long max_samples)
+/* encoder_ip_buffer_reserve: grow the input buffers to hold at least n_samples
+ *
+ * The buffers are kept for the life of the encoder so after the first
+ * few calls no further allocation takes place.
+ */
+static int encoder_ip_buffer_reserve(struct encoder *encoder, size_t n_samples)
     {
-    long n_samples;
-    int i;
+    void *p;
 
-    n_samples = jack_ringbuffer_read_space(rb[1]) / sizeof (sample_t);
-    if (n_samples > max_samples)
-        n_samples = max_samples;
-    for (i = 0; i < 2; i++, rb++, dest++)
-        jack_ringbuffer_read(*rb, (char *)*dest, n_samples * sizeof (sample_t));
-    return n_samples;
-    }
-    
-static long encoder_input_rb_one_channel(jack_ringbuffer_t **rb, float **dest, long max_samples, int c)
-    {
-    long n_samples;
-
-    n_samples = jack_ringbuffer_read_space(rb[c]) / sizeof (sample_t);
-    if (n_samples > max_samples)
-        n_samples = max_samples;
-    jack_ringbuffer_read(rb[c], (char *)dest[c], n_samples * sizeof (sample_t));
-    return n_samples;
-    }
+    if (n_samples <= encoder->ip_buffer_size)
+        return SUCCEEDED;
 
-static long encoder_resampler_get_data(void *cb_data, float **data)
-    {
-    struct encoder *encoder = cb_data;
-    long n_samples;
-    
-    if (encoder->rs_channel >= 0)
-        {
-        n_samples = encoder_input_rb_one_channel(encoder->input_rb, encoder->rs_input, RS_INPUT_SAMPLES, encoder->rs_channel);
-        *data = encoder->rs_input[encoder->rs_channel];
-        }
-    else
+    /* room for the largest request with any codec so growth happens only once */
+    if (n_samples < IP_BUFFER_SAMPLES)
+        n_samples = IP_BUFFER_SAMPLES;
+    for (int i = 0; i < 2; ++i)
         {
-        n_samples = encoder_input_rb_mono_downmix(encoder->input_rb, encoder->rs_input[0], RS_INPUT_SAMPLES);
-        *data = encoder->rs_input[0];
+        if (posix_memalign(&p, IP_BUFFER_ALIGN, n_samples * sizeof (sample_t)))
+            {
+            fprintf(stderr, "encoder_ip_buffer_reserve: malloc failure\n");
+            return FAILED;
+            }
+        free(encoder->ip_buffer[i]);
+        encoder->ip_buffer[i] = p;
         }
-
-    return (long)n_samples;
+    encoder->ip_buffer_size = n_samples;
+    return SUCCEEDED;
     }
 
+/* encoder_get_input_data: the returned data is a view into buffers owned by the encoder
+ * which remains valid until the next call */
 struct encoder_ip_data *encoder_get_input_data(struct encoder *encoder, size_t min_samples_needed, size_t max_samples, float **caller_supplied_buffer)
     {
-    struct encoder_ip_data *id;
-    ssize_t n_samples;
-    size_t samples_available;
+    struct encoder_ip_data *id = &encoder->ip_data;
     int i;
     
     if (max_samples == 0)
         return NULL;
     
-    if (!(id = calloc(1, sizeof (struct encoder_ip_data))))
-        {
-        fprintf(stderr, "encoder_get_input_data: malloc failure\n");
-        return NULL;
-        }
     id->channels = encoder->n_channels;
-    if (caller_supplied_buffer)
+    id->qty_samples = 0;
+    if ((id->caller_supplied_buffer = (caller_supplied_buffer != NULL)))
         {
         /* link callers own buffer into the encoder_input_data structure */
         for (i = 0; i < encoder->n_channels; i++)
             id->buffer[i] = caller_supplied_buffer[i];
-        id->caller_supplied_buffer = TRUE;
         }
     else
         {
-        /* make our own buffer */
+        if (!encoder_ip_buffer_reserve(encoder, max_samples))
+            return NULL;
         for (i = 0; i < encoder->n_channels; i++)
-            if (!(id->buffer[i] = malloc(max_samples * sizeof (sample_t))))
-                {
-                fprintf(stderr, "encoder_get_input_data: malloc failure\n");
-                goto no_data;
-                }
+            id->buffer[i] = encoder->ip_buffer[i];
         }
-    if (!encoder->resample_f)
+    /* a resampling encoder reads from a resampler that it shares with
+     * other encoders of the same rate and quality but is otherwise the same */
+    if (audio_feed_available(&encoder->feed) < min_samples_needed)
         {
-        if (jack_ringbuffer_read_space(encoder->input_rb[1]) / sizeof (sample_t) < min_samples_needed)
-            goto no_data;
-        if (encoder->n_channels == 2)
-            id->qty_samples = encoder_input_rb_stereo(encoder->input_rb, id->buffer, max_samples);
-        else
-            id->qty_samples = encoder_input_rb_mono_downmix(encoder->input_rb, id->buffer[0], max_samples);
+        encoder->feed_wanted = min_samples_needed;
+        goto no_data;
         }
-    else
-        {                 /* handle the resampling condition */
-        /* note 128 samples are held back to make sure the resampler gives the full number of samples on both reads */
-        n_samples = (ssize_t)(jack_ringbuffer_read_space(encoder->input_rb[1]) / sizeof (sample_t) * encoder->sr_conv_ratio) - 128;
-        samples_available = (n_samples > 0) ? n_samples : 0;
-        if (samples_available > max_samples)
-            samples_available = max_samples;
-        if (samples_available < min_samples_needed)
-            goto no_data;
-        if (encoder->n_channels == 2)
-            {
-            encoder->rs_channel = 0;
-            id->qty_samples = (size_t)src_callback_read(encoder->src_state[0], encoder->sr_conv_ratio, samples_available, id->buffer[0]);
-            encoder->rs_channel = 1;
-            src_callback_read(encoder->src_state[1], encoder->sr_conv_ratio, id->qty_samples, id->buffer[1]);
-            }
-        else
-            {
-            encoder->rs_channel = -1;
-            id->qty_samples = (size_t)src_callback_read(encoder->src_state[0], encoder->sr_conv_ratio, samples_available, id->buffer[0]);
-            }
-        if (id->qty_samples == 0)
-            goto no_data;
-        }
-
     pthread_mutex_lock(&encoder->fade_mutex);
-    if (encoder->pregain != 1.0f || encoder->fadescale != 1.0f)
+    if (encoder->pregain == 1.0f && encoder->fadescale == 1.0f && encoder->n_channels == 2)
+        id->qty_samples = audio_feed_read_stereo(&encoder->feed, id->buffer[0], id->buffer[1], max_samples);
+    else
         {
-        float pgain = encoder->pregain;
-        float fgain = 1.0f, fscale = encoder->fadescale; 
-
-        for (int i = 0; i < id->channels; ++i)
-            {
-            float *bp = id->buffer[i];
-            fgain = encoder->fadegain;
-            for (size_t s = id->qty_samples; s; --s)
-                *bp++ *= pgain * (fgain *= fscale); 
-            }
+        struct audio_feed_gain gain = { encoder->pregain, encoder->fadegain, encoder->fadescale };
 
-        if (fgain < fade_floor)
+        id->qty_samples = audio_feed_read_conditioned(&encoder->feed, &gain, id->buffer[0],
+                                (encoder->n_channels == 2) ? id->buffer[1] : NULL, max_samples);
+        if (gain.fadegain < fade_floor)
             encoder->fadegain = encoder->fadescale = 1.0f;
         else
-            encoder->fadegain = fgain;
+            encoder->fadegain = gain.fadegain;
         }
     pthread_mutex_unlock(&encoder->fade_mutex);
+    if (id->qty_samples == 0)
+        goto no_data;
+    encoder->capture_time = audio_feed_capture_time(&encoder->feed);
+    encoder->read_time = audio_feed_frame_time();
+    latency_record(&encoder->feed_latency, audio_feed_age_ms(encoder->capture_time));
 
     return id;
 
     no_data:
-    encoder_ip_data_free(id);
     return NULL;
     }
     
 void encoder_ip_data_free(struct encoder_ip_data *id)
     {
-    int i;
-    
-    if (!id->caller_supplied_buffer)
-        for (i = 0; i < id->channels; i++)
-            if (id->buffer[i])
-                free(id->buffer[i]);
-    free(id);
+    /* nothing to free since the buffers are reused, the data is simply finished with */
     }
 
-/* note encoder.mutex must be locked before helper threads can safely traverse 
-    encoder.output_chain to find the op structure to pass to this function */
-size_t encoder_write_packet(struct encoder_op *op, struct encoder_op_packet *packet)
+void encoder_ip_data_s16(struct encoder_ip_data *id, int16_t *dest)
     {
-    size_t packet_size, written;
-     
-    packet->header.magic = encoder_packet_magic_number;
-    packet->header.serial = op->encoder->oggserial;
-    packet_size = sizeof packet->header + packet->header.data_size;
-    while (packet_size > jack_ringbuffer_write_space(op->packet_rb))
-        {
-        if (jack_ringbuffer_read_space(op->packet_rb) == 0)
+    const float *lp = id->buffer[0], *rp = id->buffer[1];
+    const size_t n = id->qty_samples;
+    float l, r;
+
+    /* one loop per layout so neither has a branch in it to stop vectorisation */
+    if (id->channels == 2)
+        for (size_t i = 0; i < n; ++i)
+            {
+            l = lp[i] * 32767.0f;
+            r = rp[i] * 32767.0f;
+            dest[2 * i] = (int16_t)(l > 32767.0f ? 32767.0f : (l < -32767.0f ? -32767.0f : l));
+            dest[2 * i + 1] = (int16_t)(r > 32767.0f ? 32767.0f : (r < -32767.0f ? -32767.0f : r));
+            }
+    else
+        for (size_t i = 0; i < n; ++i)
             {
-            fprintf(stderr, "encoder_write_packet: packet too big to fit in the ringbuffer\n");
-            return 0;
+            l = lp[i] * 32767.0f;
+            dest[i] = (int16_t)(l > 32767.0f ? 32767.0f : (l < -32767.0f ? -32767.0f : l));
             }
-        encoder_client_free_packet(encoder_client_get_packet(op)); /* flush stale packets */
+    }
+
+/* encoder_op_push: give the client a reference to the packet
+ *
+ * The encoder thread is the only writer and the client the only reader so
+ * no locking is needed.  Since the writer may not take packets back off the
+ * queue a client that falls behind drops the oldest audio as it reads.  Only
+ * a client that stops reading altogether is refused audio here, the stream
+ * markers are always queued so serials are never left open or headerless.
+ */
+static void encoder_op_push(struct encoder_op *op, struct encoder_op_packet *packet)
+    {
+    const size_t size = packet->header.data_size;
+    const unsigned long used = op->queue_write - op->queue_read;
+
+    if (used == ENCODER_OP_QUEUE_SIZE || (!(packet->header.flags & OP_MARKER_FLAGS)
+                && (used >= ENCODER_OP_QUEUE_SIZE - OP_QUEUE_RESERVE || op->queue_bytes + size > OP_QUEUE_LIMIT)))
+        {
         op->performance_warning_indicator = PW_AUDIO_DATA_DROPPED;
+        return;
+        }
+    packet_pool_ref(packet);
+    op->queue[op->queue_write & (ENCODER_OP_QUEUE_SIZE - 1)] = packet;
+    __sync_add_and_fetch(&op->queue_bytes, size);
+    __sync_synchronize();
+    op->queue_write++;
+    /* a client that has yet to empty the queue will find this packet without being told */
+    __sync_synchronize();
+    if (op->notify_fd >= 0 && op->queue_write - op->queue_read == 1)
+        {
+        uint64_t one = 1;
+
+        if (write(op->notify_fd, &one, sizeof one) != sizeof one)
+            fprintf(stderr, "encoder_op_push: failed to notify the client\n");
         }
-    pthread_mutex_lock(&op->mutex);
-    written = jack_ringbuffer_write(op->packet_rb, (char *)&packet->header, sizeof packet->header);
-    written += jack_ringbuffer_write(op->packet_rb, (char *)packet->data, packet->header.data_size);
-    pthread_mutex_unlock(&op->mutex);
-    return written;
     }
-    
-void encoder_write_packet_all(struct encoder *encoder, struct encoder_op_packet *packet)
+
+struct encoder_op_packet *encoder_packet_alloc(struct encoder *encoder, size_t data_size)
+    {
+    return packet_pool_get(encoder->packet_pool, data_size);
+    }
+
+/* note encoder.mutex keeps the output_chain from changing under us */
+void encoder_packet_send(struct encoder *encoder, struct encoder_op_packet *packet)
     {
     struct encoder_op *iter;
     struct timespec ms10 = { 0, 10000000 };
     
+    packet->header.magic = encoder_packet_magic_number;
+    packet->header.serial = encoder->oggserial;
+    /* lets clients see how much audio each packet or page carries */
+    if (packet->header.serial != encoder->sent_serial)
+        encoder->sent_timestamp = 0.0;
+    packet->header.duration = packet->header.timestamp - encoder->sent_timestamp;
+    if (packet->header.duration < 0.0)
+        packet->header.duration = 0.0;
+    encoder->sent_timestamp = packet->header.timestamp;
+    encoder->sent_serial = packet->header.serial;
+    packet->header.capture_time = encoder->capture_time;
+    packet->header.send_time = audio_feed_frame_time();
+    if (!(packet->header.flags & (PF_HEADER | PF_METADATA)))
+        latency_record(&encoder->encode_latency, audio_feed_age_ms(encoder->read_time));
     while (pthread_mutex_trylock(&encoder->mutex))
         nanosleep(&ms10, NULL);
+    /* the header pages of the serial are kept for clients that join later */
+    if (packet->header.flags & (PF_INITIAL | PF_FINAL))
+        encoder_headers_clear(encoder);
+    if ((packet->header.flags & PF_HEADER) && encoder->n_headers < ENCODER_HEADERS_MAX)
+        {
+        packet_pool_ref(packet);
+        encoder->headers[encoder->n_headers++] = packet;
+        }
     for (iter = encoder->output_chain; iter; iter = iter->next)
-        encoder_write_packet(iter, packet);
+        encoder_op_push(iter, packet);
     pthread_mutex_unlock(&encoder->mutex);
+    packet_pool_unref(packet);
     }
 
+void encoder_write_packet_all(struct encoder *encoder, struct encoder_op_packet *packet)
+    {
+    struct encoder_op_packet *pooled;
+
+    if (!(pooled = encoder_packet_alloc(encoder, packet->header.data_size)))
+        return;
+    pooled->header = packet->header;
+    memcpy(pooled->data, packet->data, packet->header.data_size);
+    encoder_packet_send(encoder, pooled);
+    }
+
+/* encoder_client_get_packet: the client's reference to the next packet or NULL
+ * the packet is shared so it must be treated as read-only */
 struct encoder_op_packet *encoder_client_get_packet(struct encoder_op *op)
     {
     struct encoder_op_packet *packet;
+    size_t behind;
     
-    pthread_mutex_lock(&op->mutex);
-    if (jack_ringbuffer_read_space(op->packet_rb) >= sizeof (struct encoder_op_packet_header))
+    for (;;)
         {
-        if (!(packet = calloc(1, sizeof (struct encoder_op_packet))))
-            {
-            fprintf(stderr, "encoder_client_get_packet: malloc failure\n");
-            goto unlock;
-            }
-        jack_ringbuffer_read(op->packet_rb, (char *)packet, sizeof (struct encoder_op_packet_header));
+        if (op->queue_read == op->queue_write)
+            return NULL;
+        __sync_synchronize();
+        packet = op->queue[op->queue_read & (ENCODER_OP_QUEUE_SIZE - 1)];
+        behind = __sync_sub_and_fetch(&op->queue_bytes, packet->header.data_size);
+        __sync_synchronize();
+        op->queue_read++;
+
         if (packet->header.magic != encoder_packet_magic_number)
             {
             fprintf(stderr, "encoder_client_get_packet: magic number missing\n");
-            free(packet);
-            goto unlock;
+            packet_pool_unref(packet);
+            return NULL;
             }
-        if (jack_ringbuffer_read_space(op->packet_rb) < packet->header.data_size)
+        /* catch up a whole packet at a time keeping the stream markers */
+        if (behind > OP_QUEUE_BYTES && !(packet->header.flags & OP_MARKER_FLAGS))
             {
-            fprintf(stderr, "encoder_client_get_packet: packet header specifying more data than can fit in the buffer\n");
-            free(packet);
-            goto unlock;
-            }   
-        if (packet->header.data_size)
-            {
-            if (!(packet->data = malloc(packet->header.data_size)))
-                {
-                fprintf(stderr, "encoder_client_get_packet: malloc failure for data buffer\n");
-                free(packet);
-                goto unlock;
-                }
-            jack_ringbuffer_read(op->packet_rb, packet->data, packet->header.data_size);
+            op->performance_warning_indicator = PW_AUDIO_DATA_DROPPED;
+            packet_pool_unref(packet);
+            continue;
             }
-        pthread_mutex_unlock(&op->mutex);
         return packet;
         }
-    unlock:
-    pthread_mutex_unlock(&op->mutex);
-    return NULL;
     }
     
 void encoder_client_free_packet(struct encoder_op_packet *packet)
     {
-    if (packet->data)
-        free(packet->data);
-    free(packet);
+    packet_pool_unref(packet);
     }
 
 int encoder_client_set_flush(struct encoder_op *op)
@@ -459,11 +426,31 @@ int encoder_client_set_flush(struct encoder_op *op)
     serial = encoder->oggserial;
     encoder->flush = TRUE;
     pthread_mutex_unlock(&encoder->flush_mutex);
+    audio_feed_wake(&encoder->feed);
     return serial;
     }
 
 /* this is called from a recipient thread to obtain a handle for getting data */ 
 /* the numeric_id is the encoder that is requested */
+int encoder_client_join(struct encoder_op *op)
+    {
+    struct encoder *encoder = op->encoder;
+    struct encoder_op_packet *packet;
+    struct timespec ms10 = { 0, 10000000 };
+    int serial;
+
+    while (pthread_mutex_trylock(&encoder->mutex))
+        nanosleep(&ms10, NULL);
+    /* with the encoder held off nothing can arrive between the headers and what follows */
+    while ((packet = encoder_client_get_packet(op)))
+        encoder_client_free_packet(packet);
+    for (int i = 0; i < encoder->n_headers; ++i)
+        encoder_op_push(op, encoder->headers[i]);
+    serial = encoder->oggserial;
+    pthread_mutex_unlock(&encoder->mutex);
+    return serial;
+    }
+
 struct encoder_op *encoder_register_client(struct threads_info *ti, int numeric_id)
     {
     struct encoder *enc;
@@ -480,15 +467,9 @@ struct encoder_op *encoder_register_client(struct threads_info *ti, int numeric_
         fprintf(stderr, "encoder_register_client: malloc failure\n");
         return NULL;
         }
-    if (!(op->packet_rb = jack_ringbuffer_create(65536)))
-        {
-        fprintf(stderr, "encoder_register_client: malloc failure\n");
-        free(op);
-        return NULL;
-        }
     enc = ti->encoder[numeric_id];
     op->encoder = enc;
-    pthread_mutex_init(&op->mutex, NULL);
+    op->notify_fd = -1;
     while (pthread_mutex_trylock(&op->encoder->mutex))
         nanosleep(&ms10, NULL);
     op->next = enc->output_chain;
@@ -498,9 +479,16 @@ struct encoder_op *encoder_register_client(struct threads_info *ti, int numeric_
     return op;
     }
     
+void encoder_client_set_notify(struct encoder_op *op, int fd)
+    {
+    op->notify_fd = fd;
+    __sync_synchronize();
+    }
+
 void encoder_unregister_client(struct encoder_op *op)
     {
     struct encoder_op *iter;
+    struct encoder_op_packet *packet;
     struct timespec ms10 = { 0, 10000000 };      /* ten milliseconds */
     
     fprintf(stderr, "encoder_unregister_client called\n");
@@ -516,21 +504,26 @@ void encoder_unregister_client(struct encoder_op *op)
         }
     op->encoder->client_count--;
     pthread_mutex_unlock(&op->encoder->mutex);
-    pthread_mutex_destroy(&op->mutex);
-    jack_ringbuffer_free(op->packet_rb);
+    /* the encoder no longer sees us so what remains queued may be released */
+    while ((packet = encoder_client_get_packet(op)))
+        encoder_client_free_packet(packet);
     free(op);
     fprintf(stderr, "encoder_unregister_client finished\n");
     }
 
-void *encoder_main(void *args)
+/* encoder_dispatch: runs the encoder as far as the audio allows
+ *
+ * An encoder short of audio is armed for the jack thread to make it ready
+ * once the amount it asked for has arrived.  A stopped encoder waits for
+ * encoder_start.  One with work left after its share of passes is made
+ * ready again straight away to be weighed against the others.
+ */
+void encoder_dispatch(struct encoder *self)
     {
-    struct encoder *self = args;
-    struct timespec ms10 = { 0, 10000000 };      /* ten milliseconds */
-
-    sig_mask_thread();
-    while(!self->thread_terminate_f)
+    for (int i = 0; i < DISPATCH_RUNS; ++i)
         {
         pthread_mutex_lock(&self->flush_mutex);
+        self->feed_wanted = 0;
         switch(self->encoder_state)
             {
             case ES_STOPPED:
@@ -543,9 +536,18 @@ void *encoder_main(void *args)
                 break;
             }
         pthread_mutex_unlock(&self->flush_mutex);
-        nanosleep(&ms10, NULL);
+
+        if (self->encoder_state == ES_STOPPED)
+            return;
+        if (self->feed_wanted)
+            {
+            self->deadline = audio_feed_deadline(&self->feed);
+            audio_feed_arm(&self->feed, self->feed_wanted);
+            return;
+            }
         }
-    return NULL;
+    self->deadline = audio_feed_deadline(&self->feed);
+    audio_feed_wake(&self->feed);
     }
 
 int encoder_start(struct threads_info *ti, struct universal_vars *uv, void *other)
@@ -554,13 +556,15 @@ int encoder_start(struct threads_info *ti, struct universal_vars *uv, void *othe
     struct encoder_vars *ev = other;
     struct timespec ms10 = { 0, 10000000 };
     int (*encoder_init)(struct encoder *, struct encoder_vars *) = NULL;
-    int i, resample_mode, error;
+    int resample_mode;
 
     if (self->encoder_state != ES_STOPPED)
         {
         fprintf(stderr, "encoder_start: encoder state out of control - shouldn't be marked as running\n");
         goto failed;
         }
+    if (!encoder_pool_start(ti->encoder_pool))
+        goto failed;
 
     self->data_format = encoder_lex_format(ev->encode_source, ev->family, ev->codec);
 
@@ -636,9 +640,10 @@ int encoder_start(struct threads_info *ti, struct universal_vars *uv, void *othe
     self->samplerate = (long)self->threads_info->audio_feed->sample_rate;
     self->target_samplerate = atol(ev->samplerate);
     self->resample_f = !(self->samplerate == self->target_samplerate);
-    self->sr_conv_ratio = (double)self->target_samplerate / (double)self->samplerate;
     self->pregain = atof(ev->pregain);
     self->fadegain = self->fadescale = 1.0f;
+    latency_reset(&self->feed_latency);
+    latency_reset(&self->encode_latency);
     if (ev->bitrate)
         self->bitrate = atoi(ev->bitrate);
     self->n_channels = strcmp(ev->mode, "mono") ? 2 : 1;
@@ -646,34 +651,24 @@ int encoder_start(struct threads_info *ti, struct universal_vars *uv, void *othe
         self->new_metadata = TRUE;
     if (self->resample_f)
         {
-        fprintf(stderr, "encoder_start: initiating resampler(s)\n");
+        fprintf(stderr, "encoder_start: using a shared resampler\n");
         resample_mode = encoder_get_resample_mode(ev->resample_quality);
-        for (i = 0; i < self->n_channels; i++)
-            {
-            if (!(self->src_state[i] = src_callback_new(encoder_resampler_get_data, resample_mode, 1, &error, self)))
-                goto failed;
-            src_set_ratio(self->src_state[i], self->sr_conv_ratio);
-            }
+        if (!audio_feed_cursor_attach_resampled(&self->feed, max_lag_samples, &self->performance_warning_indicator, self->target_samplerate, resample_mode))
+            goto failed;
         }
     else
+        {
         fprintf(stderr, "encoder_start: resampler will not be used\n");
+        audio_feed_cursor_attach(&self->feed, max_lag_samples, &self->performance_warning_indicator);
+        }
         
     if (encoder_init && encoder_init(self, ev))
         {
-        if (self->data_format.source == ENCODER_SOURCE_JACK)
-            {
-            self->input_rb[0] = jack_ringbuffer_create(rb_n_samples * sizeof (sample_t));
-            self->input_rb[1] = jack_ringbuffer_create(rb_n_samples * sizeof (sample_t));
-            if (!(self->input_rb[0] && self->input_rb[1]))
-                {
-                fprintf(stderr, "encoder_start: jack ringbuffer creation failure\n");
-                goto failed;
-                }
-            self->jack_dataflow_control = JD_ON;
-            }
 
         self->run_request_f = TRUE;
+        self->deadline = audio_feed_deadline(&self->feed);
         self->encoder_state = ES_STARTING;
+        audio_feed_wake(&self->feed);
         while (self->encoder_state == ES_STARTING)
             nanosleep(&ms10, NULL);
         while (self->encoder_state == ES_STOPPING)
@@ -722,6 +717,18 @@ int encoder_initiate_fade(struct threads_info *ti, struct universal_vars *uv, vo
     
     return SUCCEEDED;
     }
+
+/* encoder_make_report: the latency figures are median/99th percentile in ms */
+int encoder_make_report(struct encoder *self)
+    {
+    char feed[24], encode[24];
+
+    latency_format(&self->feed_latency, feed, sizeof feed);
+    latency_format(&self->encode_latency, encode, sizeof encode);
+    fprintf(g.out, "idjcsc: encoder%dreport=%d:%lu:%s:%s\n", self->numeric_id, (int)self->encoder_state, self->feed.frames_dropped, feed, encode);
+    fflush(g.out);
+    return SUCCEEDED;
+    }
  
 int encoder_new_song_metadata(struct threads_info *ti, struct universal_vars *uv, void *other)
     {
@@ -789,6 +796,7 @@ int encoder_new_custom_metadata(struct threads_info *ti, struct universal_vars *
     if (self->use_metadata)
         self->new_metadata = TRUE;
     pthread_mutex_unlock(&self->metadata_mutex);
+    audio_feed_wake(&self->feed);
     return SUCCEEDED;
     }
 
@@ -801,9 +809,7 @@ struct encoder *encoder_init(struct threads_info *ti, int numeric_id)
         fprintf(stderr, "encoder_init: malloc failure\n");
         return NULL;
         }
-    self->rs_input[0] = malloc(RS_INPUT_SAMPLES * sizeof (sample_t));
-    self->rs_input[1] = malloc(RS_INPUT_SAMPLES * sizeof (sample_t));
-    if (!(self->rs_input[0] && self->rs_input[1]))
+    if (!(self->packet_pool = packet_pool_create()))
         {
         fprintf(stderr, "encoder_init: malloc failure\n");
         free(self);
@@ -820,27 +826,21 @@ struct encoder *encoder_init(struct threads_info *ti, int numeric_id)
     pthread_mutex_init(&self->metadata_mutex, NULL);
     pthread_mutex_init(&self->flush_mutex, NULL);
     pthread_mutex_init(&self->fade_mutex, NULL);
-    if (pthread_create(&self->thread_h, NULL, encoder_main, self))
-        {
-        fprintf(stderr, "encoder_init: pthread_create call failed\n");
-        return NULL;
-        }
-    /* the input ringbuffer will be allocated when the encoder is started */
+    audio_feed_cursor_init(&self->feed, &ti->encoder_pool->work);
+    /* the feed is attached when the encoder is started */
     return self;
     }
 
 void encoder_destroy(struct encoder *self)
     {
-    self->thread_terminate_f = TRUE;
-    pthread_join(self->thread_h, NULL);
+    /* the encoder pool is already gone so nothing is running the encoder */
     pthread_mutex_destroy(&self->mutex);
     pthread_mutex_destroy(&self->metadata_mutex);
     pthread_mutex_destroy(&self->flush_mutex);
     pthread_mutex_destroy(&self->fade_mutex);
-    if (self->rs_input[0])
-        free(self->rs_input[0]);
-    if (self->rs_input[1])
-        free(self->rs_input[1]);
+    free(self->ip_buffer[0]);
+    free(self->ip_buffer[1]);
+    packet_pool_destroy(self->packet_pool);
     if (self->custom_meta)
         free(self->custom_meta);
     if (self->artist)
@@ -26,9 +26,11 @@
 #include <jack/ringbuffer.h>
 #include <pthread.h>
 #include "sourceclient.h"
+#include "latency.h"
+
+#define ENCODER_OP_QUEUE_SIZE 1024      /* packet references, a power of two */
+#define ENCODER_HEADERS_MAX 8           /* header pages kept for clients joining mid-stream */
 
-enum jack_dataflow { JD_OFF, JD_ON, JD_FLUSH };
-enum performance_warning { PW_OK, PW_AUDIO_DATA_DROPPED };
 enum encoder_source {ENCODER_SOURCE_UNHANDLED, ENCODER_SOURCE_JACK, ENCODER_SOURCE_FILE};
 enum encoder_family {ENCODER_FAMILY_UNHANDLED, ENCODER_FAMILY_MPEG, ENCODER_FAMILY_OGG};
 enum encoder_codec {ENCODER_CODEC_UNHANDLED, ENCODER_CODEC_MP3, ENCODER_CODEC_VORBIS, ENCODER_CODEC_FLAC, ENCODER_CODEC_SPEEX, ENCODER_CODEC_OPUS, ENCODER_CODEC_MP2, ENCODER_CODEC_AAC, ENCODER_CODEC_AACPLUSV2};
@@ -57,6 +59,8 @@ struct encoder_vars
     char *quality;
     char *complexity;
     char *framesize;
+    char *page_duration;         /* ogg page length in ms, optional */
+    char *page_packets;          /* ogg page length in codec packets, optional */
     char *mode;
     char *metadata_mode;
     char *standard;
@@ -95,6 +99,9 @@ struct encoder_op_packet_header
     enum packet_flags flags;             /* first, last, metadata, mp3, ogg, etc */
     int serial;                          /* the ogg serial number */
     double timestamp;                    /* time in seconds for this serial */
+    double duration;                     /* seconds of audio since the last packet, set on sending */
+    uint32_t capture_time;               /* jack frame time of the newest audio read before sending */
+    uint32_t send_time;                  /* jack frame time on sending */
     size_t data_size;                    /* how much data follows in bytes */
     };
 
@@ -108,9 +115,13 @@ struct encoder_op                       /* encoder output object */
     {
     struct encoder *encoder;             /* parent encoder */
     struct encoder_op *next;             /* the next encoder output object */
-    jack_ringbuffer_t *packet_rb;        /* ringbuffer containing ogg or mp3 packets */
-    enum performance_warning performance_warning_indicator; /* indicates ringbuffer overflow condition */
-    pthread_mutex_t mutex;               /* this enables the encoder to expire old output packets safely */
+    /* a single reader single writer queue of references to pooled ogg or mp3 packets */
+    struct encoder_op_packet *queue[ENCODER_OP_QUEUE_SIZE];
+    volatile unsigned long queue_write;
+    volatile unsigned long queue_read;
+    volatile size_t queue_bytes;         /* payload referenced by the queue */
+    int notify_fd;                       /* an eventfd written when the queue stops being empty or -1 */
+    enum performance_warning performance_warning_indicator; /* indicates queue overflow condition */
     };
 
 struct encoder_header_buffer
@@ -124,12 +135,16 @@ struct encoder
     {
     struct threads_info *threads_info;   /* link to the global data structure */
     int numeric_id;                      /* identitity of this encoder from 0 */
-    pthread_t thread_h;                  /* this encoder's pthread handle */
-    int thread_terminate_f;              /* signal the encoder thread to exit */
+    volatile int dispatched;             /* set while a pool worker runs the encoder */
+    unsigned long deadline;              /* jack feed position by which the encoder must run */
     int run_request_f;                   /* to run or not to run... */
     enum encoder_state encoder_state;    /* indicate what the encoder should be doing */
-    enum jack_dataflow jack_dataflow_control;    /* tells the jack callback routine what we want it to do */
-    jack_ringbuffer_t *input_rb[2];      /* circular buffer containing pcm audio data */
+    struct audio_feed_cursor feed;       /* read position in the shared pcm audio feed */
+    size_t feed_wanted;                  /* input frames the encoder is waiting for or 0 */
+    struct encoder_ip_data ip_data;      /* returned by encoder_get_input_data */
+    float *ip_buffer[2];                 /* the input buffers behind ip_data, kept between calls */
+    size_t ip_buffer_size;               /* their size in samples */
+    struct packet_pool *packet_pool;     /* where the encoded packets are kept */
     struct encoder_data_format data_format;
     int n_channels;                      /* stream parameters information... */
     int bitrate;
@@ -138,10 +153,6 @@ struct encoder
     float fadescale;                /* encoder fadeout rate */
     long samplerate;
     long target_samplerate;
-    double sr_conv_ratio;
-    SRC_STATE *src_state[2];     /* resampler variables */
-    float *rs_input[2];          /* buffer used by resampler input callback */
-    int rs_channel;              /* resampler callback channel control */
     int resample_f;              /* true or false to resampling required */
     int client_count;            /* number of streamers/recorders connected */
     pthread_mutex_t flush_mutex; /* to block encoder so it's in a known state before flush */
@@ -150,6 +161,8 @@ struct encoder
     pthread_mutex_t fade_mutex;     /* for blocking fade initiate while fade being processed */
     struct encoder_op *output_chain;     /* one output buffer per client connection */
     struct encoder_header_buffer *header_buffer; /* point to needed headers or NULL */
+    struct encoder_op_packet *headers[ENCODER_HEADERS_MAX]; /* the current serial's header pages */
+    int n_headers;                       /* guarded by mutex */
     enum performance_warning performance_warning_indicator; /* indicates ringbuffer overflow condition */
     char *custom_meta;           /* when this is set it is used for stream metadata - in the title tag of ogg streams */
     char *artist;                /* used for recordings' metadata - always utf-8 */
@@ -160,6 +173,14 @@ struct encoder
     int flush;
     int oggserial;               /* n.b. not restricted to ogg useage */
     double timestamp;            /* running counter in seconds for current serial */
+    double sent_timestamp;       /* that of the last packet sent and its serial */
+    int sent_serial;
+    uint32_t capture_time;       /* jack frame times for the newest audio read */
+    uint32_t read_time;
+    /* reading lags capture by feed_latency and sending lags reading by encode_latency
+     * audio held back inside the codec for lookahead is not counted */
+    struct latency_histogram feed_latency;
+    struct latency_histogram encode_latency;
     void (*run_encoder)(struct encoder *);       /* pointer to the encoder in use */
     void *encoder_private;               /* used by the specific encoder */
     };
@@ -167,20 +188,37 @@ struct encoder
 struct encoder *encoder_init(struct threads_info *ti, int numeric_id);
 int encoder_init_lame(struct threads_info *ti, struct universal_vars *uv, void *param);
 void encoder_destroy(struct encoder *self);
+/* encoder_dispatch: for the pool worker that has claimed the encoder */
+void encoder_dispatch(struct encoder *self);
 struct encoder_op_packet *encoder_client_get_packet(struct encoder_op *op);
 void encoder_client_free_packet(struct encoder_op_packet *packet);
 int encoder_client_set_flush(struct encoder_op *op);
-size_t encoder_write_packet(struct encoder_op *op, struct encoder_op_packet *packet);
+/* encoder_client_join: for the client's own thread, drops what is queued and resumes
+ * from the current serial's headers which the packets that follow carry on from
+ * returns the serial */
+int encoder_client_join(struct encoder_op *op);
+/* encoder_packet_alloc: a packet for the encoder to fill with data_size bytes and then send */
+struct encoder_op_packet *encoder_packet_alloc(struct encoder *enc, size_t data_size);
+/* encoder_packet_send: share the packet with all the clients, the caller gives up the packet */
+void encoder_packet_send(struct encoder *enc, struct encoder_op_packet *packet);
+/* encoder_write_packet_all: as above for data in the encoder's own buffer, which is copied */
 void encoder_write_packet_all(struct encoder *enc, struct encoder_op_packet *packet);
 struct encoder_op *encoder_register_client(struct threads_info *ti, int numeric_id);
+/* encoder_client_set_notify: have the encoder write to an eventfd as packets become available
+ * the client must drain its queue each time the eventfd is read */
+void encoder_client_set_notify(struct encoder_op *op, int fd);
 void encoder_unregister_client(struct encoder_op *op);
 int encoder_start(struct threads_info *ti, struct universal_vars *uv, void *other);
 int encoder_stop(struct threads_info *ti, struct universal_vars *uv, void *other);
 int encoder_initiate_fade(struct threads_info *ti, struct universal_vars *uv, void *other);
+int encoder_make_report(struct encoder *self);
 int encoder_update(struct threads_info *ti, struct universal_vars *uv, void *other);
 int encoder_new_song_metadata(struct threads_info *ti, struct universal_vars *uv, void *other);
 int encoder_new_custom_metadata(struct threads_info *ti, struct universal_vars *uv, void *other);
 void encoder_src_data_cleanup(struct encoder *self);
 struct encoder_ip_data *encoder_get_input_data(struct encoder *encoder, size_t min_samples_needed, size_t max_samples, float **caller_supplied_buffer);
+/* encoder_ip_data_free: marks the input data as finished with, no heap operations take place */
 void encoder_ip_data_free(struct encoder_ip_data *id);
+/* encoder_ip_data_s16: interleaved signed 16 bit copy of the input data, clipped rather than wrapped */
+void encoder_ip_data_s16(struct encoder_ip_data *id, int16_t *dest);
 #endif
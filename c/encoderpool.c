@@ -0,0 +1,136 @@
+/*
+#   encoderpool.c: worker threads shared by the encoders of the streaming module
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Encoders are jobs rather than threads.  The jack thread and the control
+ * functions make an encoder ready and post the pool's semaphore.  A worker
+ * then takes whichever ready encoder is nearest to losing audio, that is
+ * the one with the earliest deadline, and runs it for a while.
+ *
+ * An encoder is only ever run by one worker at a time.  The worker that
+ * lets go of an encoder checks whether it was made ready meanwhile and if
+ * so posts the semaphore again on its behalf.
+ */
+
+#include "../config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "sourceclient.h"
+#include "encoderpool.h"
+#include "sig.h"
+
+/* encoder_pool_pick: claim the ready encoder with the earliest deadline */
+static struct encoder *encoder_pool_pick(struct encoder_pool *self)
+    {
+    struct threads_info *ti = self->threads_info;
+    struct encoder *e, *best;
+
+    do {
+        best = NULL;
+        for (int i = 0; i < ti->n_encoders; ++i)
+            {
+            if (!(e = ti->encoder[i]) || !e->feed.ready || e->dispatched)
+                continue;
+            if (!best || (long)(e->deadline - best->deadline) < 0)
+                best = e;
+            }
+        if (!best)
+            return NULL;
+        } while (!__sync_bool_compare_and_swap(&best->dispatched, 0, 1));
+
+    best->feed.ready = 0;
+    return best;
+    }
+
+static void *encoder_pool_worker(void *args)
+    {
+    struct encoder_pool *self = args;
+    struct encoder *e;
+
+    sig_mask_thread();
+    for (;;)
+        {
+        while (sem_wait(&self->work) && errno == EINTR);
+        if (self->terminate)
+            break;
+        while ((e = encoder_pool_pick(self)))
+            {
+            encoder_dispatch(e);
+            e->dispatched = 0;
+            __sync_synchronize();
+            if (e->feed.ready)
+                sem_post(&self->work);
+            }
+        }
+    return NULL;
+    }
+
+struct encoder_pool *encoder_pool_init(struct threads_info *ti)
+    {
+    struct encoder_pool *self;
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (!(self = calloc(1, sizeof (struct encoder_pool))))
+        {
+        fprintf(stderr, "encoder_pool_init: malloc failure\n");
+        return NULL;
+        }
+    self->threads_info = ti;
+    /* more workers than encoders would only sit idle */
+    self->n_workers = (n_cpus < 1) ? 1 : n_cpus;
+    if (self->n_workers > ti->n_encoders)
+        self->n_workers = ti->n_encoders;
+    if (!(self->workers = calloc(self->n_workers ? self->n_workers : 1, sizeof (pthread_t))))
+        {
+        fprintf(stderr, "encoder_pool_init: malloc failure\n");
+        free(self);
+        return NULL;
+        }
+    sem_init(&self->work, 0, 0);
+    return self;
+    }
+
+int encoder_pool_start(struct encoder_pool *self)
+    {
+    if (self->thread_started)
+        return SUCCEEDED;
+
+    for (; self->n_started < self->n_workers; ++self->n_started)
+        if (pthread_create(&self->workers[self->n_started], NULL, encoder_pool_worker, self))
+            {
+            fprintf(stderr, "encoder_pool_start: pthread_create call failed\n");
+            return FAILED;
+            }
+    self->thread_started = TRUE;
+    fprintf(stderr, "encoder_pool_start: %d workers for %d encoders\n", self->n_workers, self->threads_info->n_encoders);
+    return SUCCEEDED;
+    }
+
+void encoder_pool_destroy(struct encoder_pool *self)
+    {
+    self->terminate = TRUE;
+    for (int i = 0; i < self->n_started; ++i)
+        sem_post(&self->work);
+    for (int i = 0; i < self->n_started; ++i)
+        pthread_join(self->workers[i], NULL);
+    sem_destroy(&self->work);
+    free(self->workers);
+    free(self);
+    }
@@ -0,0 +1,46 @@
+/*
+#   encoderpool.h: worker threads shared by the encoders of the streaming module
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ENCODERPOOL_H
+#define ENCODERPOOL_H
+
+#include <pthread.h>
+#include <semaphore.h>
+
+struct threads_info;
+
+struct encoder_pool
+    {
+    struct threads_info *threads_info;
+    int n_workers;
+    int n_started;
+    int thread_started;         /* the workers are launched on the first encoder_start */
+    pthread_t *workers;
+    sem_t work;                 /* posted whenever an encoder is made ready */
+    volatile int terminate;
+    };
+
+/* encoder_pool_init: one worker per processor, to be made before the encoders */
+struct encoder_pool *encoder_pool_init(struct threads_info *ti);
+/* encoder_pool_start: launch the workers if they are not already running */
+int encoder_pool_start(struct encoder_pool *self);
+/* encoder_pool_destroy: waits for the workers that were started to finish what they are doing */
+void encoder_pool_destroy(struct encoder_pool *self);
+
+#endif
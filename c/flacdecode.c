@@ -219,6 +219,7 @@ int flacdecode_reg(struct xlplayer *xlplayer)
         xlplayer->dec_eject = flacdecode_eject;
         return ACCEPTED;
         }
+    free(self);
     return REJECTED;
     }
 #endif
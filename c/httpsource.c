@@ -0,0 +1,699 @@
+/*
+#   httpsource.c: http input for the xlplayer decoders
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../config.h"
+
+#include "gnusource.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <jack/ringbuffer.h>
+
+#include "xlplayer.h"
+#include "httpsource.h"
+#include "sig.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#define HTTP_MAX_REDIRECTS 5
+#define HTTP_MAX_HEADER 16384
+#define HTTP_CHUNK 4096
+#define HTTP_TIMEOUT_S 10               /* connect and receive timeout */
+#define HTTP_STALL_TIMEOUT_MS 10000     /* the decoder gives up after waiting this long for data */
+#define HTTP_PREFETCH_SIZE (1 << 20)    /* read ahead for seekable files */
+#define HTTP_JITTER_SIZE (1 << 19)      /* jitter buffer for live streams */
+#define HTTP_JITTER_MS 2000             /* amount of live audio to have buffered before playback */
+#define HTTP_JITTER_DEFAULT 32768       /* used when the stream bitrate is not advertised */
+
+struct httpsource
+    {
+    struct xlplayer *xlplayer;
+    char *url;                          /* as requested i.e. before any redirect */
+    char *host;
+    char *port;
+    char *path;
+    int sock;
+    int seekable;
+    int64_t length;                     /* content length or -1 when unknown */
+    int64_t pos;                        /* stream offset of the next byte the decoder reads */
+    int metaint;                        /* icy-metaint or 0 */
+    int bitrate;                        /* icy-br in kbps or 0 */
+    jack_ringbuffer_t *rb;              /* prefetch or jitter buffer */
+    size_t prebuffer;                   /* the buffer level at which audio may flow */
+    int buffering;
+    int eof;
+    int stop;
+    int thread_running;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cv;
+    };
+
+int httpsource_is_url(const char *pathname)
+    {
+    return !strncasecmp(pathname, "http://", 7) || !strncasecmp(pathname, "https://", 8);
+    }
+
+/* parse_url: split url into host, port and path, only plain http is handled here */
+static int parse_url(struct httpsource *self, const char *url)
+    {
+    const char *host, *path, *colon;
+
+    if (strncasecmp(url, "http://", 7))
+        {
+        fprintf(stderr, "httpsource: unsupported url scheme %s\n", url);
+        return FALSE;
+        }
+    host = url + 7;
+    if ((path = strchr(host, '@')) && path < strchrnul(host, '/'))
+        host = path + 1;                /* credentials are not supported */
+    path = strchrnul(host, '/');
+    colon = memchr(host, ':', path - host);
+
+    free(self->host);
+    free(self->port);
+    free(self->path);
+    self->host = strndup(host, (colon ? colon : path) - host);
+    self->port = colon ? strndup(colon + 1, path - colon - 1) : strdup("80");
+    self->path = strdup(*path ? path : "/");
+    return self->host && self->port && self->path && *self->host;
+    }
+
+static int open_socket(struct httpsource *self)
+    {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res, *ai;
+    struct timeval tv = { .tv_sec = HTTP_TIMEOUT_S };
+    int rv;
+
+    if ((rv = getaddrinfo(self->host, self->port, &hints, &res)))
+        {
+        fprintf(stderr, "httpsource: failed to resolve %s: %s\n", self->host, gai_strerror(rv));
+        return -1;
+        }
+    for (ai = res; ai; ai = ai->ai_next)
+        {
+        if ((self->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+            continue;
+        setsockopt(self->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+        setsockopt(self->sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+        if (!connect(self->sock, ai->ai_addr, ai->ai_addrlen))
+            break;
+        close(self->sock);
+        self->sock = -1;
+        }
+    freeaddrinfo(res);
+    if (self->sock < 0)
+        fprintf(stderr, "httpsource: failed to connect to %s:%s\n", self->host, self->port);
+    return self->sock;
+    }
+
+static int send_all(int sock, const char *buf, size_t len)
+    {
+    ssize_t n;
+
+    while (len)
+        {
+        if ((n = send(sock, buf, len, MSG_NOSIGNAL)) < 0)
+            {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+            }
+        buf += n;
+        len -= n;
+        }
+    return TRUE;
+    }
+
+/* read_header: read the response header a byte at a time so no body data is consumed */
+static char *read_header(int sock)
+    {
+    char *header;
+    size_t fill = 0;
+    ssize_t n;
+
+    if (!(header = malloc(HTTP_MAX_HEADER)))
+        return NULL;
+    while (fill < HTTP_MAX_HEADER - 1)
+        {
+        if ((n = recv(sock, header + fill, 1, 0)) <= 0)
+            {
+            if (n < 0 && errno == EINTR)
+                continue;
+            break;
+            }
+        if (header[fill++] == '\n' && fill >= 2 && (header[fill - 2] == '\n' || (fill >= 4 && !memcmp(header + fill - 4, "\r\n\r\n", 4))))
+            {
+            header[fill] = '\0';
+            return header;
+            }
+        }
+    free(header);
+    return NULL;
+    }
+
+/* header_value: case insensitive lookup of a response header field */
+static char *header_value(char *header, const char *field, char *value, size_t size)
+    {
+    size_t len = strlen(field);
+    char *line, *end;
+
+    for (line = strchr(header, '\n'); line; line = strchr(line, '\n'))
+        if (!strncasecmp(++line, field, len) && line[len] == ':')
+            {
+            for (line += len + 1; *line == ' ' || *line == '\t'; ++line);
+            end = line + strcspn(line, "\r\n");
+            if ((size_t)(end - line) >= size)
+                end = line + size - 1;
+            memcpy(value, line, end - line);
+            value[end - line] = '\0';
+            return value;
+            }
+    return NULL;
+    }
+
+/* httpsource_connect: make the request for the resource starting at offset and parse the reply */
+static int httpsource_connect(struct httpsource *self, int64_t offset)
+    {
+    char request[2048], value[1024], *header, *p;
+    int redirects, status;
+
+    for (redirects = 0; redirects <= HTTP_MAX_REDIRECTS; ++redirects)
+        {
+        if (open_socket(self) < 0)
+            return FALSE;
+
+        snprintf(request, sizeof request, "GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: idjc\r\nAccept: */*\r\n%s", self->path, self->host, offset ? "" : "Icy-MetaData: 1\r\n");
+        if (offset)
+            snprintf(request + strlen(request), sizeof request - strlen(request), "Range: bytes=%lld-\r\n", (long long)offset);
+        strncat(request, "Connection: close\r\n\r\n", sizeof request - strlen(request) - 1);
+
+        if (!send_all(self->sock, request, strlen(request)) || !(header = read_header(self->sock)))
+            {
+            fprintf(stderr, "httpsource: no response from %s\n", self->host);
+            goto fail;
+            }
+
+        /* both HTTP/1.x and Shoutcast's ICY status lines are accepted */
+        if (!(p = strchr(header, ' ')) || (status = atoi(p + 1)) == 0)
+            {
+            fprintf(stderr, "httpsource: malformed response from %s\n", self->host);
+            free(header);
+            goto fail;
+            }
+
+        if (status >= 300 && status < 400 && header_value(header, "Location", value, sizeof value))
+            {
+            free(header);
+            close(self->sock);
+            self->sock = -1;
+            if (value[0] == '/')
+                {
+                free(self->path);
+                self->path = strdup(value);
+                }
+            else if (!parse_url(self, value))
+                return FALSE;
+            continue;
+            }
+
+        if (status != 200 && status != 206)
+            {
+            fprintf(stderr, "httpsource: server %s returned status %d\n", self->host, status);
+            free(header);
+            goto fail;
+            }
+
+        if (offset && status != 206)
+            {
+            fprintf(stderr, "httpsource: server %s ignored a range request\n", self->host);
+            free(header);
+            goto fail;
+            }
+
+        self->metaint = header_value(header, "icy-metaint", value, sizeof value) ? atoi(value) : 0;
+        self->bitrate = header_value(header, "icy-br", value, sizeof value) ? atoi(value) : 0;
+        if (status == 206 && header_value(header, "Content-Range", value, sizeof value) && (p = strchr(value, '/')) && p[1] != '*')
+            self->length = strtoll(p + 1, NULL, 10);
+        else if (status == 200)
+            self->length = header_value(header, "Content-Length", value, sizeof value) ? strtoll(value, NULL, 10) : -1;
+        if (status == 200)
+            self->seekable = self->metaint == 0 && self->length > 0 && header_value(header, "Accept-Ranges", value, sizeof value) && !strcasecmp(value, "bytes");
+        self->pos = offset;
+        self->eof = FALSE;
+        free(header);
+        return TRUE;
+
+fail:
+        close(self->sock);
+        self->sock = -1;
+        return FALSE;
+        }
+
+    fprintf(stderr, "httpsource: too many redirects\n");
+    return FALSE;
+    }
+
+static int is_utf8(const unsigned char *s)
+    {
+    int follow;
+
+    for (; *s; ++s)
+        {
+        if (*s < 0x80)
+            continue;
+        if ((*s & 0xE0) == 0xC0)
+            follow = 1;
+        else if ((*s & 0xF0) == 0xE0)
+            follow = 2;
+        else if ((*s & 0xF8) == 0xF0)
+            follow = 3;
+        else
+            return FALSE;
+        while (follow--)
+            if ((*++s & 0xC0) != 0x80)
+                return FALSE;
+        }
+    return TRUE;
+    }
+
+/* icy_metadata: pass StreamTitle on to the user interface timed to when the audio will be heard */
+static void icy_metadata(struct httpsource *self, char *meta)
+    {
+    char *title, *end;
+    int delay;
+
+    if (!(title = strstr(meta, "StreamTitle='")))
+        return;
+    title += 13;
+    if ((end = strstr(title, "';")) || (end = strrchr(title, '\'')))
+        *end = '\0';
+
+    delay = xlplayer_calc_rbdelay(self->xlplayer);
+    if (self->bitrate)
+        delay += jack_ringbuffer_read_space(self->rb) * 8 / self->bitrate;
+    xlplayer_set_dynamic_metadata(self->xlplayer, is_utf8((unsigned char *)title) ? DM_JOINED_U8 : DM_JOINED_L1, "", title, "", delay);
+    }
+
+static void *httpsource_reader(void *args)
+    {
+    struct httpsource *self = args;
+    char buf[HTTP_CHUNK], meta[4096], *p;
+    int audio_left = self->metaint, meta_left = -1, meta_fill = 0, k;
+    ssize_t n;
+
+    sig_mask_thread();
+    while (!self->stop)
+        {
+        pthread_mutex_lock(&self->mutex);
+        while (!self->stop && jack_ringbuffer_write_space(self->rb) < HTTP_CHUNK)
+            pthread_cond_wait(&self->cv, &self->mutex);
+        pthread_mutex_unlock(&self->mutex);
+        if (self->stop)
+            break;
+
+        if ((n = recv(self->sock, buf, HTTP_CHUNK, 0)) <= 0)
+            {
+            if (n < 0 && errno == EINTR)
+                continue;
+            break;
+            }
+
+        /* demultiplex the audio data from the icy metadata */
+        for (p = buf; n > 0; p += k, n -= k)
+            {
+            if (!self->metaint || audio_left > 0)
+                {
+                k = (self->metaint && audio_left < n) ? audio_left : n;
+                jack_ringbuffer_write(self->rb, p, k);
+                audio_left -= k;
+                }
+            else if (meta_left < 0)
+                {
+                k = 1;
+                meta_fill = 0;
+                if (!(meta_left = (unsigned char)*p * 16))
+                    {
+                    audio_left = self->metaint;
+                    meta_left = -1;
+                    }
+                }
+            else
+                {
+                k = (meta_left < n) ? meta_left : n;
+                memcpy(meta + meta_fill, p, k);
+                meta_fill += k;
+                if (!(meta_left -= k))
+                    {
+                    meta[meta_fill] = '\0';
+                    icy_metadata(self, meta);
+                    audio_left = self->metaint;
+                    meta_left = -1;
+                    }
+                }
+            }
+
+        pthread_mutex_lock(&self->mutex);
+        pthread_cond_broadcast(&self->cv);
+        pthread_mutex_unlock(&self->mutex);
+        }
+
+    pthread_mutex_lock(&self->mutex);
+    self->eof = TRUE;
+    pthread_cond_broadcast(&self->cv);
+    pthread_mutex_unlock(&self->mutex);
+    return NULL;
+    }
+
+static int httpsource_start(struct httpsource *self)
+    {
+    self->stop = FALSE;
+    self->buffering = TRUE;
+    if (pthread_create(&self->thread, NULL, httpsource_reader, self))
+        {
+        fprintf(stderr, "httpsource: failed to start reader thread\n");
+        return FALSE;
+        }
+    self->thread_running = TRUE;
+    return TRUE;
+    }
+
+static void httpsource_stop(struct httpsource *self)
+    {
+    if (self->thread_running)
+        {
+        pthread_mutex_lock(&self->mutex);
+        self->stop = TRUE;
+        pthread_cond_broadcast(&self->cv);
+        pthread_mutex_unlock(&self->mutex);
+        shutdown(self->sock, SHUT_RDWR);
+        pthread_join(self->thread, NULL);
+        self->thread_running = FALSE;
+        }
+    if (self->sock >= 0)
+        {
+        close(self->sock);
+        self->sock = -1;
+        }
+    }
+
+/* aborted: the player wants the decoder back e.g. to perform an eject */
+static int aborted(struct httpsource *self)
+    {
+    return self->xlplayer->command == CMD_EJECT || self->xlplayer->command == CMD_CLEANUP || *self->xlplayer->jack_shutdown_f;
+    }
+
+/* timespec_add_ms: t advanced by ms milliseconds */
+static struct timespec timespec_add_ms(struct timespec t, long ms)
+    {
+    t.tv_sec += ms / 1000;
+    if ((t.tv_nsec += ms % 1000 * 1000000L) >= 1000000000L)
+        {
+        t.tv_nsec -= 1000000000L;
+        ++t.tv_sec;
+        }
+    return t;
+    }
+
+static int timespec_before(const struct timespec *a, const struct timespec *b)
+    {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+    }
+
+/* httpsource_peek: copy data from offset bytes ahead of the read position without consuming it
+ * unlike a read there is no wait for the prebuffer, only for the bytes asked for */
+static size_t httpsource_peek(struct httpsource *self, char *buf, size_t offset, size_t len)
+    {
+    struct timespec now, deadline, ts;
+    jack_ringbuffer_data_t vec[2];
+    size_t n, k;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = timespec_add_ms(now, HTTP_STALL_TIMEOUT_MS);
+    pthread_mutex_lock(&self->mutex);
+    while (jack_ringbuffer_read_space(self->rb) < offset + len && jack_ringbuffer_write_space(self->rb) >= HTTP_CHUNK
+                        && !self->eof && !aborted(self) && timespec_before(&now, &deadline))
+        {
+        ts = timespec_add_ms(now, 100);
+        if (timespec_before(&deadline, &ts))
+            ts = deadline;
+        pthread_cond_timedwait(&self->cv, &self->mutex, &ts);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        }
+    pthread_mutex_unlock(&self->mutex);
+
+    jack_ringbuffer_get_read_vector(self->rb, vec);
+    for (i = 0, n = 0; i < 2 && n < len; ++i)
+        {
+        if (offset >= vec[i].len)
+            {
+            offset -= vec[i].len;
+            continue;
+            }
+        k = (vec[i].len - offset < len - n) ? vec[i].len - offset : len - n;
+        memcpy(buf + n, vec[i].buf + offset, k);
+        n += k;
+        offset = 0;
+        }
+    return n;
+    }
+
+static ssize_t httpsource_read(void *cookie, char *buf, size_t size)
+    {
+    struct httpsource *self = cookie;
+    struct timespec now, deadline, ts;
+    size_t avail;
+
+    /* the reader thread wakes us on every recv so time is what counts, not wakeups */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = timespec_add_ms(now, HTTP_STALL_TIMEOUT_MS);
+    pthread_mutex_lock(&self->mutex);
+    for (;;)
+        {
+        avail = jack_ringbuffer_read_space(self->rb);
+        if (self->buffering && (avail >= self->prebuffer || self->eof))
+            self->buffering = FALSE;
+        if (!self->buffering && avail)
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (self->eof || aborted(self) || !timespec_before(&now, &deadline))
+            {
+            pthread_mutex_unlock(&self->mutex);
+            return 0;
+            }
+        if (!self->buffering && !self->seekable)
+            {
+            fprintf(stderr, "httpsource: %s buffer underrun, rebuffering\n", self->xlplayer->playername);
+            self->buffering = TRUE;
+            }
+        /* a tenth of a second at most so an eject is noticed */
+        ts = timespec_add_ms(now, 100);
+        if (timespec_before(&deadline, &ts))
+            ts = deadline;
+        pthread_cond_timedwait(&self->cv, &self->mutex, &ts);
+        }
+    pthread_mutex_unlock(&self->mutex);
+
+    size = jack_ringbuffer_read(self->rb, buf, (size < avail) ? size : avail);
+    self->pos += size;
+
+    pthread_mutex_lock(&self->mutex);
+    pthread_cond_broadcast(&self->cv);
+    pthread_mutex_unlock(&self->mutex);
+    return size;
+    }
+
+static int httpsource_seek(void *cookie, off64_t *offset, int whence)
+    {
+    struct httpsource *self = cookie;
+    int64_t target;
+
+    switch (whence)
+        {
+        case SEEK_SET:
+            target = *offset;
+            break;
+        case SEEK_CUR:
+            target = self->pos + *offset;
+            break;
+        case SEEK_END:
+            if (self->length < 0)
+                goto bad;
+            target = self->length + *offset;
+            break;
+        default:
+            goto bad;
+        }
+
+    if (target == self->pos)
+        {
+        *offset = target;
+        return 0;
+        }
+    if (!self->seekable)
+        {
+        errno = ESPIPE;
+        return -1;
+        }
+    if (target < 0 || target > self->length)
+        goto bad;
+
+    if (target > self->pos && target - self->pos <= (int64_t)jack_ringbuffer_read_space(self->rb))
+        {
+        /* the data is already in the prefetch buffer */
+        jack_ringbuffer_read_advance(self->rb, target - self->pos);
+        pthread_mutex_lock(&self->mutex);
+        pthread_cond_broadcast(&self->cv);
+        pthread_mutex_unlock(&self->mutex);
+        }
+    else
+        {
+        httpsource_stop(self);
+        jack_ringbuffer_reset(self->rb);
+        if (target == self->length)
+            self->eof = TRUE;
+        else if (!(httpsource_connect(self, target) && httpsource_start(self)))
+            {
+            errno = EIO;
+            return -1;
+            }
+        }
+
+    *offset = self->pos = target;
+    return 0;
+
+bad:
+    errno = EINVAL;
+    return -1;
+    }
+
+static void httpsource_free(struct httpsource *self)
+    {
+    httpsource_stop(self);
+    if (self->rb)
+        jack_ringbuffer_free(self->rb);
+    pthread_cond_destroy(&self->cv);
+    pthread_mutex_destroy(&self->mutex);
+    free(self->url);
+    free(self->host);
+    free(self->port);
+    free(self->path);
+    free(self);
+    }
+
+static int httpsource_close(void *cookie)
+    {
+    httpsource_free(cookie);
+    return 0;
+    }
+
+/* httpsource_new: connect to url and start the reader thread */
+static struct httpsource *httpsource_new(struct xlplayer *xlplayer, const char *url)
+    {
+    struct httpsource *self;
+    pthread_condattr_t cv_attr;
+
+    if (!(self = calloc(1, sizeof (struct httpsource))))
+        {
+        fprintf(stderr, "httpsource_new: malloc failure\n");
+        return NULL;
+        }
+    self->xlplayer = xlplayer;
+    self->sock = -1;
+    self->length = -1;
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_condattr_init(&cv_attr);
+    pthread_condattr_setclock(&cv_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&self->cv, &cv_attr);
+    pthread_condattr_destroy(&cv_attr);
+
+    if (!(self->url = strdup(url)) || !parse_url(self, url) || !httpsource_connect(self, 0))
+        goto fail;
+
+    if (self->seekable)
+        {
+        self->rb = jack_ringbuffer_create(HTTP_PREFETCH_SIZE);
+        self->prebuffer = 1;
+        }
+    else
+        {
+        self->rb = jack_ringbuffer_create(HTTP_JITTER_SIZE);
+        self->prebuffer = self->bitrate ? self->bitrate * HTTP_JITTER_MS / 8 : HTTP_JITTER_DEFAULT;
+        if (self->prebuffer > HTTP_JITTER_SIZE / 2)
+            self->prebuffer = HTTP_JITTER_SIZE / 2;
+        }
+    if (!self->rb || !httpsource_start(self))
+        goto fail;
+    return self;
+
+fail:
+    httpsource_free(self);
+    return NULL;
+    }
+
+FILE *httpsource_fopen(struct xlplayer *xlplayer, const char *url, int *seekable)
+    {
+    struct httpsource *self;
+    FILE *fp;
+    cookie_io_functions_t io = { .read = httpsource_read, .seek = httpsource_seek, .close = httpsource_close };
+
+    /* take over the connection decprobe sniffed rather than make a new one */
+    if ((self = xlplayer->httpsource) && !strcmp(self->url, url))
+        xlplayer->httpsource = NULL;
+    else if (!(self = httpsource_new(xlplayer, url)))
+        return NULL;
+
+    if (!(fp = fopencookie(self, "r", io)))
+        {
+        httpsource_free(self);
+        return NULL;
+        }
+
+    fprintf(stderr, "httpsource_fopen: %s %s\n", self->seekable ? "seekable file" : "live stream", url);
+    if (seekable)
+        *seekable = self->seekable;
+    return fp;
+    }
+
+size_t httpsource_probe(struct xlplayer *xlplayer, void *buf, size_t offset, size_t len)
+    {
+    if (!xlplayer->httpsource && !(xlplayer->httpsource = httpsource_new(xlplayer, xlplayer->pathname)))
+        return 0;
+    return httpsource_peek(xlplayer->httpsource, buf, offset, len);
+    }
+
+void httpsource_probe_done(struct xlplayer *xlplayer)
+    {
+    if (xlplayer->httpsource)
+        {
+        httpsource_free(xlplayer->httpsource);
+        xlplayer->httpsource = NULL;
+        }
+    }
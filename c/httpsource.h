@@ -0,0 +1,51 @@
+/*
+#   httpsource.h: http input for the xlplayer decoders
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HTTPSOURCE_H
+#define HTTPSOURCE_H
+
+#include <stdio.h>
+#include "xlplayer.h"
+
+/* httpsource_is_url: true when pathname refers to a remote http(s) resource */
+int httpsource_is_url(const char *pathname);
+
+/* httpsource_fopen: open a url for reading as a stdio stream
+ *
+ * Two modes are supported and chosen according to the server's response.
+ * Seekable files (Content-Length with byte ranges) are prefetched by a
+ * reader thread and seeking is done with range requests.  Live streams
+ * e.g. Icecast or Shoutcast relays are read through a jitter buffer, any
+ * ICY metadata being stripped out and passed to xlplayer_set_dynamic_metadata.
+ *
+ * seekable: if not NULL, set to indicate which mode is in use
+ * return value: a stream to be closed with fclose or NULL on failure */
+FILE *httpsource_fopen(struct xlplayer *xlplayer, const char *url, int *seekable);
+
+/* httpsource_probe: sniff xlplayer->pathname without consuming any of the stream
+ * The connection is kept for the decoder's httpsource_fopen of the same url
+ * so that selecting a decoder costs neither a second request nor a second
+ * prebuffer wait.  offset counts from the start of the stream.
+ * return value: the number of bytes copied into buf, 0 on failure */
+size_t httpsource_probe(struct xlplayer *xlplayer, void *buf, size_t offset, size_t len);
+
+/* httpsource_probe_done: close the probe connection if no decoder took it */
+void httpsource_probe_done(struct xlplayer *xlplayer);
+
+#endif /* HTTPSOURCE_H */
@@ -0,0 +1,57 @@
+/*
+#   latency.c: latency histograms for the streaming module
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include "latency.h"
+
+void latency_reset(struct latency_histogram *h)
+    {
+    for (int i = 0; i < LATENCY_BINS; ++i)
+        h->bin[i] = 0;
+    }
+
+void latency_record(struct latency_histogram *h, unsigned long ms)
+    {
+    int i = 0;
+
+    while (i < LATENCY_BINS - 1 && ms >= 1UL << i)
+        ++i;
+    h->bin[i]++;
+    }
+
+unsigned long latency_percentile(struct latency_histogram *h, int pc)
+    {
+    unsigned long count[LATENCY_BINS], total = 0, sum = 0;
+
+    /* a snapshot since the recording thread carries on meanwhile */
+    for (int i = 0; i < LATENCY_BINS; ++i)
+        total += count[i] = h->bin[i];
+    if (!total)
+        return 0;
+    for (int i = 0; i < LATENCY_BINS; ++i)
+        if ((sum += count[i]) * 100 >= total * pc)
+            return 1UL << i;
+    return 1UL << (LATENCY_BINS - 1);
+    }
+
+void latency_format(struct latency_histogram *h, char *buf, size_t size)
+    {
+    snprintf(buf, size, "%lu/%lu", latency_percentile(h, 50), latency_percentile(h, 99));
+    }
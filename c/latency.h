@@ -0,0 +1,45 @@
+/*
+#   latency.h: latency histograms for the streaming module
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+
+#define LATENCY_BINS 16
+
+/* a count of latencies in power of two milliseconds
+ *
+ * Bin n counts those under 2^n ms with the last bin taking all the rest.
+ * Only one thread may record into a histogram but any may read it.
+ */
+struct latency_histogram
+    {
+    volatile unsigned long bin[LATENCY_BINS];
+    };
+
+void latency_reset(struct latency_histogram *h);
+void latency_record(struct latency_histogram *h, unsigned long ms);
+/* latency_percentile: the bin limit in ms that pc percent come within, 0 when there are none */
+unsigned long latency_percentile(struct latency_histogram *h, int pc);
+/* latency_format: median/99th percentile for the reports */
+void latency_format(struct latency_histogram *h, char *buf, size_t size);
+
+#endif
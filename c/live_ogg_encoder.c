@@ -28,6 +28,8 @@
 #include "live_ogg_encoder.h"
 
 #define READSIZE 1024
+#define PAGE_FILL_MAX 65025     /* a page body with every lacing value at 255 */
+#define PAGE_MAX_PACKETS 255    /* one lacing value each at the least */
 
 typedef jack_default_audio_sample_t sample_t;
 
@@ -44,7 +46,15 @@ struct loe_data
     ogg_page         og;
     ogg_packet       op;
     int pagesamples;
+    int pagepackets;
+    struct ogg_page_policy page_policy;
     int (*owf)(ogg_stream_state *os, ogg_page *og);
+    int (*pageout)(ogg_stream_state *os, ogg_page *og);     /* owf between flushes */
+    int vi_ready;                /* vi holds a completed encoder setup */
+    int relink;                  /* restarting only for new metadata */
+    struct timespec relink_start;
+    long link_samples;           /* input given to the current link */
+    long link_granule;           /* the final granule position of the last link */
     };
 
 void live_ogg_capture_metadata(struct encoder *e, struct ogg_tag_data *t)
@@ -73,27 +83,80 @@ void live_ogg_free_metadata(struct ogg_tag_data *t)
     memset(t, '\0', sizeof (struct ogg_tag_data));
     }
 
-int live_ogg_write_packet(struct encoder *encoder, ogg_page *op, int flags)
+void live_ogg_relink_report(const char *caller, const struct timespec *start, long seam, long samplerate)
     {
-    struct encoder_op_packet packet;
-    char *buffer;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "%s: info: new logical stream after %.3f ms, seam %ld samples (%.2f ms)\n", caller,
+        (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0,
+        seam, seam * 1000.0 / samplerate);
+    }
 
-    if (!(buffer = malloc(op->header_len + op->body_len)))
+int live_ogg_page_policy_init(struct ogg_page_policy *pp, struct encoder_vars *ev)
+    {
+    pp->duration_ms = ev->page_duration ? atoi(ev->page_duration) : 0;
+    pp->max_packets = ev->page_packets ? atoi(ev->page_packets) : 0;
+    if (pp->duration_ms < 0 || pp->max_packets < 0 || pp->max_packets > PAGE_MAX_PACKETS)
         {
-        fprintf(stderr, "live_ogg_write_packet: malloc failure\n");
-        return 0;
+        fprintf(stderr, "live_ogg_page_policy_init: bad page setting %d ms %d packets\n", pp->duration_ms, pp->max_packets);
+        return FAILED;
         }
-    memcpy(buffer, op->header, op->header_len);
-    memcpy(buffer + op->header_len, op->body, op->body_len);
-    packet.header.bit_rate = encoder->bitrate;
-    packet.header.sample_rate = encoder->target_samplerate;
-    packet.header.n_channels = encoder->n_channels;
-    packet.header.flags = flags;
-    packet.header.data_size = op->header_len + op->body_len;
-    packet.header.timestamp = encoder->timestamp = (double)ogg_page_granulepos(op) / (double)encoder->samplerate;
-    packet.data = buffer;
-    encoder_write_packet_all(encoder, &packet);
-    free(buffer);
+    if (pp->duration_ms || pp->max_packets)
+        fprintf(stderr, "live_ogg_page_policy_init: pages of %d ms or %d packets\n", pp->duration_ms, pp->max_packets);
+    return SUCCEEDED;
+    }
+
+int live_ogg_page_packets(const struct ogg_page_policy *pp, int packet_samples, long samplerate, int fallback)
+    {
+    long n;
+
+    if (pp->max_packets)
+        return pp->max_packets;
+    if (!pp->duration_ms)
+        return fallback;
+    n = (long)pp->duration_ms * samplerate / (1000L * packet_samples);
+    if (n < 1)
+        return 1;
+    return (n > PAGE_MAX_PACKETS) ? PAGE_MAX_PACKETS : n;
+    }
+
+/* live_ogg_page_due: the vorbis page rule, packets vary in length so duration is counted in samples */
+static int live_ogg_page_due(struct loe_data *s, long samplerate)
+    {
+    if (s->page_policy.max_packets)
+        return s->pagepackets >= s->page_policy.max_packets;
+    if (s->page_policy.duration_ms)
+        return s->pagesamples >= (long)s->page_policy.duration_ms * samplerate / 1000;
+    /* write out a new ogg page at least 10 times a second */
+    return s->pagesamples > samplerate / 10;
+    }
+
+/* live_ogg_pageout: with a policy set pages grow until it says otherwise, not just to 4k */
+static int live_ogg_pageout(ogg_stream_state *os, ogg_page *og)
+    {
+    return ogg_stream_pageout_fill(os, og, PAGE_FILL_MAX);
+    }
+
+int live_ogg_write_packet(struct encoder *encoder, ogg_page *op, int flags)
+    {
+    struct encoder_op_packet *packet;
+    ogg_int64_t granulepos = ogg_page_granulepos(op);
+
+    /* the page is assembled straight into the packet the clients will share */
+    if (!(packet = encoder_packet_alloc(encoder, op->header_len + op->body_len)))
+        return 0;
+    memcpy(packet->data, op->header, op->header_len);
+    memcpy((char *)packet->data + op->header_len, op->body, op->body_len);
+    packet->header.bit_rate = encoder->bitrate;
+    packet->header.sample_rate = encoder->target_samplerate;
+    packet->header.n_channels = encoder->n_channels;
+    packet->header.flags = flags;
+    /* granule positions are at the codec rate and absent on pages that finish no packet */
+    if (granulepos >= 0)
+        encoder->timestamp = (double)granulepos / (double)encoder->target_samplerate;
+    packet->header.timestamp = encoder->timestamp;
+    encoder_packet_send(encoder, packet);
     return 1;
     }
 
@@ -113,20 +176,25 @@ static void live_ogg_encoder_main(struct encoder *encoder)
     if (encoder->encoder_state == ES_STARTING)
         {
         fprintf(stderr, "live_ogg_encoder_main: first pass of the encoder\n");
-        vorbis_info_init(&s->vi);
-        if (vorbis_encode_setup_managed(&s->vi, encoder->n_channels, encoder->target_samplerate, s->max_bitrate, encoder->bitrate, s->min_bitrate))
+        /* the mode setup is the costly part and survives a change of metadata */
+        if (!s->vi_ready)
             {
-            fprintf(stderr, "live_ogg_encoder_main: mode initialisation failed\n");
-            vorbis_info_clear(&s->vi);
-            goto bailout;
-            }
+            vorbis_info_init(&s->vi);
+            if (vorbis_encode_setup_managed(&s->vi, encoder->n_channels, encoder->target_samplerate, s->max_bitrate, encoder->bitrate, s->min_bitrate))
+                {
+                fprintf(stderr, "live_ogg_encoder_main: mode initialisation failed\n");
+                vorbis_info_clear(&s->vi);
+                goto bailout;
+                }
 
-        vorbis_encode_ctl(&s->vi, OV_ECTL_RATEMANAGE2_GET, &ai);
-        ai.bitrate_limit_min_kbps = s->min_bitrate / 1000;
-        if (vorbis_encode_ctl(&s->vi, OV_ECTL_RATEMANAGE2_SET, &ai))
-            fprintf(stderr, "live_ogg_encoder_main: failed to set hard bitrate floor\n");
-            
-        vorbis_encode_setup_init(&s->vi);
+            vorbis_encode_ctl(&s->vi, OV_ECTL_RATEMANAGE2_GET, &ai);
+            ai.bitrate_limit_min_kbps = s->min_bitrate / 1000;
+            if (vorbis_encode_ctl(&s->vi, OV_ECTL_RATEMANAGE2_SET, &ai))
+                fprintf(stderr, "live_ogg_encoder_main: failed to set hard bitrate floor\n");
+                
+            vorbis_encode_setup_init(&s->vi);
+            s->vi_ready = TRUE;
+            }
         vorbis_analysis_init(&s->vd, &s->vi);
         vorbis_block_init(&s->vd, &s->vb);
         ogg_stream_init(&s->os, ++encoder->oggserial);
@@ -170,8 +238,15 @@ static void live_ogg_encoder_main(struct encoder *encoder)
                 }
             packet_flags = PF_OGG | PF_HEADER;
             }
-        s->pagesamples = 0;
-        s->owf = ogg_stream_pageout;
+        s->pagesamples = s->pagepackets = 0;
+        s->owf = s->pageout;
+        if (s->relink)
+            {
+            live_ogg_relink_report("live_ogg_encoder_main", &s->relink_start,
+                                s->link_samples - s->link_granule, encoder->target_samplerate);
+            s->relink = FALSE;
+            }
+        s->link_samples = 0;
         encoder->encoder_state = ES_RUNNING;
         return;
         }
@@ -182,6 +257,12 @@ static void live_ogg_encoder_main(struct encoder *encoder)
             cycle_restart = TRUE;
             encoder->flush = FALSE;
             }
+        else
+            if (encoder->new_metadata && encoder->run_request_f && !s->relink)
+                {
+                s->relink = TRUE;
+                clock_gettime(CLOCK_MONOTONIC, &s->relink_start);
+                }
         cycle_restart |= encoder->new_metadata | !encoder->run_request_f;
         if (cycle_restart)
             {
@@ -196,6 +277,7 @@ static void live_ogg_encoder_main(struct encoder *encoder)
             if (input_data)
                 {
                 vorbis_analysis_wrote(&s->vd, input_data->qty_samples);
+                s->link_samples += input_data->qty_samples;
                 encoder_ip_data_free(input_data);
                 }
             else
@@ -210,16 +292,17 @@ static void live_ogg_encoder_main(struct encoder *encoder)
                 oldgranulepos = s->os.granulepos;
                 ogg_stream_packetin(&s->os, &s->op);
                 s->pagesamples += s->os.granulepos - oldgranulepos;
-                /* write out a new ogg page at least 10 times a second */
-                if (s->pagesamples > encoder->samplerate / 10)
+                s->pagepackets++;
+                if (live_ogg_page_due(s, encoder->target_samplerate))
                     s->owf = ogg_stream_flush;
                 while (s->owf(&s->os, &s->og))
                     {
-                    s->owf = ogg_stream_pageout;
-                    s->pagesamples = 0;
+                    s->owf = s->pageout;
+                    s->pagesamples = s->pagepackets = 0;
                     if (ogg_page_eos(&s->og))
                         {
                         fprintf(stderr, "live_ogg_encoder_main: writing final packet\n");
+                        s->link_granule = ogg_page_granulepos(&s->og);
                         live_ogg_write_packet(encoder, &s->og, PF_OGG | PF_FINAL);
                         cycle_restart2 = TRUE;
                         break;
@@ -240,7 +323,13 @@ static void live_ogg_encoder_main(struct encoder *encoder)
         vorbis_block_clear(&s->vb);
         vorbis_dsp_clear(&s->vd);
         vorbis_comment_clear(&s->vc);
-        vorbis_info_clear(&s->vi);
+        /* each link of the chain must decode on its own so only the setup carries over */
+        if (!s->relink || !encoder->run_request_f)
+            {
+            vorbis_info_clear(&s->vi);
+            s->vi_ready = FALSE;
+            s->relink = FALSE;
+            }
         fprintf(stderr, "live_ogg_encoder_main: libvorbis structures freed\n");
         if (!encoder->run_request_f)
             goto bailout;
@@ -283,6 +372,13 @@ int live_ogg_encoder_init(struct encoder *encoder, struct encoder_vars *ev)
         s->min_bitrate = encoder->bitrate - var;
         }
 
+    if (!live_ogg_page_policy_init(&s->page_policy, ev))
+        {
+        free(s);
+        return FAILED;
+        }
+
+    s->pageout = (s->page_policy.duration_ms || s->page_policy.max_packets) ? live_ogg_pageout : ogg_stream_pageout;
     encoder->encoder_private = s;
     encoder->run_encoder = live_ogg_encoder_main;
     return SUCCEEDED;
@@ -20,6 +20,7 @@
 #ifndef HAVE_OGGENC
 #define HAVE_OGGENC
 
+#include <time.h>
 #include <ogg/ogg.h>
 #include "sourceclient.h"
 
@@ -31,9 +32,24 @@ struct ogg_tag_data
     char *album;
     };
 
+/* when an Ogg page is closed, zero in both leaves it to the codec's own rule */
+struct ogg_page_policy
+    {
+    int duration_ms;             /* once it holds this much audio */
+    int max_packets;             /* or this many codec packets, which takes precedence */
+    };
+
 int live_ogg_encoder_init(struct encoder *encoder, struct encoder_vars *ev);
 int live_ogg_write_packet(struct encoder *encoder, ogg_page *op, int flags);
 void live_ogg_capture_metadata(struct encoder *e, struct ogg_tag_data *td);
 void live_ogg_free_metadata(struct ogg_tag_data *td);
+/* live_ogg_page_policy_init: from the encoder settings, returns FAILED on bad values */
+int live_ogg_page_policy_init(struct ogg_page_policy *pp, struct encoder_vars *ev);
+/* live_ogg_page_packets: how many fixed size packets make a page, fallback if no policy is set */
+int live_ogg_page_packets(const struct ogg_page_policy *pp, int packet_samples, long samplerate, int fallback);
+/* live_ogg_relink_report: log how long a metadata change held up the encoder
+ * seam is where the new link's audio starts less where the old link's ended,
+ * in input samples, so zero is seamless, positive a gap and negative an overlap */
+void live_ogg_relink_report(const char *caller, const struct timespec *start, long seam, long samplerate);
 
 #endif
@@ -40,25 +40,28 @@ static FLAC__int32 **live_oggflac_encoder_make_pcm(struct encoder_ip_data *id, s
     const FLAC__int32 ul = mul - 0.5;
     const FLAC__int32 ll = ~ul;
     FLAC__int32 val;
-    FLAC__int32 **pcm;
+    FLAC__int32 **pcm = s->pcm;
     int i;
     unsigned j;
 
-    if (!(pcm = malloc(sizeof (FLAC__int32 *) * id->channels)))
+    /* the buffers are kept and only grow so steady state encoding does not allocate */
+    if (id->qty_samples > s->pcm_size)
         {
-        fprintf(stderr, "live_oggflac_encoder_make_pcm: malloc failure\n");
-        return NULL;
+        for (i = 0; i < 2; i++)
+            {
+            free(pcm[i]);
+            if (!(pcm[i] = malloc(sizeof (FLAC__int32) * id->qty_samples)))
+                {
+                fprintf(stderr, "live_oggflac_encoder_make_pcm: malloc failure\n");
+                s->pcm_size = 0;
+                return NULL;
+                }
+            }
+        s->pcm_size = id->qty_samples;
         }
 
     for (i = 0; i < id->channels; i++)
         {
-        if (!(pcm[i] = malloc(sizeof (FLAC__int32) * id->qty_samples)))
-            {
-            fprintf(stderr, "live_oggflac_encoder_make_pcm: malloc failure\n");
-            free(pcm);
-            return NULL;
-            }
-
         for(j = 0; j < id->qty_samples; j++)
             {
             if (s->bits_per_sample <= 20)
@@ -85,15 +88,6 @@ static FLAC__int32 **live_oggflac_encoder_make_pcm(struct encoder_ip_data *id, s
     return pcm;
     }
 
-static void live_oggflac_encoder_free_pcm(FLAC__int32 *pcm[], int channels)
-    {
-    int i;
-
-    for (i = 0; i < channels; i++)
-        free(pcm[i]);
-    free(pcm);
-    }
-
 static FLAC__StreamEncoderWriteStatus live_oggflac_encoder_write_cb(const FLAC__StreamEncoder *enc, const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame, void *client_data)
     {
     struct encoder *encoder = client_data;
@@ -154,7 +148,7 @@ static FLAC__StreamEncoderWriteStatus live_oggflac_encoder_write_cb(const FLAC__
         packet.header.n_channels = encoder->n_channels;
         packet.header.flags = s->flags;
         packet.header.data_size = s->pab_rqd;
-        packet.header.timestamp = encoder->timestamp = (double)s->samples / (double)encoder->samplerate;
+        packet.header.timestamp = encoder->timestamp = (double)s->samples / (double)encoder->target_samplerate;
         packet.data = s->pab;
         encoder_write_packet_all(encoder, &packet);
         }
@@ -190,7 +184,8 @@ static void live_oggflac_encoder_main(struct encoder *encoder)
 
     if (encoder->encoder_state == ES_STARTING)
         {
-        if (!(s->enc = FLAC__stream_encoder_new()))
+        /* finish leaves the encoder ready to be initialised again so it is kept */
+        if (!s->enc && !(s->enc = FLAC__stream_encoder_new()))
             {
             fprintf(stderr, "live_oggflac_encoder_main: failed to create new encoder\n");
             goto bailout;
@@ -254,6 +249,13 @@ static void live_oggflac_encoder_main(struct encoder *encoder)
             FLAC__stream_encoder_set_metadata(s->enc, s->metadata, 1);
         FLAC__stream_encoder_init_ogg_stream(s->enc, NULL, live_oggflac_encoder_write_cb, NULL, NULL, NULL, encoder);
         encoder->timestamp = 0.0;
+        if (s->relink)
+            {
+            live_ogg_relink_report("live_oggflac_encoder_main", &s->relink_start,
+                                s->link_samples - (long)s->samples, encoder->target_samplerate);
+            s->relink = FALSE;
+            }
+        s->link_samples = 0;
         encoder->encoder_state = ES_RUNNING;
         return;
         }
@@ -264,9 +266,12 @@ static void live_oggflac_encoder_main(struct encoder *encoder)
 
         if (encoder->new_metadata || !encoder->run_request_f || encoder->flush)
             {
+            /* FLAC frames stand alone so the audio runs on unbroken into the new link */
+            if ((s->relink = encoder->new_metadata && encoder->run_request_f && !encoder->flush))
+                clock_gettime(CLOCK_MONOTONIC, &s->relink_start);
             FLAC__stream_encoder_finish(s->enc);
             encoder->flush = FALSE;
-            encoder->encoder_state = ES_STOPPING;
+            encoder->encoder_state = s->relink ? ES_STARTING : ES_STOPPING;
             }
         else
             {
@@ -275,9 +280,9 @@ static void live_oggflac_encoder_main(struct encoder *encoder)
                 {
                 FLAC__int32 **pcm;
 
-                pcm = live_oggflac_encoder_make_pcm(id, s);
-                FLAC__stream_encoder_process(s->enc, (const FLAC__int32 ** const)pcm, id->qty_samples);
-                live_oggflac_encoder_free_pcm(pcm, id->channels);
+                if ((pcm = live_oggflac_encoder_make_pcm(id, s)))
+                    FLAC__stream_encoder_process(s->enc, (const FLAC__int32 ** const)pcm, id->qty_samples);
+                s->link_samples += id->qty_samples;
                 encoder_ip_data_free(id);
                 }
             }
@@ -286,7 +291,6 @@ static void live_oggflac_encoder_main(struct encoder *encoder)
         
     if (encoder->encoder_state == ES_STOPPING)
         {
-        FLAC__stream_encoder_delete(s->enc);
         if (!encoder->run_request_f)
             goto bailout;
         else
@@ -309,12 +313,16 @@ static void live_oggflac_encoder_main(struct encoder *encoder)
         {
         fprintf(stderr, "Clipping detected on upper %d times and lower %d times.\n", s->uclip, s->lclip);
         
+        if (s->enc)
+            FLAC__stream_encoder_delete(s->enc);
         if (s->metadata[0])
             {
             if (s->metadata[0]->data.vorbis_comment.comments)
                 free(s->metadata[0]->data.vorbis_comment.comments);
             free(s->metadata[0]);
             }
+        free(s->pcm[0]);
+        free(s->pcm[1]);
         live_ogg_free_metadata(t);
         free(s);
         }
@@ -41,6 +41,11 @@ struct lofe_data
     unsigned int seedp;
     int uclip;
     int lclip;
+    FLAC__int32 *pcm[2];         /* the converted audio, reused between calls */
+    size_t pcm_size;             /* in samples */
+    int relink;                  /* restarting only for new metadata */
+    struct timespec relink_start;
+    long link_samples;           /* input given to the current link */
     };
 
 int live_oggflac_encoder_init(struct encoder *encoder, struct encoder_vars *ev);
@@ -53,6 +53,13 @@ struct local_data {
     unsigned char *outbuf;
     struct vtag_block metadata_block;
     int fillbytes;
+    int relink;                 /* ending the link for new metadata */
+    struct timespec relink_start;
+    float *history;             /* the latest input, replayed to prime the encoder for a new link */
+    int preroll;                /* samples of history, whole frames covering the lookahead */
+    ogg_int64_t input_pos;      /* samples taken from the input */
+    ogg_int64_t link_origin;    /* input position of granule zero of the current link */
+    ogg_int64_t link_end;       /* input position where the audio of the last link ended */
 };
 
 /* create a multiplexed pcm stream */
@@ -65,6 +72,43 @@ static void stereomix(float *l, float *r, float *m, size_t n)
         }
     }
 
+/* live_oggopus_encoder_packetout: add an audio packet to the link and write out any page that is due */
+static int live_oggopus_encoder_packetout(struct encoder *encoder, struct local_data *s, opus_int32 enc_bytes, int eos)
+    {
+    ogg_packet op;
+    ogg_page og;
+
+    op.packet = s->outbuf;
+    op.bytes = enc_bytes;
+    op.b_o_s = 0;
+    op.e_o_s = eos;
+    op.granulepos = (s->granulepos += s->framesamples);
+    op.packetno = s->packetno++;
+    ogg_stream_packetin(&s->os, &op);
+    if (eos)
+        s->pflags |= PF_FINAL;
+
+    s->fillbytes += enc_bytes;
+    if (++s->pagepackets == s->pagepackets_max || eos)
+        {
+        s->pagepackets = 0;
+        if (ogg_stream_flush_fill(&s->os, &og, s->fillbytes))
+            {
+            if (!live_ogg_write_packet(encoder, &og, s->pflags))
+                {
+                fprintf(stderr, "live_oggopus_encoder_main: failed to write packet\n");
+                return FAILED;
+                }
+
+            if ((s->fillbytes -= og.body_len))
+                fprintf(stderr, "!!! packet size limit exceeded\n");
+            }
+        else
+            fprintf(stderr, "live_oggopus_encoder_main: failed to flush page\n");
+        }
+    return SUCCEEDED;
+    }
+
 static void live_oggopus_encoder_main(struct encoder *encoder)
     {
     struct local_data * const s = encoder->encoder_private;
@@ -74,51 +118,77 @@ static void live_oggopus_encoder_main(struct encoder *encoder)
     if (encoder->encoder_state == ES_STARTING)
         {
         const opus_int32 la_fallback = 196;
-        int error;
+        opus_int32 enc_bytes;
+        int error, i;
             
         fprintf(stderr, "live_ogg_encoder_main: info: writing headers\n");
 
         encoder->timestamp = 0.0;
         ogg_stream_init(&s->os, ++encoder->oggserial);
        
-        if (!(s->enc_st = opus_encoder_create(48000, encoder->n_channels, OPUS_APPLICATION_AUDIO, &error)))
+        if (!s->enc_st)
             {
-            fprintf(stderr, "live_oggopus_encoder_main: failure: encoder_create: %s\n", opus_strerror(error));
-            goto bailout;
-            }
+            if (!(s->enc_st = opus_encoder_create(48000, encoder->n_channels, OPUS_APPLICATION_AUDIO, &error)))
+                {
+                fprintf(stderr, "live_oggopus_encoder_main: failure: encoder_create: %s\n", opus_strerror(error));
+                goto bailout;
+                }
 
-        if (opus_encoder_ctl(s->enc_st, OPUS_SET_BITRATE(encoder->bitrate * 1000)) != OPUS_OK)
-            {
-            fprintf(stderr, "live_oggopus_encoder_main: failure: failed to set bitrate\n");
-            goto bailout;
-            }
+            if (opus_encoder_ctl(s->enc_st, OPUS_SET_BITRATE(encoder->bitrate * 1000)) != OPUS_OK)
+                {
+                fprintf(stderr, "live_oggopus_encoder_main: failure: failed to set bitrate\n");
+                goto bailout;
+                }
            
-        if (opus_encoder_ctl(s->enc_st, OPUS_SET_VBR(s->vbr)) != OPUS_OK)
-            {
-            fprintf(stderr, "live_oggopus_encoder_main: failure: failed to set cbr/vbr\n");
-            goto bailout;
-            }
+            if (opus_encoder_ctl(s->enc_st, OPUS_SET_VBR(s->vbr)) != OPUS_OK)
+                {
+                fprintf(stderr, "live_oggopus_encoder_main: failure: failed to set cbr/vbr\n");
+                goto bailout;
+                }
             
-        if (opus_encoder_ctl(s->enc_st, OPUS_SET_VBR_CONSTRAINT(s->vbr_constraint)) != OPUS_OK)
-            {
-            fprintf(stderr, "live_oggopus_encoder_main: failure: failed to set vbr constraint\n");
-            goto bailout;
-            }
+            if (opus_encoder_ctl(s->enc_st, OPUS_SET_VBR_CONSTRAINT(s->vbr_constraint)) != OPUS_OK)
+                {
+                fprintf(stderr, "live_oggopus_encoder_main: failure: failed to set vbr constraint\n");
+                goto bailout;
+                }
             
-        if (opus_encoder_ctl(s->enc_st, OPUS_SET_COMPLEXITY(s->complexity)) != OPUS_OK)
-            fprintf(stderr, "live_oggopus_encoder_main: warning: failed to set complexity\n");
+            if (opus_encoder_ctl(s->enc_st, OPUS_SET_COMPLEXITY(s->complexity)) != OPUS_OK)
+                fprintf(stderr, "live_oggopus_encoder_main: warning: failed to set complexity\n");
 
-        if (opus_encoder_ctl(s->enc_st, OPUS_GET_LOOKAHEAD(&s->lookahead)) != OPUS_OK)
-            {
-            fprintf(stderr, "live_oggopus_encoder_main: warning: failed to get lookahead value -- using %d\n", la_fallback);
-            s->lookahead = la_fallback;
+            if (opus_encoder_ctl(s->enc_st, OPUS_GET_LOOKAHEAD(&s->lookahead)) != OPUS_OK)
+                {
+                fprintf(stderr, "live_oggopus_encoder_main: warning: failed to get lookahead value -- using %d\n", la_fallback);
+                s->lookahead = la_fallback;
+                }
+
+            s->preroll = (s->lookahead + s->framesamples - 1) / s->framesamples * s->framesamples;
+            if (!s->history && !(s->history = calloc(s->preroll * encoder->n_channels, sizeof (float))))
+                {
+                fprintf(stderr, "live_oggopus_encoder_main: malloc failure\n");
+                goto bailout;
+                }
             }
 
+        /* a fresh decoder starts each link so the encoder must start afresh too,
+         * the new link replaying enough of the old one to skip over the lookahead
+         */
+        if (s->relink)
+            {
+            if (opus_encoder_ctl(s->enc_st, OPUS_RESET_STATE) != OPUS_OK)
+                {
+                fprintf(stderr, "live_oggopus_encoder_main: failure: failed to reset encoder\n");
+                goto bailout;
+                }
+            s->link_origin = s->input_pos - s->preroll;
+            }
+        else
+            s->link_origin = s->input_pos;
+        const int preskip = s->relink ? s->preroll : s->lookahead;
         char header_packet_data[20];
         size_t header_packet_size = snprintf(header_packet_data, sizeof header_packet_data,
             "OpusHead\x1%c%c%c\x80\xbb%c%c%c%c%c",
             encoder->n_channels,
-            s->lookahead & 0xFF, (s->lookahead >> 8) & 0xFF,
+            preskip & 0xFF, (preskip >> 8) & 0xFF,
             '\0', '\0',
             s->postgain & 0xFF, (s->postgain >> 8) & 0xFF,
             '\0');
@@ -217,6 +287,24 @@ static void live_oggopus_encoder_main(struct encoder *encoder)
             s->pflags = PF_OGG;
             }
        
+        if (s->relink)
+            {
+            for (i = 0; i < s->preroll; i += s->framesamples)
+                {
+                enc_bytes = opus_encode_float(s->enc_st, s->history + i * encoder->n_channels, s->framesamples, s->outbuf, s->outbuf_siz);
+                if (enc_bytes <= 0)
+                    {
+                    fprintf(stderr, "live_oggopus_encoder_main: failed to encode packet: %s\n", opus_strerror(enc_bytes));
+                    goto bailout;
+                    }
+                if (!live_oggopus_encoder_packetout(encoder, s, enc_bytes, FALSE))
+                    goto bailout;
+                }
+
+            live_ogg_relink_report("live_oggopus_encoder_main", &s->relink_start,
+                                s->link_origin + preskip - s->lookahead - s->link_end, 48000);
+            s->relink = FALSE;
+            }
         encoder->encoder_state = ES_RUNNING;
         fprintf(stderr, "live_ogg_encoder_main: info: encoding\n");
         return;
@@ -228,13 +316,21 @@ static void live_oggopus_encoder_main(struct encoder *encoder)
         opus_int32 enc_bytes;
         float *inbuf;
 
-        if (encoder->new_metadata || !encoder->run_request_f || encoder->flush)
+        if (!encoder->run_request_f || encoder->flush)
             {
             encoder->flush = FALSE;
+            s->relink = FALSE;
             encoder->encoder_state = ES_STOPPING;
             return;
             }
 
+        /* new metadata ends the link on the next packet and the encoder carries on */
+        if (encoder->new_metadata && !s->relink)
+            {
+            s->relink = TRUE;
+            clock_gettime(CLOCK_MONOTONIC, &s->relink_start);
+            }
+
         if((id = encoder_get_input_data(encoder, s->framesamples, s->framesamples, NULL)))
             {
             if (encoder->n_channels == 2)
@@ -243,34 +339,32 @@ static void live_oggopus_encoder_main(struct encoder *encoder)
                 inbuf = id->buffer[0];
             enc_bytes = opus_encode_float(s->enc_st, inbuf, s->framesamples, s->outbuf, s->outbuf_siz);
             encoder_ip_data_free(id);
+            s->input_pos += s->framesamples;
+
+            /* keep the latest frames for priming the encoder at the start of a new link */
+            memmove(s->history, s->history + s->framesamples * encoder->n_channels,
+                                (s->preroll - s->framesamples) * encoder->n_channels * sizeof (float));
+            memcpy(s->history + (s->preroll - s->framesamples) * encoder->n_channels, inbuf,
+                                s->framesamples * encoder->n_channels * sizeof (float));
 
             if (enc_bytes > 0)
                 {
-                op.packet = s->outbuf;
-                op.bytes = enc_bytes;
-                op.b_o_s = 0;
-                op.e_o_s = 0;
-                op.granulepos = (s->granulepos += s->framesamples);
-                op.packetno = s->packetno++;
-                ogg_stream_packetin(&s->os, &op);
-                
-                s->fillbytes += enc_bytes;
-                if (++s->pagepackets == s->pagepackets_max)
+                if (!live_oggopus_encoder_packetout(encoder, s, enc_bytes, s->relink))
+                    goto bailout;
+
+                if (s->relink)
                     {
-                    s->pagepackets = 0;
-                    if (ogg_stream_flush_fill(&s->os, &og, s->fillbytes))
-                        {
+                    /* the link's audio ends where the decoder's output of the final packet does */
+                    s->link_end = s->link_origin + s->granulepos - s->lookahead;
+                    while (ogg_stream_flush(&s->os, &og))
                         if (!live_ogg_write_packet(encoder, &og, s->pflags))
                             {
                             fprintf(stderr, "live_oggopus_encoder_main: failed to write packet\n");
                             goto bailout;
                             }
-                            
-                        if ((s->fillbytes -= og.body_len))
-                            fprintf(stderr, "!!! packet size limit exceeded\n");
-                        }
-                    else
-                        fprintf(stderr, "live_oggopus_encoder_main: failed to flush page\n");
+                    ogg_stream_clear(&s->os);
+                    s->granulepos = s->packetno = s->pagepackets = s->fillbytes = 0;
+                    encoder->encoder_state = ES_STARTING;
                     }
                 }
             else
@@ -349,6 +443,7 @@ static void live_oggopus_encoder_main(struct encoder *encoder)
         else
             {
             opus_encoder_destroy(s->enc_st);
+            s->enc_st = NULL;
             ogg_stream_clear(&s->os);
             s->granulepos = s->packetno = s->pagepackets = s->fillbytes = 0;
             fprintf(stderr, "live_oggopus_encoder_main: minimal clean up\n");
@@ -373,6 +468,7 @@ static void live_oggopus_encoder_main(struct encoder *encoder)
         opus_encoder_destroy(s->enc_st);
     ogg_stream_clear(&s->os);
     free(s->inbuf);
+    free(s->history);
     free(s->outbuf);
     free(s);
     fprintf(stderr, "live_oggopus_encoder_main: finished cleanup\n");
@@ -382,6 +478,7 @@ static void live_oggopus_encoder_main(struct encoder *encoder)
 int live_oggopus_encoder_init(struct encoder *encoder, struct encoder_vars *ev)
     {    
     struct local_data * const s = calloc(1, sizeof (struct local_data));
+    struct ogg_page_policy page_policy;
 
     if (!s)
         {
@@ -392,7 +489,13 @@ int live_oggopus_encoder_init(struct encoder *encoder, struct encoder_vars *ev)
     s->complexity = atoi(ev->complexity);
     s->postgain = atoi(ev->postgain);
     s->framesamples = atoi(ev->framesize) * 48;
-    s->pagepackets_max = 48000 / s->framesamples / 5;
+    if (!live_ogg_page_policy_init(&page_policy, ev))
+        {
+        free(s);
+        return FAILED;
+        }
+    /* five pages a second unless told otherwise */
+    s->pagepackets_max = live_ogg_page_packets(&page_policy, s->framesamples, 48000, 48000 / s->framesamples / 5);
     if (!strcmp(ev->variability, "cbr"))
         s->vbr = 0;
     else
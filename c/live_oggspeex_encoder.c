@@ -62,6 +62,15 @@ struct lose_data
     int complexity;
     struct vtag_block metadata_block;
     enum packet_flags flags;
+    struct ogg_page_policy page_policy;
+    int page_frames;           /* frames per ogg page */
+    int relink;                /* ending the link for new metadata */
+    struct timespec relink_start;
+    float *relink_buf;         /* the frame that ended the last link, to start the next */
+    int refeed;                /* encode relink_buf before taking more input */
+    long input_pos;            /* samples taken from the input */
+    long link_origin;          /* input position of the start of the current link */
+    long link_end;             /* input position where the audio of the last link ended */
     };
 
 static void live_oggspeex_encoder_monomix(float *in, float *out, size_t n)
@@ -92,24 +101,46 @@ static void live_oggspeex_encoder_main(struct encoder *encoder)
         int packet_size;
         int error;
         
-        speex_bits_init(&s->bits);
-        if (!(s->enc_state = speex_encoder_init(s->mode)))
+        /* a chained link keeps the encoder from the previous one */
+        if (!s->enc_state)
             {
-            fprintf(stderr, "live_oggspeex_encoder_main: failed to initialise speex encoder\n");
-            goto bailout;
-            }
+            speex_bits_init(&s->bits);
+            if (!(s->enc_state = speex_encoder_init(s->mode)))
+                {
+                fprintf(stderr, "live_oggspeex_encoder_main: failed to initialise speex encoder\n");
+                speex_bits_destroy(&s->bits);
+                goto bailout;
+                }
+                
+            speex_encoder_ctl(s->enc_state, SPEEX_GET_FRAME_SIZE, &s->fsamples);
+            speex_encoder_ctl(s->enc_state, SPEEX_SET_QUALITY, &s->quality);
+            speex_encoder_ctl(s->enc_state, SPEEX_SET_COMPLEXITY, &s->complexity);
+            speex_encoder_ctl(s->enc_state, SPEEX_GET_LOOKAHEAD, &s->lookahead);
+            s->page_frames = live_ogg_page_packets(&s->page_policy, s->fsamples, encoder->target_samplerate, 10);
             
-        speex_encoder_ctl(s->enc_state, SPEEX_GET_FRAME_SIZE, &s->fsamples);
-        speex_encoder_ctl(s->enc_state, SPEEX_SET_QUALITY, &s->quality);
-        speex_encoder_ctl(s->enc_state, SPEEX_SET_COMPLEXITY, &s->complexity);
-        speex_encoder_ctl(s->enc_state, SPEEX_GET_LOOKAHEAD, &s->lookahead);
+            if (!(s->inbuf = realloc(s->inbuf, s->fsamples * encoder->n_channels * sizeof (float))) ||
+                        !(s->relink_buf = realloc(s->relink_buf, s->fsamples * encoder->n_channels * sizeof (float))))
+                {
+                fprintf(stderr, "live_oggspeex_encoder_main: malloc failure\n");
+                goto bailout;
+                }
+            }
         
-        if (!(s->inbuf = realloc(s->inbuf, s->fsamples * encoder->n_channels * sizeof (float))))
+        /* a fresh decoder starts each link so the encoder must start afresh too,
+         * beginning with the frame that ended the old link which was cut short to suit
+         */
+        if (s->relink)
             {
-            fprintf(stderr, "live_oggspeex_encoder_main: malloc failure\n");
-            goto bailout;
+            speex_encoder_ctl(s->enc_state, SPEEX_RESET_STATE, NULL);
+            s->refeed = TRUE;
+            s->link_origin = s->input_pos - s->fsamples;
             }
-        
+        else
+            {
+            s->refeed = FALSE;
+            s->link_origin = s->input_pos;
+            }
+
         speex_init_header(&header, encoder->target_samplerate, encoder->n_channels, s->mode);
         header.frames_per_packet = 1;
         if (!(packet = speex_header_to_packet(&header, &packet_size)))
@@ -212,6 +243,12 @@ static void live_oggspeex_encoder_main(struct encoder *encoder)
         s->samples_encoded = -s->lookahead;
         s->eos = FALSE;
         encoder->timestamp = 0.0;
+        if (s->relink)
+            {
+            live_ogg_relink_report("live_oggspeex_encoder_main", &s->relink_start,
+                                s->link_origin - s->link_end, encoder->target_samplerate);
+            s->relink = FALSE;
+            }
         encoder->encoder_state = ES_RUNNING;
         return;
         }
@@ -225,29 +262,46 @@ static void live_oggspeex_encoder_main(struct encoder *encoder)
  
         if (s->eos == FALSE)
             {
-            if (encoder->new_metadata || !encoder->run_request_f || encoder->flush)
+            if (encoder->new_metadata && encoder->run_request_f && !encoder->flush && !s->relink)
+                {
+                /* the next frame ends the link and the encoder carries on */
+                s->relink = TRUE;
+                clock_gettime(CLOCK_MONOTONIC, &s->relink_start);
+                }
+
+            if (!encoder->run_request_f || encoder->flush)
                 {
+                s->relink = FALSE;
                 s->eos = TRUE;
                 memset(s->inbuf, '\0', s->fsamples * encoder->n_channels * sizeof (float));
                 return;
                 }
             else
                 {
-                if((id = encoder_get_input_data(encoder, s->fsamples, s->fsamples, NULL)))
+                if (s->refeed)
+                    {
+                    memcpy(s->inbuf, s->relink_buf, s->fsamples * encoder->n_channels * sizeof (float));
+                    s->refeed = FALSE;
+                    }
+                else if((id = encoder_get_input_data(encoder, s->fsamples, s->fsamples, NULL)))
                     {
                     if (encoder->n_channels == 2)
-                        {
                         live_oggspeex_encoder_stereomix(id->buffer[0], id->buffer[1], s->inbuf, s->fsamples);
-                        speex_encode_stereo(s->inbuf, s->fsamples, &s->bits);
-                        }
                     else
                         live_oggspeex_encoder_monomix(id->buffer[0], s->inbuf, s->fsamples);
                     
                     encoder_ip_data_free(id);
-                    s->total_samples += s->fsamples;
+                    s->input_pos += s->fsamples;
+                    /* speex may overwrite its input */
+                    if (s->relink)
+                        memcpy(s->relink_buf, s->inbuf, s->fsamples * encoder->n_channels * sizeof (float));
                     }
                 else
                     return;     /* no new audio data available */
+
+                if (encoder->n_channels == 2)
+                    speex_encode_stereo(s->inbuf, s->fsamples, &s->bits);
+                s->total_samples += s->fsamples;
                 }
             }
         else
@@ -264,7 +318,14 @@ static void live_oggspeex_encoder_main(struct encoder *encoder)
         op.bytes = ws;
         op.b_o_s = 0;
         op.packetno = s->packetno++;
-        if (s->samples_encoded >= s->total_samples)
+        if (s->relink)
+            {
+            /* this frame is encoded again to open the next link so it is not played here */
+            op.e_o_s = 1;
+            op.granulepos = s->total_samples - s->fsamples;
+            s->link_end = s->link_origin + op.granulepos;
+            }
+        else if (s->samples_encoded >= s->total_samples)
             {
             op.e_o_s = 1;
             op.granulepos = s->total_samples;
@@ -275,7 +336,7 @@ static void live_oggspeex_encoder_main(struct encoder *encoder)
             op.granulepos = s->samples_encoded;
             }
  
-        if (op.e_o_s || ++s->frame == 10)
+        if (op.e_o_s || ++s->frame >= s->page_frames)
             ogg_paging_function = ogg_stream_flush;
         else
             ogg_paging_function = ogg_stream_pageout;
@@ -288,8 +349,11 @@ static void live_oggspeex_encoder_main(struct encoder *encoder)
             if (ogg_page_eos(&og))
                 {
                 s->pflags |= PF_FINAL;
-                encoder->flush = FALSE;
-                encoder->encoder_state = ES_STOPPING;
+                if (!s->relink)
+                    {
+                    encoder->flush = FALSE;
+                    encoder->encoder_state = ES_STOPPING;
+                    }
                 }
             if (!live_ogg_write_packet(encoder, &og, s->pflags))
                 {
@@ -297,6 +361,12 @@ static void live_oggspeex_encoder_main(struct encoder *encoder)
                 goto bailout;
                 }
             }
+
+        if (op.e_o_s && s->relink)
+            {
+            ogg_stream_clear(&s->os);
+            encoder->encoder_state = ES_STARTING;
+            }
         return;
         }
 
@@ -332,6 +402,7 @@ static void live_oggspeex_encoder_main(struct encoder *encoder)
         
     if (s->inbuf)
         free(s->inbuf);
+    free(s->relink_buf);
     vtag_block_cleanup(&s->metadata_block);
     free(s);
     fprintf(stderr, "live_oggspeex_encoder_main: finished cleanup\n");
@@ -359,6 +430,12 @@ int live_oggspeex_encoder_init(struct encoder *encoder, struct encoder_vars *ev)
     speex_lib_ctl(SPEEX_LIB_GET_VERSION_STRING, (void *)&speex_version);
     snprintf(s->vendor_string, sizeof(s->vendor_string), "Encoded with Speex %s", speex_version); 
     s->vs_len = strlen(s->vendor_string);
+    if (!live_ogg_page_policy_init(&s->page_policy, ev))
+        {
+        vtag_block_cleanup(&s->metadata_block);
+        free(s);
+        return FAILED;
+        }
     s->quality = atoi(ev->quality);
     s->complexity = atoi(ev->complexity);
 
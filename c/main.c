@@ -180,6 +180,7 @@ static int backend_main()
         }
     avcodec_register_all();
     av_register_all();
+    avformat_network_init();
 #endif /* HAVE_LIBAV */
 
     alarm(3);
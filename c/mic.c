@@ -78,14 +78,13 @@ static void mic_process_start(struct mic *self, jack_nframes_t nframes)
             fprintf(stderr, "deactivated ch %d\n", self->id);
             self->open = 0;
             self->mute = 0.0f;
-            self->unp = self->unpm = self->unpmdj = 0.0f;
-            self->lc = self->rc = self->lrc = self->lcm = self->rcm = 0.0f;
             self->peak = peak_init;
             }
 
         self->mode = mode_request;
         }
 
+    self->dfbuf = NULL;
     if (self->mode)
         {
         /* initialisation for later mic stages */
@@ -94,122 +93,221 @@ static void mic_process_start(struct mic *self, jack_nframes_t nframes)
         }
     }
 
-void mic_process_start_all(struct mic **mics, jack_nframes_t nframes)
-    {
-    while (*mics)   
-        mic_process_start(*mics++, nframes);
-    }
-
-static void mic_process_stage1(struct mic *self)
-    {
-    float sample = *self->jadp++;
-    
-    if (isunordered(sample, sample))
-        sample = 0.0f;
-
-    if (self->mode == 3)
-        sample *= self->rel_igain * self->rel_gain;
-    self->sample = sample;
-    }
-
-static void mic_process_stage2(struct mic *self)
+/* block stages run over the whole period ahead of the mix */
+static void mic_block_stage1(struct mic *self)
     {
     struct mic *host = self->host;
-    float sample = self->sample * host->igain;
-
-    /* mic open/close perform fade */
-    if (self->open && self->mute < 0.999999f)
-        self->mute += (1.0f - self->mute) * 26.46f / self->sample_rate;
-    else if (!self->open && self->mute > 0.0000004f)
-        self->mute -= self->mute * 12.348f / self->sample_rate;
-    else
-        self->mute = self->open ? 1.0f : 0.0f;
-     
-    /* unprocessed audio */  
-    self->unp = sample * host->mgain;
-    /* unprocessed audio + mute */
-    self->unpm = self->unp * self->mute;
-    /* unprocessed audio + mute for the DJ mix */
-    self->unpmdj = self->unpm * host->djmute;
+    const float gain = ((self->mode == 3) ? self->rel_igain * self->rel_gain : 1.0f) * host->igain;
+    const float sr = self->sample_rate;
+    float sample, mute = self->mute;
+    
+    for (int i = 0; i < (int)self->nframes; ++i)
+        {
+        sample = self->jadp[i];
+        if (isunordered(sample, sample))
+            sample = 0.0f;
+        self->sbuf[i] = sample * gain;
+
+        /* mic open/close perform fade */
+        if (self->open && mute < 0.999999f)
+            mute += (1.0f - mute) * 26.46f / sr;
+        else if (!self->open && mute > 0.0000004f)
+            mute -= mute * 12.348f / sr;
+        else
+            mute = self->open ? 1.0f : 0.0f;
+        self->mbuf[i] = mute;
+        }
+    self->mute = mute;
 
     if (host->mode == 2)
-        agc_process_stage1(self->agc, sample);
+        agc_process_stage1(self->agc, self->sbuf, self->nframes);
     }
 
-static void mic_process_stage3(struct mic *self)
+static void mic_block_stage2(struct mic *self)
     {
     /* agc side-channel stuff */
     if (self->host->mode == 2)
-        agc_process_stage2(self->agc, self->mute < 0.75f);
+        self->dfbuf = agc_process_stage2(self->agc, self->mbuf, self->nframes);
     }
 
-static void mic_process_stage4(struct mic *self)
+static void mic_block_stage3(struct mic *self)
     {
-    float m = self->mic_g;
-    float a = self->aux_g;
-    struct mic *host = self->host;   
-        
-    if (host->mode == 2)
-        self->lrc = agc_process_stage3(self->agc);
-    else
-        self->lrc = self->unp;
-
-    /* left and right channel audio no mute - could be procesesed or not */
-    self->lc = self->lrc * self->lgain;
-    self->rc = self->lrc * self->rgain;
-    /* the same but with muting */
-    self->lcm = self->lc * self->mute;
-    self->rcm = self->rc * self->mute;
-    
-    /* record peak levels */
-    float l = fabsf(self->lrc);
-    if (l > self->peak)
-        self->peak = l;
-        
-    self->munp = self->unp * m;
-    self->munpm = self->unpm * m;
-    self->munpmdj = self->unpmdj * m;
-    self->mlrc = self->lrc * m;
-    self->mlc = self->lc * m;
-    self->mrc = self->rc * m;
-    self->mlcm = self->lcm * m;
-    self->mrcm = self->rcm * m;
-    self->lmunpm = self->munpm * self->lgain;
-    self->rmunpm = self->munpm * self->rgain;
-    self->lmunpmdj = self->munpmdj * self->lgain;
-    self->rmunpmdj = self->munpmdj * self->rgain;
-
-    self->aunp = self->unp * a;
-    self->aunpm = self->unpm * a;
-    self->aunpmdj = self->unpmdj * a;
-    self->alrc = self->lrc * a;
-    self->alc = self->lc * a;
-    self->arc = self->rc * a;
-    self->alcm = self->lcm * a;
-    self->arcm = self->rcm * a;
+    if (self->host->mode == 2)
+        agc_process_stage3(self->agc, self->pbuf, self->nframes);
     }
 
-float mic_process_all(struct mic **mics)
+void mic_process_start_all(struct mic **mics, jack_nframes_t nframes)
     {
-    static void (*mic_process[])(struct mic *) = {mic_process_stage1,
-            mic_process_stage2, mic_process_stage3, mic_process_stage4, NULL };
-    void (**mpp)(struct mic *);
+    static void (*mic_block[])(struct mic *) = {mic_block_stage1,
+            mic_block_stage2, mic_block_stage3, NULL };
+    void (**mbp)(struct mic *);
     struct mic **mp;
-    float df, agcdf;   
+
+    for (mp = mics; *mp; mp++)
+        mic_process_start(*mp, nframes);
 
     /* processing broken up into stages to allow state sharing between
      * stereo pairs of microphones
      */
-    for (mpp = mic_process; *mpp; mpp++)
+    for (mbp = mic_block; *mbp; mbp++)
         for (mp = mics; *mp; mp++)
             if ((*mp)->mode)
-                (*mpp)(*mp);
-            
+                (*mbp)(*mp);
+    }
+
+/* mic_mix: add one channel to the mix buses
+ *
+ * Each bus is accumulated over the whole period in a simple loop
+ * the compiler is able to vectorise.  Buses the channel makes no
+ * contribution to are skipped.
+ */
+static void mic_mix(struct mic *self, struct mic_mix *mix, int flags, int n)
+    {
+    struct mic *host = self->host;
+    const float m = self->mic_g;
+    const float a = self->aux_g;
+    const float ug = host->mgain;                  /* unprocessed audio gain */
+    const float dj = (flags & MIC_MIX_OPEN) ? 1.0f : host->djmute;
+    const float *unp = self->sbuf;
+    const float *mute = self->mbuf;
+    /* processed audio or, failing that, the unprocessed audio */
+    const float *lrc = (host->mode == 2) ? self->pbuf : self->sbuf;
+    const float lrcg = (host->mode == 2) ? 1.0f : ug;
+    float peak = 0.0f, l, v;
+    int i;
+
+    /* record peak levels */
+    for (i = 0; i < n; ++i)
+        {
+        l = fabsf(lrc[i]);
+        peak = (l > peak) ? l : peak;
+        }
+    if ((peak *= lrcg) > self->peak)
+        self->peak = peak;
+
+    if (m != 0.0f)
+        {
+        const float lk = m * lrcg * self->lgain, rk = m * lrcg * self->rgain;
+        const float dlk = m * ug * dj * self->lgain, drk = m * ug * dj * self->rgain;
+
+        if (flags & MIC_MIX_OPEN)
+            for (i = 0; i < n; ++i)
+                {
+                mix->lc_mic[i] += lk * lrc[i];
+                mix->rc_mic[i] += rk * lrc[i];
+                }
+        else
+            for (i = 0; i < n; ++i)
+                {
+                v = lrc[i] * mute[i];
+                mix->lc_mic[i] += lk * v;
+                mix->rc_mic[i] += rk * v;
+                }
+
+        if (dj != 0.0f)
+            for (i = 0; i < n; ++i)
+                {
+                v = unp[i] * mute[i];
+                mix->dl_mic[i] += dlk * v;
+                mix->dr_mic[i] += drk * v;
+                }
+        }
+
+    if (a != 0.0f)
+        {
+        const float lk = a * lrcg * self->lgain, rk = a * lrcg * self->rgain;
+
+        for (i = 0; i < n; ++i)
+            {
+            v = lrc[i] * mute[i];
+            mix->lc_aux[i] += lk * v;
+            mix->rc_aux[i] += rk * v;
+            }
+        }
+    }
+
+void mic_mix_all(struct mic **mics, struct mic_mix *mix, int flags, jack_nframes_t nframes)
+    {
+    struct mic **mp;
+    const float *dfbuf;
+    float agcdf;
+    const int n = nframes;
+    int i;
+
+    memset(mix->lc_mic, 0, n * sizeof (float));
+    memset(mix->rc_mic, 0, n * sizeof (float));
+    memset(mix->lc_aux, 0, n * sizeof (float));
+    memset(mix->rc_aux, 0, n * sizeof (float));
+    memset(mix->dl_mic, 0, n * sizeof (float));
+    memset(mix->dr_mic, 0, n * sizeof (float));
+
+    for (mp = mics; *mp; mp++)
+        if ((*mp)->mode)
+            mic_mix(*mp, mix, flags, n);
+
+    if (!(flags & MIC_MIX_DUCK))
+        return;
+
     /* ducking factor tally - lowest wins */
-    for (df = 1.0f, mp = mics; *mp; mp++)
-        df = (df > (agcdf = agc_get_ducking_factor((*mp)->agc))) ? agcdf : df;
-          
-    return df;
+    for (i = 0; i < n; ++i)
+        mix->df[i] = 1.0f;
+    for (mp = mics; *mp; mp++)
+        {
+        if ((dfbuf = (*mp)->dfbuf))
+            {
+            for (i = 0; i < n; ++i)
+                mix->df[i] = (mix->df[i] > dfbuf[i]) ? dfbuf[i] : mix->df[i];
+            }
+        else
+            {
+            if ((agcdf = agc_get_ducking_factor((*mp)->agc)) < 1.0f)
+                for (i = 0; i < n; ++i)
+                    mix->df[i] = (mix->df[i] > agcdf) ? agcdf : mix->df[i];
+            }
+        }
+    }
+
+void mic_mix_alloc(struct mic_mix *mix, jack_nframes_t nframes)
+    {
+    float **bus[] = { &mix->lc_mic, &mix->rc_mic, &mix->lc_aux, &mix->rc_aux,
+                      &mix->dl_mic, &mix->dr_mic, &mix->df, NULL };
+
+    for (float ***bp = bus; *bp; ++bp)
+        if (!(**bp = realloc(**bp, nframes * sizeof (float))))
+            {
+            fprintf(stderr, "mic_mix_alloc: malloc failure\n");
+            exit(5);
+            }
+    }
+
+void mic_mix_free(struct mic_mix *mix)
+    {
+    free(mix->lc_mic);
+    free(mix->rc_mic);
+    free(mix->lc_aux);
+    free(mix->rc_aux);
+    free(mix->dl_mic);
+    free(mix->dr_mic);
+    free(mix->df);
+    memset(mix, 0, sizeof (struct mic_mix));
+    }
+
+static void mic_buffer_alloc(struct mic *self, jack_nframes_t nframes)
+    {
+    self->sbuf = realloc(self->sbuf, nframes * sizeof (float));
+    self->mbuf = realloc(self->mbuf, nframes * sizeof (float));
+    self->pbuf = realloc(self->pbuf, nframes * sizeof (float));
+    if (!(self->sbuf && self->mbuf && self->pbuf && agc_set_block_size(self->agc, nframes)))
+        {
+        fprintf(stderr, "mic_buffer_alloc: malloc failure\n");
+        exit(5);
+        }
+    }
+
+void mic_buffer_alloc_all(struct mic **mics, jack_nframes_t nframes)
+    {
+    while (*mics)
+        mic_buffer_alloc(*mics++, nframes);
     }
 
 static int mic_getpeak(struct mic *self)
@@ -252,10 +350,25 @@ static void mic_set_role(struct mic *self, int role)
 
 void mic_set_role_all(struct mic **mics, const char *role)
     {
-    while (*mics)
+    while (*mics && *role)
         mic_set_role(*mics++, *role++);
     }
 
+static void mic_free(struct mic *self)
+    {
+    free(self->sbuf);
+    free(self->mbuf);
+    free(self->pbuf);
+    agc_free(self->agc);
+    self->agc = NULL;
+    if (self->default_mapped_port_name)
+        {
+        free(self->default_mapped_port_name);
+        self->default_mapped_port_name = NULL;
+        } 
+    free(self);
+    }
+    
 static struct mic *mic_init(jack_client_t *client, int sample_rate, int id)
     {
     struct mic *self;
@@ -287,57 +400,112 @@ static struct mic *mic_init(jack_client_t *client, int sample_rate, int id)
     return self;
     }
     
-struct mic **mic_init_all(int n_mics, jack_client_t *client)
+/* mic_init_range: create mics[from] through mics[to - 1] in partnered pairs */
+static int mic_init_range(struct mic **mics, int from, int to, jack_client_t *client)
     {
-    struct mic **mics;
     int i, sr;
     /* used to map suitable port names from the audio back-end as default connection targets */
     const char **defaults, **dp;
-        
-    if (!(mics = calloc(n_mics + 1, sizeof (struct mic *))))
-        {
-        fprintf(stderr, "malloc failure\n");
-        exit(5);
-        }
-    
+
     sr = jack_get_sample_rate(client);
-    defaults = dp = jack_get_ports(client, NULL, NULL, JackPortIsPhysical | JackPortIsOutput);
-    
-    for (i = 0; i < n_mics; i++)
+    defaults = jack_get_ports(client, NULL, NULL, JackPortIsPhysical | JackPortIsOutput);
+    for (dp = defaults, i = 0; dp && *dp && i < from; ++i)
+        ++dp;
+
+    for (i = from; i < to; i++)
         {
-        mics[i] = mic_init(client, sr, i + 1);
-        if (!mics[i])
+        if (!(mics[i] = mic_init(client, sr, i + 1)))
             {
             fprintf(stderr, "mic_init failed\n");
-            exit(5);
+            while (i-- > from)
+                {
+                jack_port_unregister(client, mics[i]->jack_port);
+                mic_free(mics[i]);
+                mics[i] = NULL;
+                }
+            if (defaults)
+                jack_free(defaults);
+            return FALSE;
             }
         mics[i]->default_mapped_port_name = (dp && *dp) ? strdup(*dp++) : NULL;
         }
-        
-    for (i = 0; i < n_mics; i += 2)
+
+    for (i = from; i < to; i += 2)
         {
         mics[i]->partner = mics[i + 1];
         mics[i + 1]->partner = mics[i];
         agc_set_as_partners(mics[i]->agc, mics[i + 1]->agc);
         }
-        
+
     if (defaults)
         jack_free(defaults);
+    return TRUE;
+    }
+
+struct mic **mic_init_all(int n_mics, jack_client_t *client)
+    {
+    struct mic **mics;
+
+    if (!(mics = calloc(n_mics + 1, sizeof (struct mic *))))
+        {
+        fprintf(stderr, "malloc failure\n");
+        exit(5);
+        }
+
+    if (!mic_init_range(mics, 0, n_mics, client))
+        exit(5);
     return mics;
     }
 
-static void mic_free(struct mic *self)
+struct mic **mic_resize_all(struct mic **mics, int n_mics, jack_client_t *client, jack_nframes_t nframes)
     {
-    agc_free(self->agc);
-    self->agc = NULL;
-    if (self->default_mapped_port_name)
+    struct mic **new_mics;
+    int i, n_old;
+
+    for (n_old = 0; mics[n_old]; ++n_old);
+    n_mics += n_mics & 1;   /* channels come in pairs */
+
+    if (!(new_mics = calloc(n_mics + 1, sizeof (struct mic *))))
         {
-        free(self->default_mapped_port_name);
-        self->default_mapped_port_name = NULL;
-        } 
-    free(self);
+        fprintf(stderr, "mic_resize_all: malloc failure\n");
+        return NULL;
+        }
+
+    for (i = 0; i < n_mics && i < n_old; ++i)
+        new_mics[i] = mics[i];
+
+    if (n_mics > n_old)
+        {
+        if (!mic_init_range(new_mics, n_old, n_mics, client))
+            {
+            free(new_mics);
+            return NULL;
+            }
+        if (nframes)
+            for (i = n_old; i < n_mics; ++i)
+                mic_buffer_alloc(new_mics[i], nframes);
+        }
+
+    fprintf(stderr, "mic_resize_all: %d channels, was %d\n", n_mics, n_old);
+    return new_mics;
     }
-    
+
+void mic_retire_all(struct mic **old_mics, struct mic **mics, jack_client_t *client)
+    {
+    struct mic **mp, **cp;
+
+    for (mp = old_mics; *mp; ++mp)
+        {
+        for (cp = mics; *cp && *cp != *mp; ++cp);
+        if (!*cp)
+            {
+            jack_port_unregister(client, (*mp)->jack_port);
+            mic_free(*mp);
+            }
+        }
+    free(old_mics);
+    }
+
 void mic_free_all(struct mic **mics)
     {
     struct mic **mp = mics;   
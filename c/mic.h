@@ -20,42 +20,10 @@
 #include <jack/jack.h>
 #include "agc.h"
 
+#define MIC_MAX 12      /* the most audio input channels the preferences offer */
+
 struct mic
     {
-    /* outputs */
-    float unp;       /* barely processed audio without muting */
-    float unpm;      /* barely processed audio with channel muting */
-    float unpmdj;    /* barely processed audio with channel and dj mix muting */
-    float lrc;       /* both audio channels without muting */
-    float lc;        /* audio left channel without muting */
-    float rc;        /* audio right channel without muting */
-    float lcm;       /* audio left channel with muting */
-    float rcm;       /* audio right channel with muting */
-
-    /* mic specific output */
-    float munp;       /* barely processed audio without muting */
-    float munpm;      /* barely processed audio with muting */
-    float lmunpm;     /* barely processed left audio with muting and panning */
-    float rmunpm;     /* barely processed right audio with muting and panning */
-    float munpmdj;    /* barely processed audio for the dj mix */
-    float lmunpmdj;   /* munpmdj with left channel panning */
-    float rmunpmdj;   /* munpmdj with right channel panning */
-    float mlrc;       /* both audio channels without muting */
-    float mlc;        /* audio left channel without muting */
-    float mrc;        /* audio right channel without muting */
-    float mlcm;       /* audio left channel with muting */
-    float mrcm;       /* audio right channel with muting */
-
-    /* aux specific output */
-    float aunp;       /* barely processed audio without muting */
-    float aunpm;      /* barely processed audio with muting */
-    float aunpmdj;    /* barely processed audio for the dj mix */
-    float alrc;       /* both audio channels without muting */
-    float alc;        /* audio left channel without muting */
-    float arc;        /* audio right channel without muting */
-    float alcm;       /* audio left channel with muting */
-    float arcm;       /* audio right channel with muting */
-    
     /* control inputs */
     int open;        /* mic open/close */
     int invert;      /* mic signal is inverted */
@@ -70,7 +38,10 @@ struct mic
     struct mic *host;/* the dominant mic in a pairing */
     struct mic *partner; /* the partnerable mic */
     struct agc *agc; /* automatic gain control and much more */
-    float sample;    /* storage for the audio sample undergoing processing */
+    float *sbuf;     /* block of input audio with gain trims applied */
+    float *mbuf;     /* block of soft mute gain values */
+    float *pbuf;     /* block of agc processed audio */
+    const float *dfbuf; /* block of agc ducking factors or NULL */
     float sample_rate; /* used for smoothed mute timing */
     float mgain;   /* mono gain value (absolute gain) */
     float lgain;   /* left gain value (pan relative) */
@@ -89,10 +60,36 @@ struct mic
     char *default_mapped_port_name; /* the natural partner port or NULL*/
     };
 
+/* the mix buses built from all the active channels a period at a time */
+struct mic_mix
+    {
+    float *lc_mic;   /* mic bus left */
+    float *rc_mic;   /* mic bus right */
+    float *lc_aux;   /* aux bus left */
+    float *rc_aux;   /* aux bus right */
+    float *dl_mic;   /* barely processed mic bus for the dj mix left */
+    float *dr_mic;   /* barely processed mic bus for the dj mix right */
+    float *df;       /* ducking factor, lowest of all channels */
+    };
+
+/* mic_mix_all flags */
+#define MIC_MIX_DUCK 1  /* the ducking factor is wanted */
+#define MIC_MIX_OPEN 2  /* mic bus ignores channel muting and dj bus ignores dj muting */
+
 void mic_process_start_all(struct mic **mics, jack_nframes_t nframes);
-float mic_process_all(struct mic **mics);
+void mic_buffer_alloc_all(struct mic **mics, jack_nframes_t nframes);
+void mic_mix_all(struct mic **mics, struct mic_mix *mix, int flags, jack_nframes_t nframes);
+void mic_mix_alloc(struct mic_mix *mix, jack_nframes_t nframes);
+void mic_mix_free(struct mic_mix *mix);
 void mic_stats_all(struct mic **mics);
 struct mic **mic_init_all(int n_mics, jack_client_t *client);
+
+/* mic_resize_all: a new mic array of n_mics channels (rounded up to a pair)
+ * sharing the existing channels with the old array, which is left intact
+ * return value: the new array or NULL on failure */
+struct mic **mic_resize_all(struct mic **mics, int n_mics, jack_client_t *client, jack_nframes_t nframes);
+/* mic_retire_all: free old_mics along with the channels not carried over into mics */
+void mic_retire_all(struct mic **old_mics, struct mic **mics, jack_client_t *client);
 void mic_free_all(struct mic **self);
 void mic_valueparse(struct mic *s, char *param);
 void mic_set_role_all(struct mic **s, const char *role);
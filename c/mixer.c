@@ -47,7 +47,9 @@
 #include "sndfileinfo.h"
 #include "avcodecdecode.h"
 #include "oggdec.h"
+#include "decprobe.h"
 #include "mic.h"
+#include "streamdsp.h"
 #include "bsdcompat.h"
 #include "peakfilter.h"
 #include "sig.h"
@@ -56,8 +58,13 @@
 #define TRUE 1
 #define FALSE 0
 
-/* playlength of ring buffer contents in seconds */
+/* default playlength of ring buffer contents in seconds */
 #define MAIN_RB_SIZE 10.0
+#define EFFECTS_RB_SIZE 0.15
+/* the number of fade buffer pairs per role -- one per simultaneous eject fade */
+#define MAIN_FADE_POOL 2
+#define INTERLUDE_FADE_POOL 1
+#define EFFECTS_FADE_POOL 4
 /* number of bytes in the MIDI queue buffer */
 #define MIDI_QUEUE_SIZE 1024
 
@@ -103,7 +110,14 @@ static int effects_active;
 /* flag to indicate if audio is routed via dsp interface */
 static int using_dsp;
 /* handles for microphone */
-static struct mic **mics;
+/* the mic array is swapped rcu style, the real-time thread taking a copy of the
+ * pointer once per period and counting the periods it has completed */
+static struct mic ** volatile mics;
+static struct mic_mix mic_mix;
+static struct streamdsp *stream_dsp;
+static volatile unsigned mixer_periods;
+static jack_nframes_t mic_nframes;
+static pthread_mutex_t mic_mutex = PTHREAD_MUTEX_INITIALIZER;
 /* peakfilter handles for stream peak */
 static struct peakfilter *str_pf_l, *str_pf_r;
 /* counts the number of times port connections have changed */
@@ -154,6 +168,7 @@ static size_t midi_nqueued= 0;
 static pthread_mutex_t midi_mutex;
 
 static struct xlplayer *plr_l, *plr_r, *plr_i; /* player instance stuctures */
+static struct xlplayer_rbpool *main_pool, *interlude_pool, *effects_pool;
 static struct xlplayer **plr_j;
 static struct xlplayer **plr_j_roster;
 static struct xlplayer *players[4];
@@ -175,6 +190,7 @@ static char *use_jingles_vol_2;
 static char *jackport, *jackport2, *jackfilter;
 static char *effect_ix, *voip_pan;
 static char *session_event_string, *session_commandline;
+static char *stream_dsp_param;
 
 static struct smoothing_volume jingles_headroom_smoothing;
 static int jingles_headroom_control;
@@ -213,6 +229,7 @@ static struct kvpdict kvpdict[] = {
             { "SPXC", &speexcreatedby, NULL },
             { "RSQT", &resamplequality, NULL },
             { "AGCP", &mic_param, NULL },
+            { "SDSP", &stream_dsp_param, NULL },
             { "HEAD", &headroom, NULL },
             { "FLAG", &flag, NULL },
             { "CMOD", &channel_mode_string, NULL },
@@ -431,6 +448,43 @@ static void update_smoothed_volumes()
     }
 
 /* process_audio: the JACK callback routine */
+/* fetch the mic and aux bus levels of the current frame */
+#define MIC_MIX_READ() \
+    do { \
+    mix_i = nframes - samples_todo - 1; \
+    lc_s_micmix = mic_mix.lc_mic[mix_i]; \
+    rc_s_micmix = mic_mix.rc_mic[mix_i]; \
+    lc_s_auxmix = mic_mix.lc_aux[mix_i]; \
+    rc_s_auxmix = mic_mix.rc_aux[mix_i]; \
+    dl_micmix = mic_mix.dl_mic[mix_i]; \
+    dr_micmix = mic_mix.dr_mic[mix_i]; \
+    } while (0)
+
+/* stream_dsp_post: run the built-in stream processing on the completed stream mix
+ * and bring the stream monitor and stream meters up to date with the result */
+static void stream_dsp_post(sample_t *ls, sample_t *rs, sample_t *la, sample_t *ra, jack_nframes_t nframes)
+    {
+    jack_nframes_t i;
+
+    streamdsp_process(stream_dsp, ls, rs, nframes);
+
+    if (stream_monitor)
+        for (i = 0; i < nframes; ++i)
+            {
+            la[i] = ls[i] * dj_audio_gain;
+            ra[i] = rs[i] * dj_audio_gain;
+            }
+
+    for (i = 0; i < nframes; ++i)
+        {
+        peakfilter_process(str_pf_l, ls[i]);
+        peakfilter_process(str_pf_r, rs[i]);
+        str_l_tally += ls[i] * ls[i];
+        str_r_tally += rs[i] * rs[i];
+        }
+    rms_tally_count += nframes;
+    }
+
 int mixer_process_audio(jack_nframes_t nframes, void *arg)
     {
     int samples_todo;   /* The samples remaining counter in the main loop */
@@ -457,7 +511,9 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
     jack_nframes_t midi_nevents, midi_eventi;
     int midi_command_type, midi_channel_id;
     int pitch_wheel;
-    struct mic **micp;
+    int mix_i;          /* index into the mic mix buses */
+    struct mic ** const rt_mics = mics;
+    int stream_dsp_on;  /* the built-in stream processing is active this period */
     float * const jh = &jingles_headroom_smoothing.level;
     float * const jhi = inter_force ? jh : &((struct {float a;}){1.0f}).a;
     float e_ls, e_rs, e1_ls, e1_rs, e2_ls, e2_rs;
@@ -561,7 +617,10 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
         reset_vu_stats_f = FALSE;
         }
 
-    mic_process_start_all(mics, nframes);
+    /* the simple mixer has no use for the mics */
+    if (simple_mixer == FALSE)
+        mic_process_start_all(rt_mics, nframes);
+    stream_dsp_on = simple_mixer == FALSE && streamdsp_period_start(stream_dsp);
     xlplayer_read_start_all(players, nframes, players_roster);
     xlplayer_read_start_all(plr_j, nframes, plr_j_roster);
     
@@ -571,6 +630,7 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
         {
         memset(lps_buffer, 0, nframes * sizeof (sample_t)); /* send silence to VOIP */
         memset(rps_buffer, 0, nframes * sizeof (sample_t));
+        mic_mix_all(rt_mics, &mic_mix, MIC_MIX_DUCK, nframes);
         for(samples_todo = nframes; samples_todo--; lap++, rap++, lsp++, rsp++,
                     dilp++, dirp++, dolp++, dorp++, aap++,
                     plolp++, plorp++, prolp++, prorp++, piolp++, piorp++, pe1olp++, pe1orp++, pe2olp++, pe2orp++,
@@ -579,16 +639,8 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
             if (vol_smooth_count++ % 100 == 0) /* Can change volume level every so many samples */
                 update_smoothed_volumes();
                 
-            df = powf(mic_process_all(mics), dfmod);
-            for (micp = mics, lc_s_micmix = rc_s_micmix = lc_s_auxmix = rc_s_auxmix = dl_micmix = dr_micmix = 0.0f; *micp; micp++)
-                {
-                lc_s_micmix += (*micp)->mlcm;
-                rc_s_micmix += (*micp)->mrcm;
-                lc_s_auxmix += (*micp)->alcm;
-                rc_s_auxmix += (*micp)->arcm;
-                dl_micmix += (*micp)->lmunpmdj;
-                dr_micmix += (*micp)->rmunpmdj;
-                }
+            MIC_MIX_READ();
+            df = powf(mic_mix.df[mix_i], dfmod);
          
             /* ducking calculation */
             {
@@ -689,13 +741,16 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                     *rap *= dj_audio_gain; \
                     \
                     /* make note of the peak volume levels */ \
-                    peakfilter_process(str_pf_l, *lsp); \
-                    peakfilter_process(str_pf_r, *rsp); \
-                    \
-                    /* used for rms calculation */ \
-                    str_l_tally += *lsp * *lsp; \
-                    str_r_tally += *rsp * *rsp; \
-                    rms_tally_count++; \
+                    if (!stream_dsp_on) \
+                        { \
+                        peakfilter_process(str_pf_l, *lsp); \
+                        peakfilter_process(str_pf_r, *rsp); \
+                        \
+                        /* used for rms calculation */ \
+                        str_l_tally += *lsp * *lsp; \
+                        str_r_tally += *rsp * *rsp; \
+                        rms_tally_count++; \
+                        } \
                     \
                     if (eot_alarm_f) /* end-of-track alarm tone */ \
                         { \
@@ -717,12 +772,15 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                 
             COMMON_MIX3();
             }
+        if (stream_dsp_on)
+            stream_dsp_post(ls_buffer, rs_buffer, la_buffer, ra_buffer, nframes);
         str_l_meansqrd = str_l_tally/rms_tally_count;
         str_r_meansqrd = str_r_tally/rms_tally_count;
         }
     else
         if (simple_mixer == FALSE && mixermode == PHONE_PUBLIC)
             {
+            mic_mix_all(rt_mics, &mic_mix, 0, nframes);
             for(samples_todo = nframes; samples_todo--; lap++, rap++, lsp++, rsp++, aap++,
                     lpsp++, rpsp++, lprp++, rprp++, dilp++, dirp++, dolp++, dorp++,
                     plolp++, plorp++, prolp++, prorp++, piolp++, piorp++, pe1olp++, pe1orp++, pe2olp++, pe2orp++,
@@ -733,16 +791,7 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                 if (vol_smooth_count++ % 100 == 0) /* Can change volume level every so many samples */
                     update_smoothed_volumes();
             
-                mic_process_all(mics);
-                for (micp = mics, lc_s_micmix = rc_s_micmix = lc_s_auxmix = rc_s_auxmix = dl_micmix = dr_micmix = 0.0f; *micp; micp++)
-                    {
-                    lc_s_micmix += (*micp)->mlcm;
-                    rc_s_micmix += (*micp)->mrcm;
-                    lc_s_auxmix += (*micp)->alcm;
-                    rc_s_auxmix += (*micp)->arcm;
-                    dl_micmix += (*micp)->lmunpmdj;
-                    dr_micmix += (*micp)->rmunpmdj;
-                    }
+                MIC_MIX_READ();
 
                 /* No ducking but headroom still must apply */
                 df = db2level(current_headroom);
@@ -795,12 +844,15 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                     
                 COMMON_MIX3();
                 }
+            if (stream_dsp_on)
+                stream_dsp_post(ls_buffer, rs_buffer, la_buffer, ra_buffer, nframes);
             str_l_meansqrd = str_l_tally/rms_tally_count;
             str_r_meansqrd = str_r_tally/rms_tally_count;
             }
         else
             if (simple_mixer == FALSE && mixermode == PHONE_PRIVATE && mic_on == 0)
                 {
+                mic_mix_all(rt_mics, &mic_mix, MIC_MIX_OPEN, nframes);
                 for(samples_todo = nframes; samples_todo--; lap++, rap++, lsp++, rsp++,
                     lpsp++, rpsp++, lprp++, rprp++, dilp++, dirp++, dolp++, dorp++, aap++,
                     plolp++, plorp++, prolp++, prorp++, piolp++, piorp++, pe1olp++, pe1orp++, pe2olp++, pe2orp++,
@@ -809,16 +861,7 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                     if (vol_smooth_count++ % 100 == 0) /* Can change volume level every so many samples */
                         update_smoothed_volumes();
 
-                    mic_process_all(mics);
-                    for (micp = mics, lc_s_micmix = rc_s_micmix = lc_s_auxmix = rc_s_auxmix = dl_micmix = dr_micmix = 0.0f; *micp; micp++)
-                        {
-                        lc_s_micmix += (*micp)->mlc;
-                        rc_s_micmix += (*micp)->mrc;
-                        lc_s_auxmix += (*micp)->alcm;
-                        rc_s_auxmix += (*micp)->arcm;
-                        dl_micmix += (*micp)->lmunpm;
-                        dr_micmix += (*micp)->rmunpm;
-                        }
+                    MIC_MIX_READ();
                     
                     /* No ducking */
 
@@ -869,12 +912,15 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                         
                     COMMON_MIX3();
                     }
+                if (stream_dsp_on)
+                    stream_dsp_post(ls_buffer, rs_buffer, la_buffer, ra_buffer, nframes);
                 str_l_meansqrd = str_l_tally/rms_tally_count;
                 str_r_meansqrd = str_r_tally/rms_tally_count;
                 }
             else
                 if (simple_mixer == FALSE && mixermode == PHONE_PRIVATE) /* note: mic is on */
                     {
+                    mic_mix_all(rt_mics, &mic_mix, MIC_MIX_DUCK, nframes);
                     for(samples_todo = nframes; samples_todo--; lap++, rap++, lsp++, rsp++, 
                             lpsp++, rpsp++, dilp++, dirp++, dolp++, dorp++, aap++,
                             plolp++, plorp++, prolp++, prorp++, piolp++, piorp++, pe1olp++, pe1orp++, pe2olp++, pe2orp++,
@@ -883,16 +929,8 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                         if (vol_smooth_count++ % 100 == 0) /* Can change volume level every so many samples */
                             update_smoothed_volumes();
 
-                        df = powf(mic_process_all(mics), dfmod);
-                        for (micp = mics, lc_s_micmix = rc_s_micmix = lc_s_auxmix = rc_s_auxmix = dl_micmix = dr_micmix = 0.0f; *micp; micp++)
-                            {
-                            lc_s_micmix += (*micp)->mlcm;
-                            rc_s_micmix += (*micp)->mrcm;
-                            lc_s_auxmix += (*micp)->alcm;
-                            rc_s_auxmix += (*micp)->arcm;
-                            dl_micmix += (*micp)->lmunpmdj;
-                            dr_micmix += (*micp)->rmunpmdj;
-                            }
+                        MIC_MIX_READ();
+                        df = powf(mic_mix.df[mix_i], dfmod);
 
                         /* ducking calculation */
                         {
@@ -934,6 +972,8 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                             
                         COMMON_MIX3();
                         }
+                    if (stream_dsp_on)
+                        stream_dsp_post(ls_buffer, rs_buffer, la_buffer, ra_buffer, nframes);
                     str_l_meansqrd = str_l_tally/rms_tally_count;
                     str_r_meansqrd = str_r_tally/rms_tally_count;
                     }
@@ -983,7 +1023,8 @@ int mixer_process_audio(jack_nframes_t nframes, void *arg)
                         }
                     else
                         fprintf(stderr,"Error: no mixer mode was chosen\n");
-                        
+
+    __sync_add_and_fetch(&mixer_periods, 1);
     return 0;
     }
  
@@ -1097,6 +1138,8 @@ static void mixer_cleanup()
     free(s.our_sc_str_in_l);
     free(s.our_sc_str_in_r);
     mic_free_all(mics);
+    mic_mix_free(&mic_mix);
+    streamdsp_destroy(stream_dsp);
     peakfilter_destroy(str_pf_l);
     peakfilter_destroy(str_pf_r);
     xlplayer_destroy(plr_l);
@@ -1106,6 +1149,11 @@ static void mixer_cleanup()
         xlplayer_destroy(*p);
     free(plr_j);
     free(plr_j_roster);
+    decprobe_cache_flush();
+    if (interlude_pool != main_pool)
+        xlplayer_rbpool_destroy(interlude_pool);
+    xlplayer_rbpool_destroy(main_pool);
+    xlplayer_rbpool_destroy(effects_pool);
     }
 
 int mixer_new_buffer_size(jack_nframes_t n_frames)
@@ -1113,9 +1161,78 @@ int mixer_new_buffer_size(jack_nframes_t n_frames)
     fprintf(stderr, "player read buffer allocated for %ld frames\n", (long)n_frames);
     xlplayer_buffer_alloc_all(players, n_frames);
     xlplayer_buffer_alloc_all(plr_j, n_frames);
+    pthread_mutex_lock(&mic_mutex);
+    mic_buffer_alloc_all(mics, n_frames);
+    mic_mix_alloc(&mic_mix, n_frames);
+    mic_nframes = n_frames;
+    if (!streamdsp_set_block_size(stream_dsp, n_frames))
+        {
+        fprintf(stderr, "mixer_new_buffer_size: malloc failure\n");
+        exit(5);
+        }
+    pthread_mutex_unlock(&mic_mutex);
     return 0;
     }
 
+/* mixer_mic_resize: publish a resized mic array and free the old one
+ * after the real-time thread has finished with it */
+static void mixer_mic_resize(int n_mics)
+    {
+    struct mic **old_mics = mics, **new_mics;
+    jack_nframes_t nframes;
+    unsigned periods;
+    int wait;
+
+    if (n_mics < 2 || n_mics > MIC_MAX)
+        {
+        fprintf(stderr, "mixer_mic_resize: %d channels requested, limiting to 2-%d\n", n_mics, MIC_MAX);
+        n_mics = (n_mics < 2) ? 2 : MIC_MAX;
+        }
+
+    /* port registration waits on jack which may be calling mixer_new_buffer_size
+     * so the new channels are created without holding mic_mutex */
+    pthread_mutex_lock(&mic_mutex);
+    nframes = mic_nframes;
+    pthread_mutex_unlock(&mic_mutex);
+    if (!(new_mics = mic_resize_all(old_mics, n_mics, g.client, nframes)))
+        {
+        fprintf(stderr, "mixer_mic_resize: failed to resize to %d channels\n", n_mics);
+        return;
+        }
+
+    pthread_mutex_lock(&mic_mutex);
+    if (mic_nframes != nframes)
+        mic_buffer_alloc_all(new_mics, mic_nframes);
+    __sync_synchronize();
+    mics = new_mics;
+    __sync_synchronize();
+    pthread_mutex_unlock(&mic_mutex);
+
+    /* grace period: a process cycle completing after the swap can only
+     * have been the last to see the old array */
+    for (periods = mixer_periods, wait = 0; mixer_periods == periods; ++wait)
+        {
+        if (wait == 200)
+            {
+            fprintf(stderr, "mixer_mic_resize: jack not running, old mic array leaked\n");
+            return;
+            }
+        nanosleep(&(struct timespec){0, 10000000}, NULL);
+        }
+    mic_retire_all(old_mics, new_mics, g.client);
+    }
+
+/* rb_duration: ringbuffer length for a player role which may be overridden by the environment */
+static double rb_duration(const char *envname, double fallback)
+    {
+    char *value = getenv(envname);
+    double duration;
+
+    if (!value || (duration = atof(value)) <= 0.0)
+        return fallback;
+    return duration;
+    }
+
 void mixer_init(void)
     {
     sr = jack_get_sample_rate(g.client);
@@ -1123,9 +1240,19 @@ void mixer_init(void)
     player_samples_cutoff = sr * 0.25;           /* for gapless playback */
     int n = 0;
     int ne = atoi(getenv("num_effects"));
+    double main_duration = rb_duration("main_rb_size", MAIN_RB_SIZE);
+    double interlude_duration = rb_duration("interlude_rb_size", main_duration);
 
-    if(! ((players[n++] = plr_l = xlplayer_create(sr, MAIN_RB_SIZE, "left", &g.app_shutdown, &volume, 0, &left_stream, &left_audio, 0.3f)) &&
-            (players[n++] = plr_r = xlplayer_create(sr, MAIN_RB_SIZE, "right", &g.app_shutdown, &volume2, 0, &right_stream, &right_audio, 0.3f))))
+    /* the interlude player can share fade buffers with the main players when the sizes agree */
+    main_pool = xlplayer_rbpool_create(sr, main_duration, MAIN_FADE_POOL);
+    if (interlude_duration == main_duration)
+        interlude_pool = main_pool;
+    else
+        interlude_pool = xlplayer_rbpool_create(sr, interlude_duration, INTERLUDE_FADE_POOL);
+    effects_pool = xlplayer_rbpool_create(sr, rb_duration("effects_rb_size", EFFECTS_RB_SIZE), EFFECTS_FADE_POOL);
+
+    if(! ((players[n++] = plr_l = xlplayer_create(sr, main_pool, "left", &g.app_shutdown, &volume, 0, &left_stream, &left_audio, 0.3f)) &&
+            (players[n++] = plr_r = xlplayer_create(sr, main_pool, "right", &g.app_shutdown, &volume2, 0, &right_stream, &right_audio, 0.3f))))
         {
         fprintf(stderr, "failed to create main player modules\n");
         exit(5);
@@ -1147,7 +1274,7 @@ void mixer_init(void)
         {
         int *volct = (i < 12) ? &jinglesvolume1 : &jinglesvolume2;
 
-        if (!(plr_j[i] = xlplayer_create(sr, 0.15f, "jingles", &g.app_shutdown, volct, 0, NULL, NULL, 0.0f)))
+        if (!(plr_j[i] = xlplayer_create(sr, effects_pool, "jingles", &g.app_shutdown, volct, 0, NULL, NULL, 0.0f)))
             {
             fprintf(stderr, "failed to create jingles player module\n");
             exit(5);
@@ -1155,7 +1282,7 @@ void mixer_init(void)
         plr_j[i]->fade_mode = 3;
         }
     
-    if (!(players[n++] = plr_i = xlplayer_create(sr, MAIN_RB_SIZE, "interlude", &g.app_shutdown, &interludevol, 0, &inter_stream, &inter_audio, 0.3f)))
+    if (!(players[n++] = plr_i = xlplayer_create(sr, interlude_pool, "interlude", &g.app_shutdown, &interludevol, 0, &inter_stream, &inter_audio, 0.3f)))
         {
         fprintf(stderr, "failed to create interlude player module\n");
         exit(5);
@@ -1204,6 +1331,9 @@ void mixer_init(void)
 
     /* allocate microphone resources */
     mics = mic_init_all(atoi(getenv("mic_qty")), g.client);
+
+    /* the built-in alternative to external processing via dsp_out/dsp_in */
+    stream_dsp = streamdsp_create(sr);
         
     jack_set_port_connect_callback(g.client, custom_jack_port_connect_callback, NULL);
                 
@@ -1316,7 +1446,21 @@ int mixer_main()
 
     if (!strcmp(action, "mic_control"))
         {
-        mic_valueparse(mics[atoi(item_index)], mic_param);
+        int i = atoi(item_index), n;
+
+        for (n = 0; mics[n]; ++n);
+        if (i >= 0 && i < n)
+            mic_valueparse(mics[i], mic_param);
+        }
+
+    if (!strcmp(action, "mic_qty"))
+        {
+        mixer_mic_resize(atoi(new_mic_string));
+        }
+
+    if (!strcmp(action, "streamdsp_control"))
+        {
+        streamdsp_valueparse(stream_dsp, stream_dsp_param);
         }
 
     if (!strcmp(action, "new_channel_mode_string"))
@@ -1591,6 +1735,7 @@ int mixer_main()
                     "ports_connections_changed=%d\n"
                     "effects_playing=%d\n"
                     "freewheel_mode=%d\n"
+                    "buffer_memory=%lu\n"
                     "end\n",
                     s.str_l_peak_db, s.str_r_peak_db,
                     s.str_l_rms_db, s.str_r_rms_db,
@@ -1598,7 +1743,8 @@ int mixer_main()
                     s.session_command,
                     ports_diff,
                     effects,
-                    g.freewheel
+                    g.freewheel,
+                    (unsigned long)xlplayer_buffer_memory()
                     );
 
         if (ports_diff)
@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include "xlplayer.h"
 #include "mp3dec.h"
+#include "httpsource.h"
 #include "bsdcompat.h"
 
 #define TRUE 1
@@ -143,6 +144,21 @@ static void mp3decode_play(struct xlplayer *xlplayer)
     }
 
 
+/* stdio backed reader functions for streams lacking a file descriptor e.g. http */
+static ssize_t mp3decode_read(void *handle, void *buf, size_t count)
+    {
+    size_t n = fread(buf, 1, count, (FILE *)handle);
+
+    return (n || !ferror((FILE *)handle)) ? (ssize_t)n : -1;
+    }
+
+static off_t mp3decode_lseek(void *handle, off_t offset, int whence)
+    {
+    if (fseeko((FILE *)handle, offset, whence))
+        return -1;
+    return ftello((FILE *)handle);
+    }
+
 static void decoder_library_init()
     {
     if((decoder_library_ok = (mpg123_init() == MPG123_OK)))
@@ -155,7 +171,7 @@ int mp3decode_reg(struct xlplayer *xlplayer)
     static pthread_once_t once_control = PTHREAD_ONCE_INIT;
     struct mp3decode_vars *self;
     struct chapter *chapter;
-    int fd, rv;
+    int fd, rv, seekable;
     long rate;
     int channels, encoding;
     int src_error;
@@ -214,19 +230,44 @@ int mp3decode_reg(struct xlplayer *xlplayer)
     mpg123_format(self->mh, 11025, MPG123_STEREO, MPG123_ENC_FLOAT_32);
     mpg123_format(self->mh, 8000, MPG123_STEREO, MPG123_ENC_FLOAT_32);
 
-    if (!(self->fp = fopen(xlplayer->pathname, "r")))
+    if (httpsource_is_url(xlplayer->pathname))
         {
-        fprintf(stderr, "mp3decode_reg: failed to open %s\n", xlplayer->pathname);
-        goto rej_;
-        }
+        if (!(self->fp = httpsource_fopen(xlplayer, xlplayer->pathname, &seekable)))
+            {
+            fprintf(stderr, "mp3decode_reg: failed to open %s\n", xlplayer->pathname);
+            goto rej_;
+            }
 
-    mp3_tag_read(&self->taginfo, self->fp);
-    lseek(fd = fileno(self->fp), 0, SEEK_SET);
+        /* tags can only be read when there is the means to rewind */
+        if (seekable)
+            {
+            mp3_tag_read(&self->taginfo, self->fp);
+            fseeko(self->fp, 0, SEEK_SET);
+            }
 
-    if ((rv = mpg123_open_fd(self->mh, fd)) != MPG123_OK)
+        if ((rv = mpg123_replace_reader_handle(self->mh, mp3decode_read, mp3decode_lseek, NULL)) != MPG123_OK ||
+                                    (rv = mpg123_open_handle(self->mh, self->fp)) != MPG123_OK)
+            {
+            fprintf(stderr, "mp3decode_reg: mpg123_open_handle failed with return value %d\n", rv);
+            goto rej__;
+            }
+        }
+    else
         {
-        fprintf(stderr, "mp3decode_reg: mpg123_open_fd failed with return value %d\n", rv);
-        goto rej__;
+        if (!(self->fp = fopen(xlplayer->pathname, "r")))
+            {
+            fprintf(stderr, "mp3decode_reg: failed to open %s\n", xlplayer->pathname);
+            goto rej_;
+            }
+
+        mp3_tag_read(&self->taginfo, self->fp);
+        lseek(fd = fileno(self->fp), 0, SEEK_SET);
+
+        if ((rv = mpg123_open_fd(self->mh, fd)) != MPG123_OK)
+            {
+            fprintf(stderr, "mp3decode_reg: mpg123_open_fd failed with return value %d\n", rv);
+            goto rej__;
+            }
         }
         
     if (mpg123_getformat(self->mh, &rate, &channels, &encoding) != MPG123_OK || channels != 2)
@@ -30,6 +30,7 @@
 #include "ogg_flac_dec.h"
 #include "ogg_speex_dec.h"
 #include "vorbistagparse.h"
+#include "httpsource.h"
 
 #define ACCEPTED 1
 #define REJECTED 0
@@ -809,14 +810,14 @@ static off_t oggscan(struct oggdec_vars *self, off_t *offset, off_t offset_end)
     return oggscan_eos(self, *offset, offset_end, serial, 0);
     }
 
-static struct oggdec_vars *oggdecode_get_metadata(char *pathname)
+static struct oggdec_vars *oggdecode_get_metadata(struct xlplayer *xlplayer, char *pathname)
     {
     struct oggdec_vars *self;
     long   id3size = 0;
     off_t  offset = 0, offset_end, offset_new;
     size_t bytes;
     char  *buffer;
-    int i;
+    int i, seekable;
     unsigned samplerate = 0;
     double start_time = 0.0;
     
@@ -829,8 +830,19 @@ static struct oggdec_vars *oggdecode_get_metadata(char *pathname)
     
     self->magic = 4747;
     
-    /* open the media file */
-    if (!(self->fp = fopen(pathname, "r")))
+    /* open the media file, remote files need to be seekable since the whole file is scanned */
+    if (xlplayer && httpsource_is_url(pathname))
+        {
+        if ((self->fp = httpsource_fopen(xlplayer, pathname, &seekable)) && !seekable)
+            {
+            fprintf(stderr, "oggdecode_reg: live ogg streams are not supported %s\n", pathname);
+            fclose(self->fp);
+            self->fp = NULL;
+            }
+        }
+    else
+        self->fp = fopen(pathname, "r");
+    if (!self->fp)
         {
         fprintf(stderr, "oggdecode_reg: unable to open media file %s\n", pathname);
         free(self);
@@ -1196,7 +1208,7 @@ int oggdecode_reg(struct xlplayer *xlplayer)
     {
     struct oggdec_vars *self;
 
-    if (!(self = oggdecode_get_metadata(xlplayer->pathname)))
+    if (!(self = oggdecode_get_metadata(xlplayer, xlplayer->pathname)))
         return REJECTED;
     else
         {
@@ -1215,7 +1227,7 @@ int oggdecode_get_metainfo(char *pathname, char **artist, char **title, char **a
     struct oggdec_vars *self;
     int has_pbtime;
     
-    if(!(self = oggdecode_get_metadata(pathname)))
+    if(!(self = oggdecode_get_metadata(NULL, pathname)))
         {
         fprintf(stderr, "call to oggdecode_get_metadata failed for %s\n", pathname);
         return REJECTED;
@@ -0,0 +1,185 @@
+/*
+#   packetpool.c: reference counted encoded packets for the streaming module
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Packets come in power of two size classes from 512 bytes to 64k which
+ * covers the largest Ogg page.  A class is refilled a slab at a time and
+ * packets are never returned to the heap until the pool is destroyed.
+ * Larger packets are allocated individually.
+ *
+ * Each class keeps its free packets on a stack.  Any thread may push but
+ * only the encoder thread pops so the stack is immune to the ABA problem.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sourceclient.h"
+#include "packetpool.h"
+
+#define MIN_CLASS_SHIFT 9
+#define N_CLASSES 8
+#define SLAB_BYTES 131072
+#define HEAD_SIZE ((sizeof (struct packet_pool_buf) + 15) & ~(size_t)15)
+
+struct packet_pool_buf
+    {
+    struct encoder_op_packet packet;    /* first so the packet leads to its buffer */
+    struct packet_pool *pool;
+    struct packet_pool_buf *next;       /* in the free stack */
+    volatile int refs;
+    int size_class;                     /* -1 when individually allocated */
+    };
+
+struct packet_pool_slab
+    {
+    struct packet_pool_slab *next;
+    };
+
+struct packet_pool
+    {
+    struct packet_pool_buf *volatile free[N_CLASSES];
+    struct packet_pool_slab *slabs;     /* only touched by the encoder thread */
+    };
+
+static int packet_pool_size_class(size_t data_size)
+    {
+    int c = 0;
+
+    while (c < N_CLASSES && data_size > (size_t)1 << (MIN_CLASS_SHIFT + c))
+        ++c;
+    return (c < N_CLASSES) ? c : -1;
+    }
+
+static void packet_pool_push(struct packet_pool *self, struct packet_pool_buf *buf)
+    {
+    struct packet_pool_buf *head;
+
+    do {
+        head = self->free[buf->size_class];
+        buf->next = head;
+        } while (!__sync_bool_compare_and_swap(&self->free[buf->size_class], head, buf));
+    }
+
+static struct packet_pool_buf *packet_pool_pop(struct packet_pool *self, int c)
+    {
+    struct packet_pool_buf *buf;
+
+    do {
+        if (!(buf = self->free[c]))
+            break;
+        } while (!__sync_bool_compare_and_swap(&self->free[c], buf, buf->next));
+    return buf;
+    }
+
+static int packet_pool_add_slab(struct packet_pool *self, int c)
+    {
+    const size_t stride = HEAD_SIZE + ((size_t)1 << (MIN_CLASS_SHIFT + c));
+    size_t n = SLAB_BYTES / stride;
+    struct packet_pool_slab *slab;
+    char *p;
+
+    if (n == 0)
+        n = 1;
+    if (!(slab = malloc(HEAD_SIZE + n * stride)))
+        {
+        fprintf(stderr, "packet_pool_add_slab: malloc failure\n");
+        return 0;
+        }
+    slab->next = self->slabs;
+    self->slabs = slab;
+
+    for (p = (char *)slab + HEAD_SIZE; n--; p += stride)
+        {
+        struct packet_pool_buf *buf = (struct packet_pool_buf *)p;
+
+        buf->pool = self;
+        buf->size_class = c;
+        buf->packet.data = p + HEAD_SIZE;
+        packet_pool_push(self, buf);
+        }
+    return 1;
+    }
+
+struct encoder_op_packet *packet_pool_get(struct packet_pool *self, size_t data_size)
+    {
+    struct packet_pool_buf *buf;
+    int c = packet_pool_size_class(data_size);
+
+    if (c >= 0)
+        {
+        if (!(buf = packet_pool_pop(self, c)))
+            {
+            if (!packet_pool_add_slab(self, c))
+                return NULL;
+            buf = packet_pool_pop(self, c);
+            }
+        }
+    else
+        {
+        if (!(buf = malloc(HEAD_SIZE + data_size)))
+            {
+            fprintf(stderr, "packet_pool_get: malloc failure\n");
+            return NULL;
+            }
+        buf->pool = self;
+        buf->size_class = -1;
+        buf->packet.data = (char *)buf + HEAD_SIZE;
+        }
+
+    buf->refs = 1;
+    buf->packet.header.data_size = data_size;
+    return &buf->packet;
+    }
+
+void packet_pool_ref(struct encoder_op_packet *packet)
+    {
+    __sync_add_and_fetch(&((struct packet_pool_buf *)packet)->refs, 1);
+    }
+
+void packet_pool_unref(struct encoder_op_packet *packet)
+    {
+    struct packet_pool_buf *buf = (struct packet_pool_buf *)packet;
+
+    if (__sync_sub_and_fetch(&buf->refs, 1))
+        return;
+    if (buf->size_class >= 0)
+        packet_pool_push(buf->pool, buf);
+    else
+        free(buf);
+    }
+
+struct packet_pool *packet_pool_create()
+    {
+    struct packet_pool *self;
+
+    if (!(self = calloc(1, sizeof (struct packet_pool))))
+        fprintf(stderr, "packet_pool_create: malloc failure\n");
+    return self;
+    }
+
+void packet_pool_destroy(struct packet_pool *self)
+    {
+    struct packet_pool_slab *slab;
+
+    while ((slab = self->slabs))
+        {
+        self->slabs = slab->next;
+        free(slab);
+        }
+    free(self);
+    }
@@ -0,0 +1,41 @@
+/*
+#   packetpool.h: reference counted encoded packets for the streaming module
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include <stddef.h>
+
+struct encoder_op_packet;
+
+/* packet_pool_create: one pool per encoder
+ *
+ * Only the owning encoder thread may take packets from the pool.  The last
+ * reference may be dropped from any thread.
+ */
+struct packet_pool *packet_pool_create();
+/* packet_pool_destroy: call once no packet from the pool is referenced */
+void packet_pool_destroy(struct packet_pool *self);
+/* packet_pool_get: a packet with room for data_size bytes and one reference */
+struct encoder_op_packet *packet_pool_get(struct packet_pool *self, size_t data_size);
+void packet_pool_ref(struct encoder_op_packet *packet);
+/* packet_pool_unref: the packet goes back to the pool with the last reference */
+void packet_pool_unref(struct encoder_op_packet *packet);
+
+#endif
@@ -31,7 +31,7 @@
 
 typedef jack_default_audio_sample_t sample_t;
 
-static const size_t rb_n_samples = 10000;       /* maximum number of samples to hold in the ring buffer */
+static const size_t max_lag_seconds = 20;       /* backlog the feed will allow while the disk is slow */
 static const size_t audio_buffer_elements = 256;
 
 #if 0
@@ -437,11 +437,16 @@ static void recorder_display_logged_metadata2(struct metadata_item2 *mi2)
 static void recorder_append_metadata(struct recorder *self, struct encoder_op_packet *packet)
     {
     struct metadata_item *mi;
-    char *artist, *title, *album, *stringp;
+    char *artist, *title, *album, *stringp, *copy = NULL;
 
     if (packet)
         {
-        stringp = packet->data;
+        /* the packet is shared with other clients so it is split up in a copy */
+        if (!(stringp = copy = strndup(packet->data, packet->header.data_size)))
+            {
+            fprintf(stderr, "recorder_append_metadata: malloc failure\n");
+            return;
+            }
         strsep(&stringp, "\n");   /* we discard the first value */
         artist = strsep(&stringp, "\n");
         title  = strsep(&stringp, "\n");
@@ -455,18 +460,21 @@ static void recorder_append_metadata(struct recorder *self, struct encoder_op_pa
                 && !strcmp(self->mi_last->album, album))
         {
         fprintf(stderr, "recorder_append_metadata: duplicate artist-title, skipping\n");
+        free(copy);
         return;
         }
 
     if (!(mi = calloc(1, sizeof (struct metadata_item))))
         {
         fprintf(stderr, "recorder_append_metadata: malloc failure\n");
+        free(copy);
         return;
         }
 
     mi->artist = strdup(artist);
     mi->title = strdup(title);
     mi->album = strdup(album);
+    free(copy);
     mi->time_offset = self->recording_length_ms;
     mi->byte_offset = self->bytes_written;
     if (!(self->mi_first))
@@ -549,9 +557,8 @@ static void *recorder_main(void *args)
             case RM_RECORDING:
                 if (self->initial_serial == -1)
                     {
-                    while ((nbytes = jack_ringbuffer_read(self->input_rb[1], self->right, audio_buffer_elements * sizeof (sample_t))))
+                    while ((nbytes = audio_feed_read_stereo(&self->feed, (float *)self->left, (float *)self->right, audio_buffer_elements) * sizeof (sample_t)))
                         {
-                        jack_ringbuffer_read(self->input_rb[0], self->left, nbytes);
                         rl = self->left;
                         rr = self->right;
                         endp = rl + nbytes;
@@ -655,9 +662,9 @@ static void *recorder_main(void *args)
                     self->record_mode = RM_STOPPING;
                 else
                     {
-                    while ((nbytes = jack_ringbuffer_read(self->input_rb[1], self->right, audio_buffer_elements * sizeof (sample_t))))
+                    /* keep up with the feed so unpausing resumes with current audio */
+                    while (audio_feed_read_stereo(&self->feed, (float *)self->left, (float *)self->right, audio_buffer_elements))
                         {
-                        jack_ringbuffer_read(self->input_rb[0], self->left, nbytes);
                         }
                         
                     if (self->unpause_request)
@@ -674,11 +681,6 @@ static void *recorder_main(void *args)
                     {
                     sf_close(self->sf);
                     fclose(self->fpcue);
-                    self->jack_dataflow_control = JD_FLUSH;
-                    while (self->jack_dataflow_control != JD_OFF)
-                        nanosleep(&ms10, NULL);
-                    jack_ringbuffer_free(self->input_rb[0]);
-                    jack_ringbuffer_free(self->input_rb[1]);
                     free(self->left);
                     free(self->right);
                     free(self->combined);
@@ -734,7 +736,19 @@ static void *recorder_main(void *args)
 
 int recorder_make_report(struct recorder *self)
     {
-    fprintf(g.out, "idjcsc: recorder%dreport=%d:%d\n", self->numeric_id, self->record_mode, self->recording_length_s);
+    struct threads_info *ti = self->threads_info;
+    unsigned long dropped = self->feed.frames_dropped;
+
+    /* audio lost upstream in the encoder also counts against the recording */
+    if (self->record_mode != RM_STOPPED && self->source_encoder >= 0 && self->source_encoder < ti->n_encoders)
+        dropped += ti->encoder[self->source_encoder]->feed.frames_dropped - self->encoder_dropped_base;
+    if (dropped > self->frames_dropped_logged)
+        {
+        fprintf(stderr, "recorder_make_report: recorder %d has dropped %lu frames\n", self->numeric_id, dropped);
+        self->frames_dropped_logged = dropped;
+        }
+
+    fprintf(g.out, "idjcsc: recorder%dreport=%d:%d:%lu\n", self->numeric_id, self->record_mode, self->recording_length_s, dropped);
     fflush(g.out);
     return SUCCEEDED;
     }
@@ -781,10 +795,21 @@ int recorder_start(struct threads_info *ti, struct universal_vars *uv, void *oth
     char timestamp[TIMESTAMP_SIZ];
     size_t base;
 
+    if (!self->thread_started)
+        {
+        if (pthread_create(&self->thread_h, NULL, recorder_main, self))
+            {
+            fprintf(stderr, "recorder_start: pthread_create call failed\n");
+            return FAILED;
+            }
+        self->thread_started = TRUE;
+        }
+
     if (!strcmp(rv->record_source, "-1"))
         {
         file_extension = ".flac";
         self->encoder_op = NULL;
+        self->source_encoder = -1;
         self->left = malloc(audio_buffer_elements * sizeof (sample_t));
         self->right = malloc(audio_buffer_elements * sizeof (sample_t));
         self->combined = malloc(audio_buffer_elements * sizeof (sample_t) * 2);
@@ -801,6 +826,9 @@ int recorder_start(struct threads_info *ti, struct universal_vars *uv, void *oth
             fprintf(stderr, "recorder_start: failed to register with encoder\n");
             return FAILED;
             }
+        self->source_encoder = atoi(rv->record_source);
+        self->encoder_dropped_base = self->encoder_op->encoder->feed.frames_dropped;
+        self->feed.frames_dropped = self->frames_dropped_logged = 0;
         if (!self->encoder_op->encoder->run_request_f)
             {
             fprintf(stderr, "recorder_start: encoder is not running\n");
@@ -928,19 +956,9 @@ int recorder_start(struct threads_info *ti, struct universal_vars *uv, void *oth
             return FAILED;
             }
             
-        self->input_rb[0] = jack_ringbuffer_create(rb_n_samples * sizeof (sample_t));
-        self->input_rb[1] = jack_ringbuffer_create(rb_n_samples * sizeof (sample_t));
-        if (!(self->input_rb[0] && self->input_rb[1]))
-            {
-            fprintf(stderr, "encoder_start: jack ringbuffer creation failure\n");
-            free(self->pathname);
-            free(self->timestamp);
-            fclose(self->fp);
-            fclose(self->fpcue);
-            fprintf(stderr, "recorder_start: failed to create ringbuffers\n");
-            return FAILED;
-            }
-        self->jack_dataflow_control = JD_ON;  
+        self->performance_warning_indicator = PW_OK;
+        audio_feed_cursor_attach(&self->feed, max_lag_seconds * self->sfinfo.samplerate, &self->performance_warning_indicator);
+        self->frames_dropped_logged = 0;
         self->initial_serial = -1;
         self->new_artist_title = TRUE; /* risk inheriting old metadata rather than start with empty */
         fprintf(stderr, "recorder_start: in FLAC mode\n");
@@ -1035,23 +1053,26 @@ struct recorder *recorder_init(struct threads_info *ti, int numeric_id)
         }
     self->threads_info = ti;
     self->numeric_id = numeric_id;
+    self->source_encoder = -1;
     self->artist = strdup("");
     self->title = strdup("");
     self->album = strdup("");
     pthread_mutex_init(&self->artist_title_mutex, NULL);
     pthread_mutex_init(&self->mode_mutex, NULL);
     pthread_cond_init(&self->mode_cv, NULL);
-    pthread_create(&self->thread_h, NULL, recorder_main, self);
     return self;
     }
 
 void recorder_destroy(struct recorder *self)
     {
-    pthread_mutex_lock(&self->mode_mutex);
-    self->thread_terminate_f = TRUE;
-    pthread_cond_signal(&self->mode_cv);
-    pthread_mutex_unlock(&self->mode_mutex);
-    pthread_join(self->thread_h, NULL);
+    if (self->thread_started)
+        {
+        pthread_mutex_lock(&self->mode_mutex);
+        self->thread_terminate_f = TRUE;
+        pthread_cond_signal(&self->mode_cv);
+        pthread_mutex_unlock(&self->mode_mutex);
+        pthread_join(self->thread_h, NULL);
+        }
     pthread_cond_destroy(&self->mode_cv);
     pthread_mutex_destroy(&self->mode_mutex);
     pthread_mutex_destroy(&self->artist_title_mutex);
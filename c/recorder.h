@@ -67,6 +67,7 @@ struct recorder
     int numeric_id;              /* the identity of this recorder */
     pthread_t thread_h;          /* pthread handle for the recorder */
     int thread_terminate_f;      /* set this to cause the thread to exit */
+    int thread_started;          /* the thread is launched on the first recorder_start */
     int stop_request;            /* control variables for various obvious things */
     int stop_pending;
     int pause_request;
@@ -97,8 +98,10 @@ struct recorder
     char first_mp3_header[4];
     SNDFILE *sf;                 /* support for recording with libsndfile */
     SF_INFO sfinfo;
-    enum jack_dataflow jack_dataflow_control;    /* tells the jack callback routine what we want it to do */
-    jack_ringbuffer_t *input_rb[2];      /* circular buffer containing pcm audio data */
+    struct audio_feed_cursor feed;       /* read position in the shared pcm audio feed */
+    unsigned long frames_dropped_logged;
+    int source_encoder;          /* the encoder recorded from or -1 */
+    unsigned long encoder_dropped_base; /* the encoder's dropped frame count when recording started */
     enum performance_warning performance_warning_indicator; /* indicates ringbuffer overflow condition */
     char *left;
     char *right;
@@ -31,6 +31,7 @@
 #include "live_ogg_encoder.h"
 #include "avcodec_encoder.h"
 #include "sig.h"
+#include "encoderpool.h"
 #include "main.h"
 
 static int threads_up;
@@ -50,12 +51,22 @@ static void threads_init(struct threads_info *ti)
         fprintf(stderr, "threads_init: malloc failure\n");
         exit(5);
         }
+    if (!(ti->encoder_pool = encoder_pool_init(ti)))
+        {
+        fprintf(stderr, "threads_init: encoder pool initialisation failed\n");
+        exit(5);
+        }
     for (i = 0; i < ti->n_encoders; i++)
         if (!(ti->encoder[i] = encoder_init(ti, i)))
             {
             fprintf(stderr, "threads_init: encoder initialisation failed\n");
             exit(5);
             }
+    if (!(ti->streamer_io = streamer_io_init(ti)))
+        {
+        fprintf(stderr, "threads_init: streamer I/O initialisation failed\n");
+        exit(5);
+        }
     for (i = 0; i < ti->n_streamers; i++)
         if (!(ti->streamer[i] = streamer_init(ti, i)))
             {
@@ -73,7 +84,8 @@ static void threads_init(struct threads_info *ti)
         fprintf(stderr, "threads_init: audio feed initialisation failed\n");
         exit(5);
         }
-    fprintf(stderr, "started %d encoders, %d streamers, %d recorders\n", ti->n_encoders, ti->n_streamers, ti->n_recorders);
+    /* the streamer I/O and recorder threads are only launched once they are first put to use */
+    fprintf(stderr, "allocated %d encoders, %d streamers, %d recorders\n", ti->n_encoders, ti->n_streamers, ti->n_recorders);
     threads_up = TRUE;
     }
 
@@ -85,8 +97,10 @@ static void threads_shutdown(struct threads_info *ti)
         {
         for (i = 0; i < ti->n_recorders; i++)
             recorder_destroy(ti->recorder[i]);
+        streamer_io_destroy(ti->streamer_io);
         for (i = 0; i < ti->n_streamers; i++)
             streamer_destroy(ti->streamer[i]);
+        encoder_pool_destroy(ti->encoder_pool);
         for (i = 0; i < ti->n_encoders; i++)
             encoder_destroy(ti->encoder[i]);
         free(ti->recorder);
@@ -113,7 +127,12 @@ static int get_report(struct threads_info *ti, struct universal_vars *uv, void *
         return FAILED;
         }
     if (!strcmp(uv->dev_type, "encoder"))
+        {
+        if (uv->tab >= 0 && uv->tab < ti->n_encoders)
+            return encoder_make_report(ti->encoder[uv->tab]);
+        fprintf(stderr, "get_report: encoder %s does not exist\n", uv->tab_id);
         return FAILED;
+        }
     fprintf(stderr, "get_report: unhandled dev_type %s\n", uv->dev_type);
     return FAILED;
     }
@@ -160,6 +179,8 @@ static struct kvpdict kvpdict[] = {
     { "quality",          &ev.quality, NULL },
     { "complexity",       &ev.complexity, NULL },
     { "framesize",        &ev.framesize, NULL },
+    { "page_duration",    &ev.page_duration, NULL },
+    { "page_packets",     &ev.page_packets, NULL },
     { "filename",         &ev.filename, NULL },
     { "offset",           &ev.offset, NULL },
     { "custom_meta",      &ev.custom_meta, NULL },
@@ -37,6 +37,8 @@ struct threads_info
     struct streamer **streamer;
     struct recorder **recorder;
     struct audio_feed *audio_feed;
+    struct encoder_pool *encoder_pool;  /* the threads the encoders run on */
+    struct streamer_io *streamer_io;    /* the thread the streamers send from */
     };
 
 struct universal_vars
@@ -54,10 +56,10 @@ struct commandmap
     void *other_parameter;
     };
     
+#include "audio_feed.h"
 #include "encoder.h"
 #include "streamer.h"
 #include "recorder.h"
-#include "audio_feed.h"
 
 void sourceclient_init();
 int sourceclient_main();
@@ -0,0 +1,385 @@
+/*
+#   streamdsp.c: built-in broadcast processing for the stream mix
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The chain is equaliser, three band compressor, limiter.
+ *
+ * Everything works a period at a time.  The filters are biquads from
+ * the RBJ audio EQ cookbook and the crossover is Linkwitz-Riley 4th order
+ * with an allpass on the low band so the bands sum flat.  The band
+ * compressors compute their gain once per sub-block and ramp across it
+ * so the only per-sample work is the envelope follower and a multiply.
+ */
+
+#include "gnusource.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "streamdsp.h"
+#include "dbconvert.h"
+
+#define TRUE 1
+#define FALSE 0
+
+#define GAIN_INTERVAL 32        /* frames per band compressor gain update */
+
+static const struct streamdsp_params default_params = {
+    .active = FALSE, .eq = TRUE, .mb = TRUE,
+    .eq_low_freq = 100.0f, .eq_mid_freq = 1000.0f, .eq_mid_q = 0.7f, .eq_high_freq = 8000.0f,
+    .xover_low = 200.0f, .xover_high = 3000.0f,
+    .band = {
+        { -24.0f, 3.0f, 20.0f, 300.0f, 3.0f },
+        { -20.0f, 2.5f, 10.0f, 200.0f, 2.0f },
+        { -22.0f, 3.0f, 3.0f, 100.0f, 3.0f }},
+    .limit = -1.0f };
+
+/* the settings that can be changed by streamdsp_valueparse */
+static const struct
+    {
+    const char *key;
+    size_t offset;
+    } float_params[] = {
+    { "eq_low_freq",    offsetof(struct streamdsp_params, eq_low_freq) },
+    { "eq_low_gain",    offsetof(struct streamdsp_params, eq_low_gain) },
+    { "eq_mid_freq",    offsetof(struct streamdsp_params, eq_mid_freq) },
+    { "eq_mid_gain",    offsetof(struct streamdsp_params, eq_mid_gain) },
+    { "eq_mid_q",       offsetof(struct streamdsp_params, eq_mid_q) },
+    { "eq_high_freq",   offsetof(struct streamdsp_params, eq_high_freq) },
+    { "eq_high_gain",   offsetof(struct streamdsp_params, eq_high_gain) },
+    { "xover_low",      offsetof(struct streamdsp_params, xover_low) },
+    { "xover_high",     offsetof(struct streamdsp_params, xover_high) },
+    { "low_thresh",     offsetof(struct streamdsp_params, band[0].thresh) },
+    { "low_ratio",      offsetof(struct streamdsp_params, band[0].ratio) },
+    { "low_attack",     offsetof(struct streamdsp_params, band[0].attack) },
+    { "low_release",    offsetof(struct streamdsp_params, band[0].release) },
+    { "low_gain",       offsetof(struct streamdsp_params, band[0].gain) },
+    { "mid_thresh",     offsetof(struct streamdsp_params, band[1].thresh) },
+    { "mid_ratio",      offsetof(struct streamdsp_params, band[1].ratio) },
+    { "mid_attack",     offsetof(struct streamdsp_params, band[1].attack) },
+    { "mid_release",    offsetof(struct streamdsp_params, band[1].release) },
+    { "mid_gain",       offsetof(struct streamdsp_params, band[1].gain) },
+    { "high_thresh",    offsetof(struct streamdsp_params, band[2].thresh) },
+    { "high_ratio",     offsetof(struct streamdsp_params, band[2].ratio) },
+    { "high_attack",    offsetof(struct streamdsp_params, band[2].attack) },
+    { "high_release",   offsetof(struct streamdsp_params, band[2].release) },
+    { "high_gain",      offsetof(struct streamdsp_params, band[2].gain) },
+    { "limit",          offsetof(struct streamdsp_params, limit) },
+    { NULL, 0 }};
+
+/* biquad coefficient calculation */
+
+static void bq_set(struct streamdsp_biquad *c, double b0, double b1, double b2, double a0, double a1, double a2)
+    {
+    c->b0 = b0 / a0;
+    c->b1 = b1 / a0;
+    c->b2 = b2 / a0;
+    c->a1 = a1 / a0;
+    c->a2 = a2 / a0;
+    }
+
+static void bq_lowshelf(struct streamdsp_biquad *c, float sr, float f, float gain_db)
+    {
+    double A = pow(10.0, gain_db / 40.0), w0 = 2.0 * M_PI * f / sr;
+    double cs = cos(w0), sqa = 2.0 * sqrt(A) * sin(w0) / 2.0 * M_SQRT2;
+
+    bq_set(c, A * ((A + 1.0) - (A - 1.0) * cs + sqa), 2.0 * A * ((A - 1.0) - (A + 1.0) * cs),
+              A * ((A + 1.0) - (A - 1.0) * cs - sqa), (A + 1.0) + (A - 1.0) * cs + sqa,
+              -2.0 * ((A - 1.0) + (A + 1.0) * cs), (A + 1.0) + (A - 1.0) * cs - sqa);
+    }
+
+static void bq_highshelf(struct streamdsp_biquad *c, float sr, float f, float gain_db)
+    {
+    double A = pow(10.0, gain_db / 40.0), w0 = 2.0 * M_PI * f / sr;
+    double cs = cos(w0), sqa = 2.0 * sqrt(A) * sin(w0) / 2.0 * M_SQRT2;
+
+    bq_set(c, A * ((A + 1.0) + (A - 1.0) * cs + sqa), -2.0 * A * ((A - 1.0) + (A + 1.0) * cs),
+              A * ((A + 1.0) + (A - 1.0) * cs - sqa), (A + 1.0) - (A - 1.0) * cs + sqa,
+              2.0 * ((A - 1.0) - (A + 1.0) * cs), (A + 1.0) - (A - 1.0) * cs - sqa);
+    }
+
+static void bq_peaking(struct streamdsp_biquad *c, float sr, float f, float gain_db, float q)
+    {
+    double A = pow(10.0, gain_db / 40.0), w0 = 2.0 * M_PI * f / sr;
+    double cs = cos(w0), alpha = sin(w0) / (2.0 * q);
+
+    bq_set(c, 1.0 + alpha * A, -2.0 * cs, 1.0 - alpha * A, 1.0 + alpha / A, -2.0 * cs, 1.0 - alpha / A);
+    }
+
+static void bq_lowpass(struct streamdsp_biquad *c, float sr, float f)
+    {
+    double w0 = 2.0 * M_PI * f / sr, cs = cos(w0), alpha = sin(w0) * M_SQRT1_2;
+
+    bq_set(c, (1.0 - cs) / 2.0, 1.0 - cs, (1.0 - cs) / 2.0, 1.0 + alpha, -2.0 * cs, 1.0 - alpha);
+    }
+
+static void bq_highpass(struct streamdsp_biquad *c, float sr, float f)
+    {
+    double w0 = 2.0 * M_PI * f / sr, cs = cos(w0), alpha = sin(w0) * M_SQRT1_2;
+
+    bq_set(c, (1.0 + cs) / 2.0, -(1.0 + cs), (1.0 + cs) / 2.0, 1.0 + alpha, -2.0 * cs, 1.0 - alpha);
+    }
+
+/* the sum of the LR4 low and high outputs is this allpass */
+static void bq_allpass(struct streamdsp_biquad *c, float sr, float f)
+    {
+    double w0 = 2.0 * M_PI * f / sr, cs = cos(w0), alpha = sin(w0) * M_SQRT1_2;
+
+    bq_set(c, 1.0 - alpha, -2.0 * cs, 1.0 + alpha, 1.0 + alpha, -2.0 * cs, 1.0 - alpha);
+    }
+
+/* filter: transposed direct form II on one channel, in and out may be the same */
+static void filter(struct streamdsp_filter *f, int ch, const float *in, float *out, int n)
+    {
+    const struct streamdsp_biquad c = f->c;
+    float z1 = f->z1[ch], z2 = f->z2[ch], x, y;
+
+    for (int i = 0; i < n; ++i)
+        {
+        x = in[i];
+        y = c.b0 * x + z1;
+        z1 = c.b1 * x - c.a1 * y + z2;
+        z2 = c.b2 * x - c.a2 * y;
+        out[i] = y;
+        }
+
+    /* keep denormals out of the feedback path during silence */
+    f->z1[ch] = (fabsf(z1) < 1e-20f) ? 0.0f : z1;
+    f->z2[ch] = (fabsf(z2) < 1e-20f) ? 0.0f : z2;
+    }
+
+static float time_coefficient(float ms, float sr)
+    {
+    if (ms <= 0.0f)
+        return 1.0f;
+    return 1.0f - expf(-1000.0f / (ms * sr));
+    }
+
+/* calculate_coefficients: derive the filter and compressor values from the settings */
+static void calculate_coefficients(struct streamdsp *self)
+    {
+    struct streamdsp_params *p = &self->p;
+    const float sr = self->sample_rate, nyquist = sr * 0.45f;
+    float xl = p->xover_low, xh = p->xover_high;
+
+    bq_lowshelf(&self->eq[0].c, sr, fminf(p->eq_low_freq, nyquist), p->eq_low_gain);
+    bq_peaking(&self->eq[1].c, sr, fminf(p->eq_mid_freq, nyquist), p->eq_mid_gain, fmaxf(p->eq_mid_q, 0.1f));
+    bq_highshelf(&self->eq[2].c, sr, fminf(p->eq_high_freq, nyquist), p->eq_high_gain);
+
+    xh = fminf(xh, nyquist);
+    xl = fminf(xl, xh * 0.5f);
+    for (int i = 0; i < 2; ++i)
+        {
+        bq_lowpass(&self->band[0].split[i].c, sr, xl);
+        bq_highpass(&self->rest[i].c, sr, xl);
+        bq_lowpass(&self->band[1].split[i].c, sr, xh);
+        bq_highpass(&self->band[2].split[i].c, sr, xh);
+        }
+    bq_allpass(&self->allpass.c, sr, xh);
+
+    for (int i = 0; i < STREAMDSP_BANDS; ++i)
+        {
+        struct streamdsp_band *b = &self->band[i];
+
+        b->att_k = time_coefficient(p->band[i].attack, sr);
+        b->rel_k = time_coefficient(p->band[i].release, sr);
+        b->thresh = p->band[i].thresh;
+        b->slope = (p->band[i].ratio > 1.0f) ? 1.0f - 1.0f / p->band[i].ratio : 0.0f;
+        b->makeup = p->band[i].gain;
+        }
+
+    self->limiter.k1 = fminf(p->limit, 0.0f);
+    }
+
+/* band_compress: stereo linked compression of one band */
+static void band_compress(struct streamdsp_band *b, int n)
+    {
+    float *l = b->buf[0], *r = b->buf[1];
+    float env = b->env, gain = b->gain, target, step, x, over;
+    int i, j, m;
+
+    for (i = 0; i < n; i += m)
+        {
+        m = (n - i < GAIN_INTERVAL) ? n - i : GAIN_INTERVAL;
+        for (j = i; j < i + m; ++j)
+            {
+            x = fmaxf(fabsf(l[j]), fabsf(r[j]));
+            env += (x - env) * ((x > env) ? b->att_k : b->rel_k);
+            }
+
+        over = level2db(env) - b->thresh;
+        target = db2level(b->makeup - ((over > 0.0f) ? over * b->slope : 0.0f));
+        step = (target - gain) / m;
+        for (j = i; j < i + m; ++j)
+            {
+            gain += step;
+            l[j] *= gain;
+            r[j] *= gain;
+            }
+        }
+
+    b->env = (env < 1e-20f) ? 0.0f : env;
+    b->gain = gain;
+    }
+
+void streamdsp_process(struct streamdsp *self, float *l, float *r, int n)
+    {
+    struct streamdsp_band *b = self->band;
+    float *io[2] = { l, r };
+    float gain;
+    int ch, i;
+
+    if (n > self->block_size)
+        {
+        fprintf(stderr, "streamdsp_process: block of %d frames exceeds %d\n", n, self->block_size);
+        return;
+        }
+
+    if (self->p.eq)
+        for (ch = 0; ch < 2; ++ch)
+            {
+            if (self->p.eq_low_gain != 0.0f)
+                filter(&self->eq[0], ch, io[ch], io[ch], n);
+            if (self->p.eq_mid_gain != 0.0f)
+                filter(&self->eq[1], ch, io[ch], io[ch], n);
+            if (self->p.eq_high_gain != 0.0f)
+                filter(&self->eq[2], ch, io[ch], io[ch], n);
+            }
+
+    if (self->p.mb)
+        {
+        for (ch = 0; ch < 2; ++ch)
+            {
+            /* low band */
+            filter(&b[0].split[0], ch, io[ch], b[0].buf[ch], n);
+            filter(&b[0].split[1], ch, b[0].buf[ch], b[0].buf[ch], n);
+            filter(&self->allpass, ch, b[0].buf[ch], b[0].buf[ch], n);
+            /* the remainder is split into mid and high */
+            filter(&self->rest[0], ch, io[ch], b[2].buf[ch], n);
+            filter(&self->rest[1], ch, b[2].buf[ch], b[2].buf[ch], n);
+            filter(&b[1].split[0], ch, b[2].buf[ch], b[1].buf[ch], n);
+            filter(&b[1].split[1], ch, b[1].buf[ch], b[1].buf[ch], n);
+            filter(&b[2].split[0], ch, b[2].buf[ch], b[2].buf[ch], n);
+            filter(&b[2].split[1], ch, b[2].buf[ch], b[2].buf[ch], n);
+            }
+
+        for (i = 0; i < STREAMDSP_BANDS; ++i)
+            band_compress(&b[i], n);
+
+        for (ch = 0; ch < 2; ++ch)
+            for (i = 0; i < n; ++i)
+                io[ch][i] = b[0].buf[ch][i] + b[1].buf[ch][i] + b[2].buf[ch][i];
+        }
+
+    for (i = 0; i < n; ++i)
+        {
+        gain = db2level(limiter(&self->limiter, l[i], r[i]));
+        l[i] *= gain;
+        r[i] *= gain;
+        }
+    }
+
+int streamdsp_period_start(struct streamdsp *self)
+    {
+    /* the trylock keeps the real-time thread from waiting on the control thread
+     * in which case the new settings are picked up next period */
+    if (self->serial != self->pending_serial && !pthread_mutex_trylock(&self->mutex))
+        {
+        self->p = self->pending;
+        self->serial = self->pending_serial;
+        pthread_mutex_unlock(&self->mutex);
+        calculate_coefficients(self);
+        }
+
+    return self->p.active;
+    }
+
+void streamdsp_valueparse(struct streamdsp *self, char *param)
+    {
+    char *save = NULL, *key, *value;
+    int i;
+
+    key = strtok_r(param, "=", &save);
+    value = strtok_r(NULL, "=", &save);
+    if (!key || !value)
+        {
+        fprintf(stderr, "streamdsp_valueparse: malformed parameter\n");
+        return;
+        }
+
+    pthread_mutex_lock(&self->mutex);
+    if (!strcmp(key, "active"))
+        self->pending.active = (value[0] == '1') ? TRUE : FALSE;
+    else if (!strcmp(key, "eq"))
+        self->pending.eq = (value[0] == '1') ? TRUE : FALSE;
+    else if (!strcmp(key, "mb"))
+        self->pending.mb = (value[0] == '1') ? TRUE : FALSE;
+    else
+        {
+        for (i = 0; float_params[i].key && strcmp(key, float_params[i].key); ++i);
+        if (float_params[i].key)
+            *(float *)((char *)&self->pending + float_params[i].offset) = atof(value);
+        else
+            fprintf(stderr, "streamdsp_valueparse: lookup error for key %s\n", key);
+        }
+    self->pending_serial++;
+    pthread_mutex_unlock(&self->mutex);
+    }
+
+int streamdsp_set_block_size(struct streamdsp *self, int n)
+    {
+    for (int i = 0; i < STREAMDSP_BANDS; ++i)
+        for (int ch = 0; ch < 2; ++ch)
+            if (!(self->band[i].buf[ch] = realloc(self->band[i].buf[ch], n * sizeof (float))))
+                return FALSE;
+
+    self->block_size = n;
+    return TRUE;
+    }
+
+struct streamdsp *streamdsp_create(int sample_rate)
+    {
+    struct streamdsp *self;
+
+    if (!(self = calloc(1, sizeof (struct streamdsp))))
+        {
+        fprintf(stderr, "streamdsp_create: malloc failure\n");
+        exit(5);
+        }
+
+    self->sample_rate = sample_rate;
+    self->p = self->pending = default_params;
+    pthread_mutex_init(&self->mutex, NULL);
+    for (int i = 0; i < STREAMDSP_BANDS; ++i)
+        self->band[i].gain = 1.0f;
+    /* same as the mixer's own limiters */
+    self->limiter = (struct compressor){ 0.0, -0.05, -0.2, INFINITY, 1, 1.0F/4000.0F, 0.0, 0.0, 1, 1, 0.0, 0.0, 0.0 };
+    calculate_coefficients(self);
+    return self;
+    }
+
+void streamdsp_destroy(struct streamdsp *self)
+    {
+    for (int i = 0; i < STREAMDSP_BANDS; ++i)
+        for (int ch = 0; ch < 2; ++ch)
+            free(self->band[i].buf[ch]);
+    pthread_mutex_destroy(&self->mutex);
+    free(self);
+    }
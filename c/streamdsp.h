@@ -0,0 +1,97 @@
+/*
+#   streamdsp.h: built-in broadcast processing for the stream mix
+#   Copyright (C) 2013 Stephen Fairchild (s-fairchild@users.sourceforge.net)
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program in the file entitled COPYING.
+#   If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STREAMDSP_H
+#define STREAMDSP_H
+
+#include <pthread.h>
+#include "compressor.h"
+
+#define STREAMDSP_BANDS 3
+
+/* the user settings, frequencies in Hz, times in ms, levels in dB */
+struct streamdsp_params
+    {
+    int active;             /* master enable for the whole chain */
+    int eq;                 /* equaliser enable */
+    int mb;                 /* multiband compressor enable */
+    float eq_low_freq, eq_low_gain;                 /* low shelf */
+    float eq_mid_freq, eq_mid_gain, eq_mid_q;       /* peaking */
+    float eq_high_freq, eq_high_gain;               /* high shelf */
+    float xover_low, xover_high;                    /* crossover frequencies */
+    struct
+        {
+        float thresh, ratio, attack, release, gain;
+        } band[STREAMDSP_BANDS];
+    float limit;            /* final limiter ceiling */
+    };
+
+/* biquad coefficients, normalised so a0 is 1 */
+struct streamdsp_biquad
+    {
+    float b0, b1, b2, a1, a2;
+    };
+
+/* a biquad with state for the left and right channels */
+struct streamdsp_filter
+    {
+    struct streamdsp_biquad c;
+    float z1[2], z2[2];
+    };
+
+struct streamdsp_band
+    {
+    struct streamdsp_filter split[2];   /* LR4 crossover: two cascaded butterworth sections */
+    float att_k, rel_k;     /* envelope follower coefficients */
+    float thresh, slope;    /* threshold in dB and gain reduction per dB over it */
+    float makeup;           /* makeup gain in dB */
+    float env;              /* envelope state */
+    float gain;             /* the gain applied at the end of the last sub-block */
+    float *buf[2];          /* band audio */
+    };
+
+struct streamdsp
+    {
+    float sample_rate;
+    int block_size;
+    struct streamdsp_params p;          /* settings in use by the real-time thread */
+    struct streamdsp_params pending;    /* settings as changed by the control thread */
+    volatile unsigned pending_serial;
+    unsigned serial;
+    pthread_mutex_t mutex;              /* protects pending */
+    struct streamdsp_filter eq[3];
+    struct streamdsp_filter rest[2];        /* the low crossover high pass feeding the mid and high bands */
+    struct streamdsp_filter allpass;        /* keeps the low band in phase with the other two */
+    struct streamdsp_band band[STREAMDSP_BANDS];
+    struct compressor limiter;
+    };
+
+struct streamdsp *streamdsp_create(int sample_rate);
+void streamdsp_destroy(struct streamdsp *self);
+/* streamdsp_set_block_size: returns FALSE on memory allocation failure */
+int streamdsp_set_block_size(struct streamdsp *self, int n);
+/* streamdsp_period_start: picks up settings changes
+ * return value: whether the chain is active for this period */
+int streamdsp_period_start(struct streamdsp *self);
+/* streamdsp_process: processes n frames in place */
+void streamdsp_process(struct streamdsp *self, float *l, float *r, int n);
+/* streamdsp_valueparse: apply a key=value setting from the user interface */
+void streamdsp_valueparse(struct streamdsp *self, char *param);
+
+#endif /* STREAMDSP_H */
@@ -19,11 +19,16 @@
 
 #include "../config.h"
 
-#define _POSIX_C_SOURCE 200112L
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <shoutidjc/shout.h>
 #include "sourceclient.h"
 #include "sig.h"
@@ -37,162 +42,277 @@
 /* the number of seconds of audio to stockpile before packet dumping takes place */
 static const int shout_buffer_seconds = 9;
 
-static void *streamer_main(void *args)
+/* streamer_record_latency: for an audio packet just handed to libshout */
+static void streamer_record_latency(struct streamer *self, struct encoder_op_packet *packet, jack_nframes_t taken)
     {
-    struct streamer *self = args;
-    struct timespec ms10 = { 0, 10000000 };
-    struct encoder_op_packet *packet;
-    char buffer[10];
+    int br = packet->header.bit_rate;
+    unsigned long buffer_ms = 0;
+
+    if ((br = (br > 1000) ? br / 1000 : br))
+        buffer_ms = (unsigned long)shout_queuelen(self->shout) * 8UL / br;
+    latency_record(&self->queue_latency, audio_feed_interval_ms(packet->header.send_time, taken));
+    latency_record(&self->send_latency, audio_feed_age_ms(taken));
+    latency_record(&self->buffer_latency, buffer_ms);
+    latency_record(&self->total_latency, audio_feed_age_ms(packet->header.capture_time) + buffer_ms);
+    }
+
+/* streamer_watch: have the I/O thread woken when fd is writable, -1 for no socket */
+static void streamer_watch(struct streamer_io *io, struct streamer *self, int fd)
+    {
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = self };
+
+    if (fd == self->socket_fd)
+        return;
+    if (self->socket_fd >= 0)
+        epoll_ctl(io->epoll_fd, EPOLL_CTL_DEL, self->socket_fd, NULL);
+    if ((self->socket_fd = fd) >= 0 && epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+        {
+        fprintf(stderr, "streamer_watch: epoll_ctl failed: %s\n", strerror(errno));
+        self->socket_fd = -1;
+        }
+    }
+
+/* streamer_send_packet: pass one packet from the encoder on to the server */
+static void streamer_send_packet(struct streamer *self, struct encoder_op_packet *packet)
+    {
+    jack_nframes_t taken = audio_feed_frame_time();
     size_t data_size;
-    
-    char *s_conv(unsigned long value)
+
+    if (packet->header.serial >= self->initial_serial)
         {
-        snprintf(buffer, 10, "%lu", value);
-        return buffer;
+        /* a mid-stream join may not see the start of a serial */
+        if ((packet->header.flags & PF_INITIAL) || !self->max_shout_queue)
+            {
+            int br = packet->header.bit_rate;
+            
+            /* determine how much audio to hold in the send buffer */
+            self->max_shout_queue = (shout_buffer_seconds * ((br > 1000) ? br / 1000 : br)) << 7;
+            }
+        if (packet->header.flags & (PF_OGG | PF_MP3 | PF_MP2 | PF_AAC | PF_AACP2))
+            {
+            if ((packet->header.flags & (PF_HEADER | PF_FINAL)) || shout_queuelen(self->shout) < self->max_shout_queue)
+                data_size = packet->header.data_size;
+            else
+                {
+                data_size = 0;
+                fprintf(stderr, "streamer_send_packet: **** packet dumped due to buffer being full ****\n");
+                }
+            switch(shout_send(self->shout, packet->data, data_size))
+                {
+                case SHOUTERR_SUCCESS:
+                case SHOUTERR_BUSY:
+                    if (data_size && !(packet->header.flags & PF_HEADER))
+                        streamer_record_latency(self, packet, taken);
+                    break;
+                default:
+                    fprintf(stderr, "streamer_send_packet: failed writing to stream, shout_get_error reports: %s\n", shout_get_error(self->shout));
+                    self->stream_mode = SM_DISCONNECTING;
+                }
+            }
+        if (packet->header.flags & PF_FINAL)
+            fprintf(stderr, "streamer_send_packet: final packet with serial %d\n", packet->header.serial);
         }
-        
-    sig_mask_thread();
-    while (!self->thread_terminate_f)
+    if (packet->header.flags & PF_METADATA)  /* tell server about new metadata */
         {
-        nanosleep(&ms10, NULL);
+        /* the packet is shared with other clients so the song title is cut from a copy */
+        char *song = strndup(packet->data, packet->header.data_size);
 
-        switch (self->stream_mode)
+        if (song)
             {
-            case SM_DISCONNECTED:
-                pthread_mutex_lock(&self->mode_mutex);
-                while (self->stream_mode == SM_DISCONNECTED && !self->thread_terminate_f)
-                    pthread_cond_wait(&self->mode_cv, &self->mode_mutex);
-                pthread_mutex_unlock(&self->mode_mutex);
-                continue;
-            case SM_CONNECTING:
-                switch(self->shout_status)
-                    {
-                    case SHOUTERR_BUSY:
-                        self->shout_status = shout_get_connected(self->shout);
-
-                        if (self->disconnect_request)
-                            self->stream_mode = SM_DISCONNECTING;
-                        break;
-                    case SHOUTERR_CONNECTED:
-                        /* lock the encoder, grab the serial number and issue encoder flush */
-                        /* this makes the encoder contemporaneous with the stream */
-                        self->initial_serial = encoder_client_set_flush(self->encoder_op) + 1;
-                        fprintf(stderr, "streamer_main: connected to server - awaiting serial %d\n", self->initial_serial);
-                        self->brand_new_connection = TRUE;
-                        self->stream_mode = SM_CONNECTED;
-                        break;
-                    default:
-                        fprintf(stderr, "streamer_main: connection failed, shout_get_error reports %ld %s\n", self->shout_status, shout_get_error(self->shout));
-                        self->stream_mode = SM_DISCONNECTING;
-                    }
+            song[strcspn(song, "\n")] = '\0';
+            fprintf(stderr, "streamer_send_packet: packet is metadata: %s\n", song);
+            shout_metadata_add(self->shout_meta, "song", song);
+            free(song);
+            }
+        switch (shout_set_metadata(self->shout, self->shout_meta))
+            {
+            case SHOUTERR_SUCCESS:
+            case SHOUTERR_BUSY:
                 break;
-            case SM_CONNECTED:
-                /* check the connection is still on */
-                if ((self->shout_status = shout_get_connected(self->shout)) != SHOUTERR_CONNECTED)
-                    {
-                    fprintf(stderr, "streamer_main: shout_get_error reports %ld %s\n", self->shout_status, shout_get_error(self->shout));
+            default:
+                fprintf(stderr, "streamer_send_packet: failed writing metadata to stream, shout_get_error reports: %s\n", shout_get_error(self->shout));
+                self->stream_mode = SM_DISCONNECTING;
+            }
+        }
+    }
+
+/* streamer_service: everything the streamer can do without blocking
+ *
+ * The modes are taken in order so that a streamer that connects sends
+ * at once and one that fails is cleaned up in the same call.
+ */
+static void streamer_service(struct streamer_io *io, struct streamer *self)
+    {
+    struct encoder_op_packet *packet;
+
+    if (self->stream_mode == SM_CONNECTING)
+        {
+        switch(self->shout_status)
+            {
+            case SHOUTERR_BUSY:
+                self->shout_status = shout_get_connected(self->shout);
+
+                if (self->disconnect_request)
                     self->stream_mode = SM_DISCONNECTING;
-                    }
-                if (self->disconnect_request && (!self->disconnect_pending))
-                    {
-                    self->disconnect_pending = TRUE;
-                    fprintf(stderr, "streamer_main: disconnect_pending is set\n");
-                    self->final_serial = encoder_client_set_flush(self->encoder_op);
-                    fprintf(stderr, "streamer_main: issued flush to mixer, disconnecting from server when final packet of serial=%d arrives\n", self->final_serial);
-                    }
-                if ((packet = encoder_client_get_packet(self->encoder_op)))
-                    {
-                    if (packet->header.serial >= self->initial_serial)
-                        {
-                        if (packet->header.flags & PF_INITIAL)
-                            {
-                            int br = packet->header.bit_rate;
-                            
-                            /* determine how much audio to hold in the send buffer */
-                            self->max_shout_queue = (shout_buffer_seconds * ((br > 1000) ? br / 1000 : br)) << 7;
-                            }
-                        if (packet->header.flags & (PF_OGG | PF_MP3 | PF_MP2 | PF_AAC | PF_AACP2))
-                            {
-                            if ((packet->header.flags & (PF_HEADER | PF_FINAL)) || shout_queuelen(self->shout) < self->max_shout_queue)
-                                data_size = packet->header.data_size;
-                            else
-                                {
-                                data_size = 0;
-                                fprintf(stderr, "streamer_main: **** packet dumped due to buffer being full ****\n");
-                                }
-#if 1                           
-                            switch(shout_send(self->shout, packet->data, data_size))
-                                {
-                                case SHOUTERR_SUCCESS:
-                                case SHOUTERR_BUSY:
-                                    break;
-                                default:
-                                    fprintf(stderr, "streamer_main: failed writing to stream, shout_get_error reports: %s\n", shout_get_error(self->shout));
-                                    self->stream_mode = SM_DISCONNECTING;
-                                }
-#else
-                            if (shout_send_raw(self->shout, packet->data, data_size) != data_size)
-                                {
-                                fprintf(stderr, "streamer_main: failed writing to stream, shout_get_error reports: %s\n", shout_get_error(self->shout));
-                                self->stream_mode = SM_DISCONNECTING;
-                                }
-#endif
-                            }
-                        if (packet->header.flags & PF_FINAL)
-                            fprintf(stderr, "streamer_main: final packet with serial %d\n", packet->header.serial);
-                        if (self->disconnect_pending && (packet->header.serial > self->final_serial || ((packet->header.flags & PF_FINAL) && self->final_serial == packet->header.serial)))
-                            {
-                            fprintf(stderr, "streamer_main: last packet wrote, disconnecting\n");
-                            self->stream_mode = SM_DISCONNECTING;
-                            }
-                        }
-                    if (packet->header.flags & PF_METADATA)  /* tell server about new metadata */
-                        {
-                        *strpbrk(packet->data, "\n") = '\0';
-                        fprintf(stderr, "streamer_main: packet is metadata: %s\n", (char *)packet->data);
-                        shout_metadata_add(self->shout_meta, "song", packet->data);
-                        switch (shout_set_metadata(self->shout, self->shout_meta))
-                            {
-                            case SHOUTERR_SUCCESS:
-                            case SHOUTERR_BUSY:
-                                break;
-                            default:
-                                fprintf(stderr, "streamer_main: failed writing metadata to stream, shout_get_error reports: %s\n", shout_get_error(self->shout));
-                                self->stream_mode = SM_DISCONNECTING;
-                            }
-                        }
-                    encoder_client_free_packet(packet);
-                    }
                 break;
-            case SM_DISCONNECTING:
-                fprintf(stderr, "streamer_main: disconencting from server\n");
-                shout_close(self->shout);
-                shout_free(self->shout);
-                shout_metadata_free(self->shout_meta);
-                encoder_unregister_client(self->encoder_op);
-                self->shout = NULL;
-                self->shout_meta = NULL;
-                self->encoder_op = NULL;
-                self->max_shout_queue = 0;
-                self->disconnect_request = FALSE;
-                self->disconnect_pending = FALSE;
-                self->stream_mode = SM_DISCONNECTED;
-                fprintf(stderr, "streamer_main: disconnection complete\n");
+            case SHOUTERR_CONNECTED:
+                /* join the running encoder at its headers, other clients carry on undisturbed */
+                self->initial_serial = encoder_client_join(self->encoder_op);
+                fprintf(stderr, "streamer_service: connected to server - joining serial %d\n", self->initial_serial);
+                self->brand_new_connection = TRUE;
+                latency_reset(&self->queue_latency);
+                latency_reset(&self->send_latency);
+                latency_reset(&self->buffer_latency);
+                latency_reset(&self->total_latency);
+                self->stream_mode = SM_CONNECTED;
                 break;
+            default:
+                fprintf(stderr, "streamer_service: connection failed, shout_get_error reports %ld %s\n", self->shout_status, shout_get_error(self->shout));
+                self->stream_mode = SM_DISCONNECTING;
+            }
+        }
+
+    if (self->stream_mode == SM_CONNECTED)
+        {
+        /* check the connection is still on */
+        if ((self->shout_status = shout_get_connected(self->shout)) != SHOUTERR_CONNECTED)
+            {
+            fprintf(stderr, "streamer_service: shout_get_error reports %ld %s\n", self->shout_status, shout_get_error(self->shout));
+            self->stream_mode = SM_DISCONNECTING;
+            }
+        /* leave at a packet boundary without flushing the encoder others may be using */
+        else if (self->disconnect_request)
+            {
+            fprintf(stderr, "streamer_service: disconnect requested\n");
+            self->stream_mode = SM_DISCONNECTING;
+            }
+        /* the socket having become writable is one reason to be here */
+        else if (shout_queuelen(self->shout) > 0)
+            switch (shout_send(self->shout, NULL, 0))
+                {
+                case SHOUTERR_SUCCESS:
+                case SHOUTERR_BUSY:
+                    break;
+                default:
+                    fprintf(stderr, "streamer_service: failed writing to stream, shout_get_error reports: %s\n", shout_get_error(self->shout));
+                    self->stream_mode = SM_DISCONNECTING;
+                }
+
+        while (self->stream_mode == SM_CONNECTED && (packet = encoder_client_get_packet(self->encoder_op)))
+            {
+            streamer_send_packet(self, packet);
+            encoder_client_free_packet(packet);
+            }
+
+        if (self->stream_mode == SM_CONNECTED)
+            streamer_watch(io, self, (shout_queuelen(self->shout) > 0) ? shout_get_socket(self->shout) : -1);
+        }
+
+    if (self->stream_mode == SM_DISCONNECTING)
+        {
+        fprintf(stderr, "streamer_service: disconencting from server\n");
+        streamer_watch(io, self, -1);
+        shout_close(self->shout);
+        shout_free(self->shout);
+        shout_metadata_free(self->shout_meta);
+        encoder_unregister_client(self->encoder_op);
+        self->shout = NULL;
+        self->shout_meta = NULL;
+        self->encoder_op = NULL;
+        self->max_shout_queue = 0;
+        self->disconnect_request = FALSE;
+        __sync_synchronize();
+        self->stream_mode = SM_DISCONNECTED;
+        fprintf(stderr, "streamer_service: disconnection complete\n");
+        }
+    }
+
+/* the one I/O thread, it sleeps until an encoder has packets for a streamer,
+ * a socket with data queued in libshout becomes writable or it is woken
+ * with a connection to attend to
+ */
+static void *streamer_io_main(void *args)
+    {
+    struct streamer_io *self = args;
+    struct threads_info *ti = self->threads_info;
+    struct epoll_event events[16];
+    struct streamer *streamer;
+    uint64_t count;
+    int timeout;
+
+    sig_mask_thread();
+    while (!self->thread_terminate_f)
+        {
+        timeout = -1;
+        for (int i = 0; i < ti->n_streamers; ++i)
+            {
+            streamer = ti->streamer[i];
+            /* resetting the count before draining the queue means nothing is missed */
+            if (read(streamer->notify_fd, &count, sizeof count) < 0 && errno != EAGAIN)
+                fprintf(stderr, "streamer_io_main: read failed: %s\n", strerror(errno));
+            streamer_service(self, streamer);
+            /* libshout's connection steps are polled */
+            if (streamer->stream_mode == SM_CONNECTING)
+                timeout = 10;
+            }
+
+        if (epoll_wait(self->epoll_fd, events, sizeof events / sizeof events[0], timeout) < 0 && errno != EINTR)
+            {
+            fprintf(stderr, "streamer_io_main: epoll_wait failed: %s\n", strerror(errno));
+            break;
             }
+        if (read(self->wake_fd, &count, sizeof count) < 0 && errno != EAGAIN)
+            fprintf(stderr, "streamer_io_main: read failed: %s\n", strerror(errno));
         }
     return NULL;
     }
 
+static void streamer_io_wake(struct streamer_io *self)
+    {
+    uint64_t one = 1;
+
+    if (write(self->wake_fd, &one, sizeof one) != sizeof one)
+        fprintf(stderr, "streamer_io_wake: write failed: %s\n", strerror(errno));
+    }
+
 int streamer_make_report(struct streamer *self)
     {
     int buffer_fill_pc = 0;
     int new_connection = self->brand_new_connection; /* for thread safety */
     int max_shout_queue = self->max_shout_queue;
+    unsigned long frames_dropped = 0;
+    struct latency_histogram *stages[6] = { NULL, NULL, &self->queue_latency, &self->send_latency,
+                                            &self->buffer_latency, &self->total_latency };
+    char latency[6 * 24] = "", *lp = latency;
 
     if (self->stream_mode == SM_CONNECTED && max_shout_queue)
         buffer_fill_pc = (int)(shout_queuelen(self->shout) * 100 / max_shout_queue);
-    fprintf(g.out, "idjcsc: streamer%dreport=%d:%d:%d\n", self->numeric_id, (int)self->stream_mode, buffer_fill_pc, new_connection);
+    /* audio the encoder could not take in time, the listeners will have heard a gap */
+    if (self->source_encoder >= 0 && self->source_encoder < self->threads_info->n_encoders)
+        {
+        struct encoder *encoder = self->threads_info->encoder[self->source_encoder];
+
+        frames_dropped = encoder->feed.frames_dropped;
+        stages[0] = &encoder->feed_latency;
+        stages[1] = &encoder->encode_latency;
+        }
+    /* median/99th percentile ms of each stage from capture to the socket and overall */
+    for (int i = 0; i < 6; ++i)
+        {
+        if (stages[i])
+            latency_format(stages[i], lp, latency + sizeof latency - lp);
+        else
+            strcpy(lp, "0/0");
+        lp += strlen(lp);
+        if (i < 5)
+            *lp++ = ',';
+        }
+    if (frames_dropped > self->frames_dropped_logged)
+        {
+        fprintf(stderr, "streamer_make_report: encoder %d has dropped %lu frames\n", self->source_encoder, frames_dropped);
+        self->frames_dropped_logged = frames_dropped;
+        }
+    fprintf(g.out, "idjcsc: streamer%dreport=%d:%d:%d:%lu:%s\n", self->numeric_id, (int)self->stream_mode, buffer_fill_pc, new_connection, frames_dropped, latency);
     if (new_connection)
         self->brand_new_connection = FALSE;
     fflush(g.out);
@@ -213,11 +333,22 @@ int streamer_connect(struct threads_info *ti, struct universal_vars *uv, void *o
         fprintf(stderr, "streamer_connect: failed to set parameter %s\n", parameter);
         }
 
+    if (!ti->streamer_io->thread_started)
+        {
+        if (pthread_create(&ti->streamer_io->thread_h, NULL, streamer_io_main, ti->streamer_io))
+            {
+            fprintf(stderr, "streamer_connect: pthread_create call failed\n");
+            return FAILED;
+            }
+        ti->streamer_io->thread_started = TRUE;
+        }
     if (!(self->encoder_op = encoder_register_client(ti, atoi(sv->stream_source))))
         {
         fprintf(stderr, "streamer_start: failed to register with encoder\n");
         return FAILED;
         }
+    self->source_encoder = atoi(sv->stream_source);
+    self->frames_dropped_logged = 0;
     if (!self->encoder_op->encoder->run_request_f)
         {
         fprintf(stderr, "streamer_start: encoder is not running\n");
@@ -407,10 +538,11 @@ int streamer_connect(struct threads_info *ti, struct universal_vars *uv, void *o
             self->shout_status = SHOUTERR_CONNECTED;
         case SHOUTERR_BUSY:
         case SHOUTERR_CONNECTED:
-            pthread_mutex_lock(&self->mode_mutex);
+            encoder_client_set_notify(self->encoder_op, self->notify_fd);
+            /* the I/O thread must see the connection complete before the mode */
+            __sync_synchronize();
             self->stream_mode = SM_CONNECTING;
-            pthread_cond_signal(&self->mode_cv);
-            pthread_mutex_unlock(&self->mode_mutex);
+            streamer_io_wake(ti->streamer_io);
             fprintf(stderr, "streamer_connect: established connection to the server\n");
             return SUCCEEDED;
         }
@@ -433,6 +565,7 @@ int streamer_disconnect(struct threads_info *ti, struct universal_vars *uv, void
         return FAILED;
         }
     self->disconnect_request = TRUE;
+    streamer_io_wake(ti->streamer_io);
     fprintf(stderr, "streamer_disconnect: disconnection_request is set\n");
     while(self->stream_mode != SM_DISCONNECTED)
         nanosleep(&ms10, NULL);
@@ -448,6 +581,7 @@ void shout_initialiser()
 struct streamer *streamer_init(struct threads_info *ti, int numeric_id)
     {
     struct streamer *self;
+    struct epoll_event ev = { .events = EPOLLIN };
     static pthread_once_t once_control = PTHREAD_ONCE_INIT;
     
     pthread_once(&once_control, shout_initialiser);
@@ -458,24 +592,81 @@ struct streamer *streamer_init(struct threads_info *ti, int numeric_id)
         }
     self->threads_info = ti;
     self->numeric_id = numeric_id;
-    pthread_mutex_init(&self->mode_mutex, NULL);
-    pthread_cond_init(&self->mode_cv, NULL);
-    pthread_create(&self->thread_h, NULL, streamer_main, self);
+    self->source_encoder = -1;
+    self->socket_fd = -1;
+    if ((self->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        {
+        fprintf(stderr, "streamer_init: eventfd failed: %s\n", strerror(errno));
+        free(self);
+        return NULL;
+        }
+    ev.data.ptr = self;
+    if (epoll_ctl(ti->streamer_io->epoll_fd, EPOLL_CTL_ADD, self->notify_fd, &ev))
+        {
+        fprintf(stderr, "streamer_init: epoll_ctl failed: %s\n", strerror(errno));
+        close(self->notify_fd);
+        free(self);
+        return NULL;
+        }
     return self;
     }
 
 void streamer_destroy(struct streamer *self)
     {
     static pthread_once_t once_control = PTHREAD_ONCE_INIT;
-    void *thread_ret;
 
     pthread_once(&once_control, shout_shutdown);
-    pthread_mutex_lock(&self->mode_mutex);
-    self->thread_terminate_f = TRUE;
-    pthread_cond_signal(&self->mode_cv);
-    pthread_mutex_unlock(&self->mode_mutex);
-    pthread_join(self->thread_h, &thread_ret);
-    pthread_cond_destroy(&self->mode_cv);
-    pthread_mutex_destroy(&self->mode_mutex);
+    close(self->notify_fd);
+    free(self);
+    }
+
+struct streamer_io *streamer_io_init(struct threads_info *ti)
+    {
+    struct streamer_io *self;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+    if (!(self = calloc(1, sizeof (struct streamer_io))))
+        {
+        fprintf(stderr, "streamer_io_init: malloc failure\n");
+        return NULL;
+        }
+    self->threads_info = ti;
+    self->wake_fd = -1;
+    if ((self->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        {
+        fprintf(stderr, "streamer_io_init: epoll_create1 failed: %s\n", strerror(errno));
+        goto failed;
+        }
+    if ((self->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        {
+        fprintf(stderr, "streamer_io_init: eventfd failed: %s\n", strerror(errno));
+        goto failed;
+        }
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->wake_fd, &ev))
+        {
+        fprintf(stderr, "streamer_io_init: epoll_ctl failed: %s\n", strerror(errno));
+        goto failed;
+        }
+    return self;
+
+    failed:
+    if (self->wake_fd >= 0)
+        close(self->wake_fd);
+    if (self->epoll_fd >= 0)
+        close(self->epoll_fd);
+    free(self);
+    return NULL;
+    }
+
+void streamer_io_destroy(struct streamer_io *self)
+    {
+    if (self->thread_started)
+        {
+        self->thread_terminate_f = TRUE;
+        streamer_io_wake(self);
+        pthread_join(self->thread_h, NULL);
+        }
+    close(self->wake_fd);
+    close(self->epoll_fd);
     free(self);
     }
@@ -21,6 +21,7 @@
 #define STREAMER_H
 
 #include "sourceclient.h"
+#include "latency.h"
 
 struct streamer_vars
     {
@@ -47,27 +48,45 @@ enum stream_mode { SM_DISCONNECTED, SM_CONNECTING, SM_CONNECTED, SM_DISCONNECTIN
 struct shout; 
 struct _util_dict;
 
+/* the one thread that does the network I/O for every streamer */
+struct streamer_io
+    {
+    struct threads_info *threads_info;
+    pthread_t thread_h;
+    int thread_started;          /* the thread is launched on the first connection attempt */
+    volatile int thread_terminate_f;
+    int epoll_fd;
+    int wake_fd;                 /* an eventfd for the control functions to get attention with */
+    };
+
 struct streamer
     {
     struct threads_info *threads_info;
     int numeric_id;
-    pthread_t thread_h;
-    int thread_terminate_f;
-    int disconnect_request;
-    int disconnect_pending;
+    int notify_fd;               /* an eventfd the encoder writes when it has packets for us */
+    int socket_fd;               /* the shout socket while waiting for it to become writable or -1 */
+    volatile int disconnect_request;
     struct encoder_op *encoder_op;
+    int source_encoder;          /* the numeric id of the encoder streamed from */
+    unsigned long frames_dropped_logged;
     struct shout *shout;
     struct _util_dict *shout_meta;
-    enum stream_mode stream_mode;
+    volatile enum stream_mode stream_mode;      /* changed by the I/O thread once connecting */
     int brand_new_connection;    /* used for triggering actions in the gui */
     long shout_status;
     int initial_serial;  /* the enocoder serial number we commence streaming from */
-    int final_serial;    /* the serial number to cease streaming at the end of */
     ssize_t max_shout_queue;     /* how much audio data we are willing to stockpile */
-    pthread_mutex_t mode_mutex;
-    pthread_cond_t mode_cv;
+    /* from the encoder sending a packet to taking it, to shout_send returning,
+     * the time to drain libshout's queue at the bit rate and from capture to all of that */
+    struct latency_histogram queue_latency;
+    struct latency_histogram send_latency;
+    struct latency_histogram buffer_latency;
+    struct latency_histogram total_latency;
     };
 
+/* streamer_io_init: to be made before the streamers and destroyed before them */
+struct streamer_io *streamer_io_init(struct threads_info *ti);
+void streamer_io_destroy(struct streamer_io *self);
 struct streamer *streamer_init(struct threads_info *ti, int numeric_id);
 void streamer_destroy(struct streamer *self);
 int streamer_connect(struct threads_info *ti, struct universal_vars *uv, void *other);
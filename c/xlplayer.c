@@ -36,6 +36,7 @@
 #include "flacdecode.h"
 #include "sndfiledecode.h"
 #include "avcodecdecode.h"
+#include "decprobe.h"
 #include "bsdcompat.h"
 #include "sig.h"
 #include "main.h"
@@ -46,6 +47,11 @@
 #define PBSPEED_INPUT_SAMPLE_SIZE 256
 #define PBSPEED_INPUT_BUFFER_SIZE (PBSPEED_INPUT_SAMPLE_SIZE * sizeof (float))
 
+#define DECODE_BATCH_MS 200          /* amount of audio to decode per decoder thread wakeup */
+#define DECODE_BATCH_MAX_CALLS 512   /* upper bound on decoder calls per batch e.g. for header packets */
+#define DECODE_LOW_WATERMARK_MS 2000 /* below this ringbuffer level the buffer is filled without delay */
+#define DECODE_FILL_RATIO 12         /* speed relative to real time at which the ringbuffer is filled */
+
 typedef jack_default_audio_sample_t sample_t;
 
 int mpg123ok = FALSE;
@@ -210,7 +216,6 @@ void xlplayer_write_channel_data(struct xlplayer *self)
             jack_ringbuffer_write(self->right_ch, (char *)self->rightbuffer, self->op_buffersize);
             samplecount = self->op_buffersize / sizeof (sample_t);
             self->samples_written += samplecount;
-            self->sleep_samples += samplecount;
             /* count cumulative silent samples */
             for (sc = 0, lp = self->leftbuffer, rp = self->rightbuffer; samplecount--; ++lp, ++rp)
                 {
@@ -225,17 +230,38 @@ void xlplayer_write_channel_data(struct xlplayer *self)
             self->silence += (float)sc / self->samplerate;
             }
         self->write_deferred = FALSE;
-        if (self->sleep_samples > 6000)
-            {
-            if (self->sleep_samples > 12000)
-                usleep(20000);
-            else
-                usleep(10000);
-            self->sleep_samples = 0;
-            }
         }
     }
 
+/* xlplayer_decode_batch: call the decoder repeatedly until a batch of audio is produced
+ * so that the loop overhead and the sleep that follows are paid once per batch rather than per frame
+ */
+static void xlplayer_decode_batch(struct xlplayer *self)
+    {
+    const int batch_ms = (self->rbdelay / 2 < DECODE_BATCH_MS) ? self->rbdelay / 2 : DECODE_BATCH_MS;
+    const u_int64_t target = (u_int64_t)self->samplerate * batch_ms / 1000;
+    const u_int64_t start = self->samples_written;
+    int calls = 0;
+    int32_t buffered_ms;
+
+    do {
+        self->dec_play(self);
+        } while (self->playmode == PM_PLAYING && !self->write_deferred && self->command == CMD_COMPLETE
+                    && self->samples_written - start < target && ++calls < DECODE_BATCH_MAX_CALLS);
+
+    self->sleep_samples += self->samples_written - start;
+    if (self->write_deferred || self->sleep_samples < target)
+        return;
+
+    /* near the high watermark pace the decoder, below the low watermark fill the ringbuffer flat out */
+    buffered_ms = xlplayer_calc_rbdelay(self);
+    if (buffered_ms > self->rbdelay - batch_ms * 2)
+        usleep(batch_ms * 1000 / 2);
+    else if (buffered_ms > DECODE_LOW_WATERMARK_MS)
+        usleep(self->sleep_samples * 1000 / self->samplerate * 1000 / DECODE_FILL_RATIO);
+    self->sleep_samples = 0;
+    }
+
 /* xlplayer_update_progress_time_ms: a rather ugly calculator of where the play progress is up to */
 static u_int32_t xlplayer_update_progress_time_ms(struct xlplayer *self)
     {
@@ -251,26 +277,21 @@ static u_int32_t xlplayer_update_progress_time_ms(struct xlplayer *self)
         return self->play_progress_ms = 0;
     }
 
-static char *get_extension(char *pathname)
-    {
-    char *p, *extension;
-    
-    if (!(p = strrchr(pathname, '.')))
-        {
-        fprintf(stderr, "get_extension: failed to find a file extension delineator '.'\n");
-        return strdup("");
-        }
-    extension = p = strdup(p + 1);
-    while (*p)
-        {
-        char c = tolower(*p);
-        *p++ = c;
-        }
-    return extension;
-    }
+static void xlplayer_start(struct xlplayer *self);
 
 static void xlplayer_command(struct xlplayer *self, enum command_t new_command)
     {
+    if (self->up == FALSE)
+        {
+        /* a player that has never been started has nothing to eject or clean up */
+        if (new_command == CMD_EJECT || new_command == CMD_CLEANUP)
+            {
+            xlplayer_set_fadesteps(self, self->fade_mode);
+            self->pause = 0;
+            return;
+            }
+        xlplayer_start(self);
+        }
     pthread_mutex_lock(&self->command_mutex);
     self->command = new_command;
     pthread_cond_signal(&self->command_cv);
@@ -281,8 +302,6 @@ static void xlplayer_command(struct xlplayer *self, enum command_t new_command)
 
 static void *xlplayer_main(struct xlplayer *self)
     {
-    char *extension;
-    
     sig_mask_thread();
     for(self->up = TRUE; self->command != CMD_THREADEXIT; self->watchdog_timer = 0)
         {
@@ -328,24 +347,7 @@ static void *xlplayer_main(struct xlplayer *self)
             case PM_INITIATE:
                 self->initial_audio_context = -1;   /* pre-select failure return code */
                 xlplayer_set_fadesteps(self, self->fade_mode);
-                extension = get_extension(self->pathname);
-                if (
-                          ((!strcmp(extension, "ogg") || !strcmp(extension, "oga")) && oggdecode_reg(self))
-#ifdef HAVE_SPEEX
-                          || (!strcmp(extension, "spx") && oggdecode_reg(self))
-#endif
-#ifdef HAVE_OPUS
-                          || (!strcmp(extension, "opus") && oggdecode_reg(self))
-#endif
-#ifdef HAVE_FLAC
-                          || (!strcmp(extension, "flac") && flacdecode_reg(self))
-#endif
-                          || ((!strcmp(extension, "wav") || !strcmp(extension, "au") || !strcmp(extension, "aiff")) && sndfiledecode_reg(self))
-#ifdef HAVE_LIBAV
-                          || ((!strcmp(extension, "aac") || !strcmp(extension, "m4a") || !strcmp(extension, "mp4") || !strcmp(extension, "m4b") || !strcmp(extension, "m4p") || !strcmp(extension, "wma") || !strcmp(extension, "avi") || !strcmp(extension, "mpc") || !strcmp(extension, "ape")) && avcodecdecode_reg(self))
-#endif /* HAVE_LIBAV */
-                          || ((!strcmp(extension, "mp3") || (!strcmp(extension, "mp2"))) && mpg123ok && mp3decode_reg(self))
-                    )
+                if (decprobe_reg(self))
                     {
                     self->playmode = PM_PLAYING;
                     self->play_progress_ms = 0;
@@ -363,13 +365,12 @@ static void *xlplayer_main(struct xlplayer *self)
                 else
                     self->playmode = PM_STOPPED;
                 self->command = CMD_COMPLETE;
-                free(extension);
                 break;
             case PM_PLAYING:
                 if (self->write_deferred)
                     xlplayer_write_channel_data(self);
                 else
-                    self->dec_play(self);
+                    xlplayer_decode_batch(self);
                 break;
             case PM_FLUSH:
                 if (self->write_deferred)
@@ -496,40 +497,126 @@ static long conv_rf_read(void *cb_data, float **audiodata)
         }
     }
 
-struct xlplayer *xlplayer_create(int samplerate, double duration, char *playername, sig_atomic_t *shutdown_f, int *vol_c, float vol_scale, int *strmute_c, int *audmute_c, float cutoff_s)
+static size_t buffer_memory;    /* running total of player ringbuffer allocation */
+
+static jack_ringbuffer_t *xlplayer_rb_create(size_t size)
     {
-    struct xlplayer *self;
-    int error;
-    const float minlevel = 1.0f/10000.0f;
-    
-    if (!(self = calloc(1, sizeof (struct xlplayer))))
+    jack_ringbuffer_t *rb;
+
+    if (!(rb = jack_ringbuffer_create(size)))
         {
-        fprintf(stderr, "xlplayer: malloc failure");
+        fprintf(stderr, "xlplayer: ringbuffer creation failure");
         exit(5);
         }
-    self->rbsize = (int)(duration * samplerate) << 2;
-    self->rbdelay = (int)(duration * 1000);
-    self->samples_cutoff = samplerate * cutoff_s;
-    if (!(self->left_ch = jack_ringbuffer_create(self->rbsize)))
+    buffer_memory += rb->size;
+    return rb;
+    }
+
+static void xlplayer_rb_free(jack_ringbuffer_t *rb)
+    {
+    buffer_memory -= rb->size;
+    jack_ringbuffer_free(rb);
+    }
+
+size_t xlplayer_buffer_memory()
+    {
+    return buffer_memory;
+    }
+
+struct xlplayer_rbpool *xlplayer_rbpool_create(int samplerate, double duration, int n_pairs)
+    {
+    struct xlplayer_rbpool *self;
+
+    if (!(self = calloc(1, sizeof (struct xlplayer_rbpool))))
         {
-        fprintf(stderr, "xlplayer: ringbuffer creation failure");
+        fprintf(stderr, "xlplayer_rbpool_create: malloc failure\n");
         exit(5);
         }
-    if (!(self->right_ch = jack_ringbuffer_create(self->rbsize)))
+    self->duration = duration;
+    self->rbsize = (int)(duration * samplerate) << 2;
+    self->n_pairs = n_pairs;
+    self->free_l = calloc(n_pairs + 1, sizeof (jack_ringbuffer_t *));
+    self->free_r = calloc(n_pairs + 1, sizeof (jack_ringbuffer_t *));
+    if (!(self->free_l && self->free_r))
         {
-        fprintf(stderr, "xlplayer: ringbuffer creation failure");
+        fprintf(stderr, "xlplayer_rbpool_create: malloc failure\n");
         exit(5);
         }
-    if (!(self->left_fade = jack_ringbuffer_create(self->rbsize)))
+    for (self->n_free = 0; self->n_free < n_pairs; ++self->n_free)
         {
-        fprintf(stderr, "xlplayer: ringbuffer creation failure");
-        exit(5);
+        self->free_l[self->n_free] = xlplayer_rb_create(self->rbsize);
+        self->free_r[self->n_free] = xlplayer_rb_create(self->rbsize);
         }
-    if (!(self->right_fade = jack_ringbuffer_create(self->rbsize)))
+    self->empty = xlplayer_rb_create(sizeof (sample_t));
+    return self;
+    }
+
+void xlplayer_rbpool_destroy(struct xlplayer_rbpool *self)
+    {
+    if (self)
         {
-        fprintf(stderr, "xlplayer: ringbuffer creation failure");
-        exit(5);
+        while (self->n_free--)
+            {
+            xlplayer_rb_free(self->free_l[self->n_free]);
+            xlplayer_rb_free(self->free_r[self->n_free]);
+            }
+        xlplayer_rb_free(self->empty);
+        free(self->free_l);
+        free(self->free_r);
+        free(self);
         }
+    }
+
+/* xlplayer_fade_release: hand the fade buffers back to the pool */
+static void xlplayer_fade_release(struct xlplayer *self)
+    {
+    struct xlplayer_rbpool *pool = self->rbpool;
+
+    if (self->left_fade != pool->empty)
+        {
+        jack_ringbuffer_reset(self->left_fade);
+        jack_ringbuffer_reset(self->right_fade);
+        pool->free_l[pool->n_free] = self->left_fade;
+        pool->free_r[pool->n_free++] = self->right_fade;
+        self->left_fade = self->right_fade = pool->empty;
+        }
+    }
+
+/* xlplayer_fade_acquire: the playback buffers become the fade buffers and a fresh pair is taken from the pool
+ * return value: FALSE when the pool is exhausted in which case there will be no fade */
+static int xlplayer_fade_acquire(struct xlplayer *self)
+    {
+    struct xlplayer_rbpool *pool = self->rbpool;
+
+    xlplayer_fade_release(self);        /* a fade in progress is cut short */
+    if (pool->n_free == 0)
+        return FALSE;
+    self->left_fade = self->left_ch;
+    self->right_fade = self->right_ch;
+    self->left_ch = pool->free_l[--pool->n_free];
+    self->right_ch = pool->free_r[pool->n_free];
+    return TRUE;
+    }
+
+/* xlplayer_fade_expire: return the fade buffers once they run dry or the fade is complete */
+static void xlplayer_fade_expire(struct xlplayer *self)
+    {
+    struct fade *f = self->fadeout;
+
+    if (self->left_fade != self->rbpool->empty && (jack_ringbuffer_read_space(self->right_fade) == 0 ||
+                            (!f->newdata && !f->moving && f->level == 0.0f)))
+        xlplayer_fade_release(self);
+    }
+
+/* xlplayer_start: allocate the buffers and speed converters then launch the decoder thread
+ * this is deferred until the player is first given something to do */
+static void xlplayer_start(struct xlplayer *self)
+    {
+    int error;
+
+    self->left_ch = xlplayer_rb_create(self->rbsize);
+    self->right_ch = xlplayer_rb_create(self->rbsize);
+    self->left_fade = self->right_fade = self->rbpool->empty;
     if (!(self->pbspeed_conv_l = src_callback_new(conv_l_read, SRC_LINEAR, 1, &error, self)))
         {
         fprintf(stderr, "xlplayer: playback speed converter initialisation failure");
@@ -550,13 +637,6 @@ struct xlplayer *xlplayer_create(int samplerate, double duration, char *playerna
         fprintf(stderr, "xlplayer: playback speed converter initialisation failure");
         exit(5);
         }
-    if (pthread_mutex_init(&(self->dynamic_metadata.meta_mutex), NULL))
-        {
-        fprintf(stderr, "xlplayer: failed initialising metadata_mutex\n");
-        exit(5);
-        }
-    self->fadein = fade_init(samplerate, minlevel);
-    self->fadeout = fade_init(samplerate, minlevel);
     self->pbsrb_l = malloc(PBSPEED_INPUT_BUFFER_SIZE);
     self->pbsrb_r = malloc(PBSPEED_INPUT_BUFFER_SIZE);
     self->pbsrb_lf = malloc(PBSPEED_INPUT_BUFFER_SIZE);
@@ -566,6 +646,33 @@ struct xlplayer *xlplayer_create(int samplerate, double duration, char *playerna
         fprintf(stderr, "xlplayer: playback speed converter input buffer initialisation failure\n");
         exit(5);
         }
+    /* the jack callback leaves the player alone until up is set by the new thread */
+    pthread_create(&self->thread, NULL, (void *(*)(void *)) xlplayer_main, self);
+    while (self->up == FALSE)
+        usleep(10000);
+    }
+
+struct xlplayer *xlplayer_create(int samplerate, struct xlplayer_rbpool *rbpool, char *playername, sig_atomic_t *shutdown_f, int *vol_c, float vol_scale, int *strmute_c, int *audmute_c, float cutoff_s)
+    {
+    struct xlplayer *self;
+    const float minlevel = 1.0f/10000.0f;
+    
+    if (!(self = calloc(1, sizeof (struct xlplayer))))
+        {
+        fprintf(stderr, "xlplayer: malloc failure");
+        exit(5);
+        }
+    self->rbpool = rbpool;
+    self->rbsize = rbpool->rbsize;
+    self->rbdelay = (int)(rbpool->duration * 1000);
+    self->samples_cutoff = samplerate * cutoff_s;
+    if (pthread_mutex_init(&(self->dynamic_metadata.meta_mutex), NULL))
+        {
+        fprintf(stderr, "xlplayer: failed initialising metadata_mutex\n");
+        exit(5);
+        }
+    self->fadein = fade_init(samplerate, minlevel);
+    self->fadeout = fade_init(samplerate, minlevel);
     self->playername = playername;
     self->cf_l_gain = self->cf_r_gain = 1.0f;
     self->seed = 17234;
@@ -579,9 +686,6 @@ struct xlplayer *xlplayer_create(int samplerate, double duration, char *playerna
     smoothing_mute_init(&self->mute_aud, audmute_c);
     pthread_mutex_init(&self->command_mutex, NULL);
     pthread_cond_init(&self->command_cv, NULL);
-    pthread_create(&self->thread, NULL, (void *(*)(void *)) xlplayer_main, self);
-    while (self->up == FALSE)
-        usleep(10000);
     return self;
     }
 
@@ -589,8 +693,26 @@ void xlplayer_destroy(struct xlplayer *self)
     {
     if (self)
         {
-        xlplayer_command(self, CMD_CLEANUP);
-        pthread_join(self->thread, NULL);
+        if (self->up)
+            {
+            xlplayer_command(self, CMD_CLEANUP);
+            pthread_join(self->thread, NULL);
+            free(self->pbsrb_l);
+            free(self->pbsrb_r);
+            free(self->pbsrb_lf);
+            free(self->pbsrb_rf);
+            src_delete(self->pbspeed_conv_l);
+            src_delete(self->pbspeed_conv_r);
+            src_delete(self->pbspeed_conv_lf);
+            src_delete(self->pbspeed_conv_rf);
+            xlplayer_rb_free(self->left_ch);
+            xlplayer_rb_free(self->right_ch);
+            if (self->left_fade != self->rbpool->empty)
+                {
+                xlplayer_rb_free(self->left_fade);
+                xlplayer_rb_free(self->right_fade);
+                }
+            }
         pthread_cond_destroy(&self->command_cv);
         pthread_mutex_destroy(&self->command_mutex);
         pthread_mutex_destroy(&(self->dynamic_metadata.meta_mutex));
@@ -598,20 +720,8 @@ void xlplayer_destroy(struct xlplayer *self)
         ifree(self->rcb);
         ifree(self->lcfb);
         ifree(self->rcfb);
-        free(self->pbsrb_l);
-        free(self->pbsrb_r);
-        free(self->pbsrb_lf);
-        free(self->pbsrb_rf);
         fade_destroy(self->fadein);
         fade_destroy(self->fadeout);
-        src_delete(self->pbspeed_conv_l);
-        src_delete(self->pbspeed_conv_r);
-        src_delete(self->pbspeed_conv_lf);
-        src_delete(self->pbspeed_conv_rf);
-        jack_ringbuffer_free(self->left_ch);
-        jack_ringbuffer_free(self->right_ch);
-        jack_ringbuffer_free(self->left_fade);
-        jack_ringbuffer_free(self->right_fade);
         free(self);
         }
     }
@@ -724,18 +834,18 @@ void xlplayer_set_fadesteps(struct xlplayer *self, int fade_mode)
 /* version supporting playback speed variance */
 size_t read_from_player_sv(struct xlplayer *self, sample_t *left_buf, sample_t *right_buf, sample_t *left_fbuf, sample_t *right_fbuf, jack_nframes_t nframes)
     {
-    jack_ringbuffer_t *swap;
     SRC_STATE *pbs_swap;
     float *pbsrb_swap;
     size_t todo = 0, ftodo = 0;
 
+    xlplayer_fade_expire(self);
     if (self->jack_flush)
         {
         if (self->noflush == FALSE)
             {
-            if (self->pause == 0)
+            if (self->pause == 0 && xlplayer_fade_acquire(self))
                 {
-                /* perform the exchange of handles for the purpose of fading out the remaining buffer contents */
+                /* the ringbuffers are exchanged for the purpose of fading out the remaining buffer contents */
                 /* exchange speed converter handles */
                 pbs_swap = self->pbspeed_conv_l;
                 self->pbspeed_conv_l = self->pbspeed_conv_lf;
@@ -751,13 +861,6 @@ size_t read_from_player_sv(struct xlplayer *self, sample_t *left_buf, sample_t *
                 self->pbsrb_r = self->pbsrb_rf;
                 self->pbsrb_rf = pbsrb_swap;
                 self->pbs_exchange = !self->pbs_exchange;
-                /* exchange ring buffers */
-                swap = self->left_ch;
-                self->left_ch = self->left_fade;
-                self->left_fade = swap;
-                swap = self->right_ch;
-                self->right_ch = self->right_fade;
-                self->right_fade = swap;
                 /* initialisations for fade */
                 fade_set(self->fadeout, FADE_SET_HIGH, -1.0f, FADE_OUT);
                 }
@@ -817,23 +920,15 @@ size_t read_from_player_sv(struct xlplayer *self, sample_t *left_buf, sample_t *
 /* version not supporting playback speed variance but uses less CPU */
 size_t read_from_player(struct xlplayer *self, sample_t *left_buf, sample_t *right_buf, sample_t *left_fbuf, sample_t *right_fbuf, jack_nframes_t nframes)
     {
-    jack_ringbuffer_t *swap;
     size_t todo, favail, ftodo;
     
+    xlplayer_fade_expire(self);
     if (self->jack_flush)
         {
         if (self->noflush == FALSE)
             {
-            if (self->pause == 0)
-                {
-                swap = self->left_ch;
-                self->left_ch = self->left_fade;
-                self->left_fade = swap;
-                swap = self->right_ch;
-                self->right_ch = self->right_fade;
-                self->right_fade = swap;
+            if (self->pause == 0 && xlplayer_fade_acquire(self))
                 fade_set(self->fadeout, FADE_SET_HIGH, -1.0f, FADE_OUT);
-                }
             jack_ringbuffer_reset(self->left_ch);
             jack_ringbuffer_reset(self->right_ch);
             }
@@ -926,6 +1021,16 @@ size_t xlplayer_read_start(struct xlplayer *self, jack_nframes_t nframes)
     self->lcfp = self->lcfb;
     self->rcfp = self->rcfb;
         
+    if (self->up == FALSE)
+        {
+        /* not yet started so there are no buffers to read from */
+        memset(self->lcb, 0, nframes * sizeof (sample_t));
+        memset(self->rcb, 0, nframes * sizeof (sample_t));
+        memset(self->lcfb, 0, nframes * sizeof (sample_t));
+        memset(self->rcfb, 0, nframes * sizeof (sample_t));
+        return 0;
+        }
+
     if (self->use_sv)
         samples_read = read_from_player_sv(self, self->lcb, self->rcb, self->lcfb, self->rcfb, nframes);
     else
@@ -53,13 +53,28 @@ struct xlp_dynamic_metadata     /* song titles can change mid-file */
     enum metadata_t data_type;
     };
 
+/* ringbuffer pairs shared among the players of one role
+ * a pair is drawn for as long as an eject fade is in progress
+ * only the jack callback draws from or returns to the pool so it requires no locking */
+struct xlplayer_rbpool
+    {
+    double duration;                    /* the ringbuffer length in seconds */
+    size_t rbsize;                      /* the size of the ringbuffers in bytes */
+    int n_pairs;                        /* the number of simultaneous fades supported */
+    int n_free;                         /* the number of pairs currently in the pool */
+    jack_ringbuffer_t **free_l;
+    jack_ringbuffer_t **free_r;
+    jack_ringbuffer_t *empty;           /* stands in as the fade buffer while there is no fade */
+    };
+
 struct xlplayer
     {
+    struct xlplayer_rbpool *rbpool;     /* the source of fade buffers */
     struct fade *fadein;                /* fade level computation */
     struct fade *fadeout;
     jack_ringbuffer_t *left_ch;         /* main playback buffer */
     jack_ringbuffer_t *right_ch;
-    jack_ringbuffer_t *left_fade;       /* buffers used for fade - swapped with above when needed */
+    jack_ringbuffer_t *left_fade;       /* buffers used for fade - drawn from the pool when needed */
     jack_ringbuffer_t *right_fade;
     size_t rbsize;                      /* the size of the jack ringbuffers in bytes */
     int rbdelay;                        /* rough time lag of the ringbuffers in ms */
@@ -94,7 +109,7 @@ struct xlplayer
     int dither;                         /* whether to add dither to player output FLAC, MP4, WAV only */
     unsigned int seed;                  /* used for dither */
     pthread_t thread;                   /* thread pointer for the player main loop */
-    u_int32_t sleep_samples;            /* used to count off when it is appropriate to call sleep */
+    u_int64_t sleep_samples;            /* samples decoded since the decoder thread last slept */
     SRC_STATE *src_state;               /* used by resampler */
     SRC_DATA src_data;
     int rsqual;                         /* resample quality */   
@@ -117,8 +132,9 @@ struct xlplayer
     int pbs_exchange;                   /* keeps correct association for input buffers after a buffer swap occurs */
     void *dec_data;                     /* points to audio decoder data */
     void (*dec_init)(struct xlplayer *);/* audio decoder init function */
-    void (*dec_play)(struct xlplayer *);/* function that decodes one frame of audio data */
+    void (*dec_play)(struct xlplayer *);/* function that decodes one frame of audio data - called in batches */
     void (*dec_eject)(struct xlplayer *);/* function that cleans up after the decoder */
+    struct httpsource *httpsource;      /* connection left open by decprobe for the decoder */
     struct xlp_dynamic_metadata dynamic_metadata;
     int usedelay;                       /* client to delay dynamic metadata display */
     float silence;                      /* the number of seconds of silence */
@@ -149,8 +165,17 @@ struct xlplayer
     pthread_cond_t command_cv;          /* used to wake up idle worker thread */
     };
 
+/* xlplayer_rbpool_create: a pool for players of ringbuffer length duration seconds
+ * n_pairs is the number of players of the role that may fade out at the same time */
+struct xlplayer_rbpool *xlplayer_rbpool_create(int samplerate, double duration, int n_pairs);
+/* xlplayer_rbpool_destroy: call after all the players using the pool are destroyed */
+void xlplayer_rbpool_destroy(struct xlplayer_rbpool *);
+
+/* xlplayer_buffer_memory: the number of bytes of ringbuffer currently allocated for all players */
+size_t xlplayer_buffer_memory();
+
 /* xlplayer_create: create an instance of the player */
-struct xlplayer *xlplayer_create(int samplerate, double duration, char *playername, sig_atomic_t *shutdown_f, int *vol_c, float vol_scale, int *strmute_c, int *audmute_c, float cutoff_s);
+struct xlplayer *xlplayer_create(int samplerate, struct xlplayer_rbpool *rbpool, char *playername, sig_atomic_t *shutdown_f, int *vol_c, float vol_scale, int *strmute_c, int *audmute_c, float cutoff_s);
 /* xlplayer_destroy: the opposite of xlplayer_create */
 void xlplayer_destroy(struct xlplayer *);
 
@@ -233,4 +258,7 @@ void xlplayer_stats_all(struct xlplayer **list);
 /* initialise mpg123 runtime linking (if falling back to runtime linking) and report the operational status */
 void xlplayer_mpg123_status();
 
+/* set by the above when the mp3 decoder may be used */
+extern int mpg123ok;
+
 #endif /* XLPLAYER_H */
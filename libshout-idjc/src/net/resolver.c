@@ -25,6 +25,7 @@
 #include <sys/types.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifndef _WIN32
 #include <netdb.h>
@@ -36,6 +37,8 @@
 #endif
 
 #ifndef NO_THREAD
+#include <pthread.h>
+#include <signal.h>
 #include <thread/thread.h>
 #else
 #define thread_mutex_create(x) do{}while(0)
@@ -47,6 +50,16 @@
 #include "resolver.h"
 #include "sock.h"
 
+/* for older C libraries */
+#ifndef AI_ADDRCONFIG
+# define AI_ADDRCONFIG 0
+#endif
+
+/* lookups of different names run side by side on up to this many threads */
+#define RESOLVER_THREADS 4
+/* seconds an unused cache entry is kept */
+#define RESOLVER_IDLE 3600
+
 /* internal function */
 
 static int _isip(const char *what);
@@ -58,6 +71,37 @@ static mutex_t _resolver_mutex;
 #endif
 static int _initialized = 0;
 
+/* the lookup cache
+ *
+ * Everything connecting to one host shares its entry and so its lookup.
+ * An entry is on the job list and not to be freed while resolving is set.
+ */
+typedef struct resolver_entry_tag {
+    struct resolver_entry_tag *next;
+    struct resolver_entry_tag *next_job;
+    char *name;
+    time_t expires;
+    time_t used;
+    int resolving;
+    int n_addrs;
+    resolver_addr_t addrs[RESOLVER_MAX_ADDRS];
+} resolver_entry_t;
+
+static resolver_entry_t *_cache = NULL;
+static resolver_entry_t *_jobs = NULL, *_last_job = NULL;
+
+#ifndef NO_THREAD
+static pthread_mutex_t _cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _cache_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t _threads[RESOLVER_THREADS];
+static int _n_threads = 0, _idle_threads = 0, _n_jobs = 0, _terminate = 0;
+#define _cache_lock() pthread_mutex_lock(&_cache_mutex)
+#define _cache_unlock() pthread_mutex_unlock(&_cache_mutex)
+#else
+#define _cache_lock() do{}while(0)
+#define _cache_unlock() do{}while(0)
+#endif
+
 #ifdef HAVE_INET_PTON
 static int _isip(const char *what)
 {
@@ -196,6 +240,255 @@ char *resolver_getip(const char *name, char *buff, int len)
 #endif
 
 
+/* _resolve
+ *
+ * the addresses of name with the address families taking turns, each in
+ * the order the system prefers
+ *
+ * returns the number of addresses, 0 when no name server answered or -1
+ * when the name does not exist
+ */
+#ifdef HAVE_GETADDRINFO
+static int _resolve(const char *name, resolver_addr_t *addrs)
+{
+    struct addrinfo *head, *ai, hints;
+    struct addrinfo *family[2][RESOLVER_MAX_ADDRS];
+    int n[2] = { 0, 0 }, first = 0, count = 0, f, i, rc;
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    if ((rc = getaddrinfo (name, NULL, &hints, &head)) != 0)
+        return (rc == EAI_NONAME) ? -1 : 0;
+
+    for (ai = head; ai; ai = ai->ai_next)
+    {
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+            continue;
+        if (ai->ai_addrlen > sizeof (addrs->addr))
+            continue;
+        f = (ai->ai_family == AF_INET6);
+        if (n[0] + n[1] == 0)
+            first = f;
+        if (n[f] < RESOLVER_MAX_ADDRS)
+            family[f][n[f]++] = ai;
+    }
+
+    for (i = 0; count < RESOLVER_MAX_ADDRS && (i < n[0] || i < n[1]); i++)
+    {
+        for (f = first; count < RESOLVER_MAX_ADDRS && f < first + 2; f++)
+        {
+            if (i >= n[f & 1])
+                continue;
+            ai = family[f & 1][i];
+            memset (&addrs[count], 0, sizeof (resolver_addr_t));
+            memcpy (&addrs[count].addr, ai->ai_addr, ai->ai_addrlen);
+            addrs[count].len = ai->ai_addrlen;
+            count++;
+        }
+    }
+    freeaddrinfo (head);
+
+    return count ? count : -1;
+}
+
+#else
+
+static int _resolve(const char *name, resolver_addr_t *addrs)
+{
+    struct hostent *host;
+    struct sockaddr_in *sin;
+    int count = 0;
+
+    thread_mutex_lock(&_resolver_mutex);
+    host = gethostbyname(name);
+    if (host == NULL)
+        count = (h_errno == HOST_NOT_FOUND) ? -1 : 0;
+    else if (host->h_addrtype != AF_INET)
+        count = -1;
+    else
+    {
+        while (count < RESOLVER_MAX_ADDRS && host->h_addr_list[count])
+        {
+            memset (&addrs[count], 0, sizeof (resolver_addr_t));
+            sin = (struct sockaddr_in *)&addrs[count].addr;
+            sin->sin_family = AF_INET;
+            memcpy (&sin->sin_addr, host->h_addr_list[count], sizeof (sin->sin_addr));
+            addrs[count].len = sizeof (struct sockaddr_in);
+            count++;
+        }
+    }
+    thread_mutex_unlock(&_resolver_mutex);
+
+    return count;
+}
+#endif
+
+/* _store: the outcome of a lookup, called with the cache locked */
+static void _store(resolver_entry_t *entry, const resolver_addr_t *addrs, int count)
+{
+    time_t now = time(NULL);
+
+    entry->resolving = 0;
+    if (count > 0)
+    {
+        memcpy (entry->addrs, addrs, count * sizeof (resolver_addr_t));
+        entry->n_addrs = count;
+        entry->expires = now + RESOLVER_TTL;
+    }
+    else
+    {
+        /* addresses outlive a name server that is down but not a name that is gone */
+        if (count < 0)
+            entry->n_addrs = 0;
+        entry->expires = now + RESOLVER_FAILED_TTL;
+    }
+}
+
+#ifndef NO_THREAD
+static void *_resolver_thread(void *arg)
+{
+    resolver_entry_t *entry;
+    resolver_addr_t addrs[RESOLVER_MAX_ADDRS];
+    int count;
+
+    _cache_lock();
+    while (!_terminate)
+    {
+        if ((entry = _jobs) == NULL)
+        {
+            _idle_threads++;
+            pthread_cond_wait(&_cache_cond, &_cache_mutex);
+            _idle_threads--;
+            continue;
+        }
+        if ((_jobs = entry->next_job) == NULL)
+            _last_job = NULL;
+        _n_jobs--;
+
+        /* the entry stays put while resolving is set */
+        _cache_unlock();
+        count = _resolve(entry->name, addrs);
+        _cache_lock();
+        _store(entry, addrs, count);
+    }
+    _cache_unlock();
+
+    return NULL;
+}
+
+/* _start_thread: called with the cache locked, the thread takes no signals */
+static int _start_thread(void)
+{
+    sigset_t all, old;
+    int rc;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&_threads[_n_threads], NULL, _resolver_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+        return -1;
+    _n_threads++;
+    return 0;
+}
+#endif
+
+/* _start_lookup: called with the cache locked */
+static void _start_lookup(resolver_entry_t *entry)
+{
+    resolver_addr_t addrs[RESOLVER_MAX_ADDRS];
+
+    entry->resolving = 1;
+#ifndef NO_THREAD
+    /* an address needs no name server */
+    if (!_isip(entry->name))
+    {
+        entry->next_job = NULL;
+        if (_last_job)
+            _last_job->next_job = entry;
+        else
+            _jobs = entry;
+        _last_job = entry;
+        _n_jobs++;
+
+        if (_n_jobs > _idle_threads && _n_threads < RESOLVER_THREADS)
+            _start_thread();
+        if (_n_threads)
+        {
+            pthread_cond_signal(&_cache_cond);
+            return;
+        }
+
+        /* no thread to be had */
+        _jobs = _last_job = NULL;
+        _n_jobs = 0;
+    }
+#endif
+    _store(entry, addrs, _resolve(entry->name, addrs));
+}
+
+/* _prune: drop entries not asked for in a while, called with the cache locked */
+static void _prune(time_t now)
+{
+    resolver_entry_t **link = &_cache, *entry;
+
+    while ((entry = *link))
+    {
+        if (!entry->resolving && now - entry->used > RESOLVER_IDLE)
+        {
+            *link = entry->next;
+            free(entry->name);
+            free(entry);
+        }
+        else
+            link = &entry->next;
+    }
+}
+
+int resolver_lookup(const char *name, resolver_addr_t *addrs, int max)
+{
+    resolver_entry_t *entry;
+    time_t now = time(NULL);
+    int count;
+
+    _cache_lock();
+    for (entry = _cache; entry; entry = entry->next)
+        if (strcmp(entry->name, name) == 0)
+            break;
+
+    if (entry == NULL)
+    {
+        _prune(now);
+        if ((entry = calloc(1, sizeof (resolver_entry_t))) == NULL ||
+                (entry->name = strdup(name)) == NULL)
+        {
+            free(entry);
+            _cache_unlock();
+            return -1;
+        }
+        entry->next = _cache;
+        _cache = entry;
+    }
+
+    entry->used = now;
+    if (!entry->resolving && now >= entry->expires)
+        _start_lookup(entry);
+
+    if (entry->n_addrs)
+    {
+        count = (entry->n_addrs < max) ? entry->n_addrs : max;
+        memcpy (addrs, entry->addrs, count * sizeof (resolver_addr_t));
+    }
+    else
+        count = entry->resolving ? 0 : -1;
+    _cache_unlock();
+
+    return count;
+}
+
+
 void resolver_initialize()
 {
     /* initialize the lib if we havne't done so already */
@@ -214,8 +507,29 @@ void resolver_initialize()
 
 void resolver_shutdown(void)
 {
+    resolver_entry_t *entry;
+
     if (_initialized)
     {
+#ifndef NO_THREAD
+        /* a thread in the middle of a lookup is waited for */
+        _cache_lock();
+        _terminate = 1;
+        pthread_cond_broadcast(&_cache_cond);
+        _cache_unlock();
+        while (_n_threads)
+            pthread_join(_threads[--_n_threads], NULL);
+        _terminate = 0;
+        _n_jobs = 0;
+#endif
+        _jobs = _last_job = NULL;
+        while ((entry = _cache))
+        {
+            _cache = entry->next;
+            free(entry->name);
+            free(entry);
+        }
+
         thread_mutex_destroy(&_resolver_mutex);
         _initialized = 0;
 #ifdef HAVE_ENDHOSTENT
@@ -25,14 +25,48 @@
 # define resolver_shutdown _mangle(resolver_shutdown)
 # define resolver_getname _mangle(resolver_getname)
 # define resolver_getip _mangle(resolver_getip)
+# define resolver_lookup _mangle(resolver_lookup)
 #endif
 
+#ifndef _WIN32
+#include <sys/socket.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+/* the most addresses kept for one name */
+#define RESOLVER_MAX_ADDRS 8
+
+/* seconds a lookup is trusted for, and a failed one before it is retried */
+#define RESOLVER_TTL 300
+#define RESOLVER_FAILED_TTL 5
+
+typedef struct {
+    socklen_t len;
+    struct sockaddr_storage addr;
+} resolver_addr_t;
+
 void resolver_initialize(void);
 void resolver_shutdown(void);
 
 char *resolver_getname(const char *ip, char *buff, int len);
 char *resolver_getip(const char *name, char *buff, int len);
 
+/*
+** resolver_lookup
+**
+** copies up to max addresses of name, with port 0 and the address
+** families alternating, from the cache.  A missing or expired entry is
+** looked up on a resolver thread meanwhile so this never blocks.  The
+** addresses of an expired entry are still given out while it is looked
+** up again, or if the lookup fails for want of a name server.
+**
+** returns the number of addresses, 0 while the first lookup of name is
+** in progress or -1 if name could not be resolved
+*/
+int resolver_lookup(const char *name, resolver_addr_t *addrs, int max);
+
 #endif
 
 
@@ -58,6 +58,8 @@
 #endif
 #endif
 
+#include <timing/timing.h>
+
 #include "sock.h"
 #include "resolver.h"
 
@@ -903,6 +905,216 @@ sock_t sock_get_server_socket(int port, const char *sinterface)
 
 #endif
 
+/* asynchronous connect
+ *
+ * The host name is looked up by the resolver without blocking.  Its
+ * addresses are tried in turn, one attempt starting every
+ * SOCK_CONNECT_STAGGER milliseconds, or at once when the last one fails,
+ * with earlier attempts left running.  The first to connect is kept.
+ * As the resolver alternates address families an unreachable IPv6 route
+ * costs a quarter second rather than a timeout.
+ */
+struct sock_connect_tag
+{
+    char *hostname;
+    unsigned port;
+    int attempt_timeout;
+    /* 0 for no limit */
+    uint64_t deadline;
+    /* n_addrs stays 0 until the name is resolved */
+    resolver_addr_t addrs[RESOLVER_MAX_ADDRS];
+    int n_addrs;
+    int next_addr;
+    uint64_t next_start;
+    /* the attempts under way */
+    sock_t attempt[RESOLVER_MAX_ADDRS];
+    uint64_t attempt_end[RESOLVER_MAX_ADDRS];
+    int n_attempts;
+};
+
+sock_connect_t *sock_connect_start (const char *hostname, unsigned port, int attempt_timeout, int timeout)
+{
+    sock_connect_t *conn;
+
+    if ((conn = calloc (1, sizeof (sock_connect_t))) == NULL)
+        return NULL;
+    if ((conn->hostname = strdup (hostname)) == NULL)
+    {
+        free (conn);
+        return NULL;
+    }
+    conn->port = port;
+    conn->attempt_timeout = attempt_timeout;
+    if (timeout > 0)
+        conn->deadline = timing_get_time() + timeout;
+
+    return conn;
+}
+
+/* start an attempt on the next address, returns 0 if it failed at once */
+static int _connect_attempt (sock_connect_t *conn, uint64_t now)
+{
+    resolver_addr_t *addr = &conn->addrs[conn->next_addr++];
+    sock_t sock;
+
+    if ((sock = socket (addr->addr.ss_family, SOCK_STREAM, 0)) == SOCK_ERROR)
+        return 0;
+    sock_set_blocking (sock, 0);
+    if (connect (sock, (struct sockaddr *)&addr->addr, addr->len) < 0 &&
+            !sock_connect_pending (sock_error()))
+    {
+        sock_close (sock);
+        return 0;
+    }
+    conn->attempt[conn->n_attempts] = sock;
+    conn->attempt_end[conn->n_attempts++] = now + conn->attempt_timeout;
+
+    return 1;
+}
+
+static void _connect_drop (sock_connect_t *conn, int i)
+{
+    conn->n_attempts--;
+    conn->attempt[i] = conn->attempt[conn->n_attempts];
+    conn->attempt_end[i] = conn->attempt_end[conn->n_attempts];
+}
+
+/* sleep until an attempt may have finished or timeout ms pass */
+static void _connect_wait (sock_connect_t *conn, int timeout)
+{
+#ifdef HAVE_POLL
+    struct pollfd check[RESOLVER_MAX_ADDRS];
+    int i;
+
+    for (i = 0; i < conn->n_attempts; i++)
+    {
+        check[i].fd = conn->attempt[i];
+        check[i].events = POLLOUT;
+    }
+    poll (check, conn->n_attempts, timeout);
+#else
+    fd_set wfds;
+    struct timeval tv;
+    sock_t max = 0;
+    int i;
+
+    FD_ZERO (&wfds);
+    for (i = 0; i < conn->n_attempts; i++)
+    {
+        FD_SET (conn->attempt[i], &wfds);
+        if (conn->attempt[i] > max)
+            max = conn->attempt[i];
+    }
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    select (max + 1, NULL, &wfds, NULL, &tv);
+#endif
+}
+
+/* sock_connect_poll
+**
+** advance the connect, waiting up to wait ms for it to finish or
+** indefinitely if wait is negative.  On success the socket, which is
+** non-blocking, is stored in sock and belongs to the caller.
+**
+** returns 1 when connected, 0 while in progress or SOCK_ERROR once every
+** address has failed or the timeout has passed
+*/
+int sock_connect_poll (sock_connect_t *conn, sock_t *sock, int wait)
+{
+    uint64_t now = timing_get_time(), until, next;
+    int i, rc, count, failed;
+
+    until = (wait < 0) ? (uint64_t)-1 : now + wait;
+    for (;;)
+    {
+        if (conn->n_addrs == 0)
+        {
+            if ((count = resolver_lookup (conn->hostname, conn->addrs, RESOLVER_MAX_ADDRS)) < 0)
+                return SOCK_ERROR;
+            for (i = 0; i < count; i++)
+            {
+                if (conn->addrs[i].addr.ss_family == AF_INET6)
+                    ((struct sockaddr_in6 *)&conn->addrs[i].addr)->sin6_port = htons (conn->port);
+                else
+                    ((struct sockaddr_in *)&conn->addrs[i].addr)->sin_port = htons (conn->port);
+            }
+            conn->n_addrs = count;
+            conn->next_start = now;
+        }
+
+        while (conn->next_addr < conn->n_addrs && now >= conn->next_start)
+        {
+            if (_connect_attempt (conn, now))
+                conn->next_start = now + SOCK_CONNECT_STAGGER;
+        }
+
+        failed = 0;
+        for (i = 0; i < conn->n_attempts; )
+        {
+            rc = sock_connected (conn->attempt[i], 0);
+            if (rc == 1)
+            {
+                *sock = conn->attempt[i];
+                _connect_drop (conn, i);
+                return 1;
+            }
+            if (rc == SOCK_ERROR || now >= conn->attempt_end[i])
+            {
+                sock_close (conn->attempt[i]);
+                _connect_drop (conn, i);
+                failed = 1;
+                continue;
+            }
+            i++;
+        }
+
+        if (conn->n_addrs && conn->n_attempts == 0 && conn->next_addr == conn->n_addrs)
+            return SOCK_ERROR;
+        if (conn->deadline && now >= conn->deadline)
+            return SOCK_ERROR;
+
+        /* an attempt that fails makes way for the next at once */
+        if (failed && conn->next_addr < conn->n_addrs)
+        {
+            conn->next_start = now;
+            continue;
+        }
+        if (now >= until)
+            return 0;
+
+        next = until;
+        if (conn->deadline && conn->deadline < next)
+            next = conn->deadline;
+        if (conn->n_addrs == 0)
+        {
+            /* the resolver is polled */
+            if (now + 10 < next)
+                next = now + 10;
+        }
+        else if (conn->next_addr < conn->n_addrs && conn->next_start < next)
+            next = conn->next_start;
+        for (i = 0; i < conn->n_attempts; i++)
+            if (conn->attempt_end[i] < next)
+                next = conn->attempt_end[i];
+
+        _connect_wait (conn, (int)(next - now));
+        now = timing_get_time();
+    }
+}
+
+void sock_connect_free (sock_connect_t *conn)
+{
+    int i;
+
+    if (conn == NULL)
+        return;
+    for (i = 0; i < conn->n_attempts; i++)
+        sock_close (conn->attempt[i]);
+    free (conn->hostname);
+    free (conn);
+}
+
 void sock_set_send_buffer (sock_t sock, int win_size)
 {
     setsockopt (sock, SOL_SOCKET, SO_SNDBUF, (char *) &win_size, sizeof(win_size));
@@ -68,6 +68,11 @@ struct iovec
 /* sock connect macro */
 #define sock_connect(h, p) sock_connect_wto(h, p, 0)
 
+/* milliseconds between starting connection attempts on successive addresses */
+#define SOCK_CONNECT_STAGGER 250
+
+typedef struct sock_connect_tag sock_connect_t;
+
 #ifdef _mangle
 # define sock_initialize _mangle(sock_initialize)
 # define sock_shutdown _mangle(sock_shutdown)
@@ -86,6 +91,9 @@ struct iovec
 # define sock_connect_wto_bind _mangle(sock_connect_wto_bind)
 # define sock_connect_non_blocking _mangle(sock_connect_non_blocking)
 # define sock_connected _mangle(sock_connected)
+# define sock_connect_start _mangle(sock_connect_start)
+# define sock_connect_poll _mangle(sock_connect_poll)
+# define sock_connect_free _mangle(sock_connect_free)
 # define sock_write_bytes _mangle(sock_write_bytes)
 # define sock_write _mangle(sock_write)
 # define sock_write_fmt _mangle(sock_write_fmt)
@@ -122,6 +130,11 @@ sock_t sock_connect_wto_bind(const char *hostname, int port, const char *bnd, in
 sock_t sock_connect_non_blocking(const char *host, unsigned port);
 int sock_connected(sock_t sock, int timeout);
 
+/* Asynchronous connect, the timeouts and wait are in milliseconds */
+sock_connect_t *sock_connect_start(const char *hostname, unsigned port, int attempt_timeout, int timeout);
+int sock_connect_poll(sock_connect_t *conn, sock_t *sock, int wait);
+void sock_connect_free(sock_connect_t *conn);
+
 /* Socket write functions */
 int sock_write_bytes(sock_t sock, const void *buff, size_t len);
 int sock_write(sock_t sock, const char *fmt, ...);
@@ -65,6 +65,10 @@ static int parse_http_response(shout_t *self);
 static int parse_xaudiocast_response(shout_t *self);
 
 static char *http_basic_authorization(shout_t *self);
+static char *alloc_printf(const char *fmt, ...);
+
+static void meta_service(shout_t *self);
+static void meta_close(shout_t *self);
 static const char *default_mime_type(const shout_t *self);
 
 /* -- static data -- */
@@ -126,6 +130,8 @@ shout_t *shout_new(void)
 	self->port = LIBSHOUT_DEFAULT_PORT;
 	self->format = LIBSHOUT_DEFAULT_FORMAT;
 	self->protocol = LIBSHOUT_DEFAULT_PROTOCOL;
+	self->socket = SOCK_ERROR;
+	self->meta.socket = SOCK_ERROR;
 
 	return self;
 }
@@ -149,6 +155,8 @@ void shout_free(shout_t *self)
 	if (self->aim) free(self->aim);
     if (self->mime_type) free(self->mime_type);
 
+	sock_connect_free(self->connect);
+	meta_close(self);
 	free(self);
 }
 
@@ -179,7 +187,12 @@ int shout_close(shout_t *self)
 	if (self->state == SHOUT_STATE_CONNECTED && self->close)
 		self->close(self);
 
-	sock_close(self->socket);
+	sock_connect_free(self->connect);
+	self->connect = NULL;
+	if (self->socket != SOCK_ERROR)
+		sock_close(self->socket);
+	self->socket = SOCK_ERROR;
+	meta_close(self);
 	self->state = SHOUT_STATE_UNCONNECTED;
 	self->starttime = 0;
 	self->senttime = 0;
@@ -200,6 +213,9 @@ int shout_send(shout_t *self, const unsigned char *data, size_t len)
 	if (self->starttime <= 0)
 		self->starttime = timing_get_time();
 
+	if (self->meta.pending || self->meta.state != SHOUT_META_IDLE)
+		meta_service(self);
+
 	if (!len)
 		return send_queue(self);
 
@@ -300,13 +316,12 @@ int shout_metadata_add(shout_metadata_t *self, const char *name, const char *val
 	return _shout_util_dict_set(self, name, value);
 }
 
-/* open second socket to server, send HTTP request to change metadata.
- * TODO: prettier error-handling. */
+/* Queues the update to go out on the admin connection and returns at once.
+ * An update not yet started on is replaced by a newer one. The connection
+ * is worked here and on each shout_send. */
 int shout_set_metadata(shout_t *self, shout_metadata_t *metadata)
 {
-	sock_t socket;
-	int rv;
-	char *encvalue;
+	char *encvalue, *request;
 
 	if (!self || !metadata)
 		return SHOUTERR_INSANE;
@@ -314,28 +329,25 @@ int shout_set_metadata(shout_t *self, shout_metadata_t *metadata)
 	if (!(encvalue = _shout_util_dict_urlencode(metadata, '&')))
 		return SHOUTERR_MALLOC;
 
-	if ((socket = sock_connect(self->host, self->port)) <= 0)
-		return SHOUTERR_NOCONNECT;
-
 	if (self->protocol == SHOUT_PROTOCOL_ICY)
-		rv = sock_write(socket, "GET /admin.cgi?mode=updinfo&pass=%s&%s HTTP/1.0\r\nUser-Agent: %s (Mozilla compatible)\r\n\r\n",
+		request = alloc_printf("GET /admin.cgi?mode=updinfo&pass=%s&%s HTTP/1.0\r\nUser-Agent: %s (Mozilla compatible)\r\n\r\n",
 		  self->password, encvalue, shout_get_agent(self));
 	else if (self->protocol == SHOUT_PROTOCOL_HTTP) {
 		char *auth = http_basic_authorization(self);
 
-		rv = sock_write(socket, "GET /admin/metadata?mode=updinfo&mount=%s&%s HTTP/1.0\r\nUser-Agent: %s\r\n%s\r\n",
-		  self->mount, encvalue, shout_get_agent(self), auth ? auth : "");
-				free(auth);
+		request = alloc_printf("GET /admin/metadata?mode=updinfo&mount=%s&%s HTTP/1.1\r\nHost: %s:%u\r\nConnection: keep-alive\r\nUser-Agent: %s\r\n%s\r\n",
+		  self->mount, encvalue, self->host, self->port, shout_get_agent(self), auth ? auth : "");
+		free(auth);
 	} else
-		rv = sock_write(socket, "GET /admin.cgi?mode=updinfo&pass=%s&mount=%s&%s HTTP/1.0\r\nUser-Agent: %s\r\n\r\n",
+		request = alloc_printf("GET /admin.cgi?mode=updinfo&pass=%s&mount=%s&%s HTTP/1.0\r\nUser-Agent: %s\r\n\r\n",
 		  self->password, self->mount, encvalue, shout_get_agent(self));
 	free(encvalue);
-	if (!rv) {
-		sock_close(socket);
-		return SHOUTERR_SOCKET;
-	}
+	if (!request)
+		return SHOUTERR_MALLOC;
 
-	sock_close(socket);
+	free(self->meta.pending);
+	self->meta.pending = request;
+	meta_service(self);
 
 	return SHOUTERR_SUCCESS;
 }
@@ -899,6 +911,14 @@ unsigned int shout_get_nonblocking(shout_t *self)
 	return self->nonblocking;
 }
 
+int shout_get_socket(shout_t *self)
+{
+	if (!self || self->state == SHOUT_STATE_UNCONNECTED)
+		return -1;
+
+	return (int)self->socket;
+}
+
 /* -- static function definitions -- */
 
 static const char *default_mime_type(const shout_t *self)
@@ -919,36 +939,35 @@ static const char *default_mime_type(const shout_t *self)
 	return "application/octet-stream";
 }
 
-/* queue data in pages of SHOUT_BUFSIZE bytes */
+/* queue data at the tail, topping up the last buffer before adding one
+ * of at least SHOUT_BUFSIZE bytes that takes all the rest */
 static int queue_data(shout_queue_t *queue, const unsigned char *data, size_t len)
 {
-	shout_buf_t *buf;
-	size_t plen;
+	shout_buf_t *buf = queue->tail;
+	size_t plen, size;
 
 	if (!len)
 		return SHOUTERR_SUCCESS;
 
-	if (!queue->len) {
-		queue->head = calloc(1, sizeof (shout_buf_t));
-		if (! queue->head)
-			return SHOUTERR_MALLOC;
-	}
-
-	for (buf = queue->head; buf->next; buf = buf->next);
-
 	/* Maybe any added data should be freed if we hit a malloc error?
 	 * Otherwise it'd be impossible to tell where to start requeueing.
 	 * (As if anyone ever tried to recover from a malloc error.) */
 	while (len > 0) {
-		if (buf->len == SHOUT_BUFSIZE) {
-			buf->next = calloc(1, sizeof (shout_buf_t));
-			if (! buf->next)
+		if (!buf || buf->len == buf->size) {
+			size = len > SHOUT_BUFSIZE ? len : SHOUT_BUFSIZE;
+			if (!(buf = malloc(sizeof (shout_buf_t) + size)))
 				return SHOUTERR_MALLOC;
-			buf->next->prev = buf;
-			buf = buf->next;
+			buf->len = buf->pos = 0;
+			buf->size = size;
+			buf->next = NULL;
+			if ((buf->prev = queue->tail))
+				queue->tail->next = buf;
+			else
+				queue->head = buf;
+			queue->tail = buf;
 		}
 
-		plen = len > SHOUT_BUFSIZE - buf->len ? SHOUT_BUFSIZE - buf->len : len;
+		plen = len > buf->size - buf->len ? buf->size - buf->len : len;
 		memcpy (buf->data + buf->len, data, plen);
 		buf->len += plen;
 		data += plen;
@@ -1009,6 +1028,7 @@ static inline void queue_free(shout_queue_t *queue)
 		queue->head = queue->head->next;
 		free(prev);
 	}
+	queue->tail = NULL;
 	queue->len = 0;
 }
 
@@ -1032,7 +1052,7 @@ static int get_response(shout_t *self)
 
 	/* work from the back looking for \r?\n\r?\n. Anything else means more
 	 * is coming. */
-	for (queue = self->rqueue.head; queue->next; queue = queue->next);
+	queue = self->rqueue.tail;
 	pc = (char*)queue->data + queue->len - 1;
 	blen = queue->len;
 	while (blen) {
@@ -1071,30 +1091,25 @@ static int try_connect (shout_t *self)
 		if (shout_get_protocol(self) == SHOUT_PROTOCOL_ICY)
 			port++;
 
-		if (shout_get_nonblocking(self)) {
-			if ((self->socket = sock_connect_non_blocking(self->host, port)) < 0)
-				return self->error = SHOUTERR_NOCONNECT;
-			self->state = SHOUT_STATE_CONNECT_PENDING;
-		} else {
-			if ((self->socket = sock_connect(self->host, port)) < 0)
-				return self->error = SHOUTERR_NOCONNECT;
-			if ((rc = create_request(self)) != SHOUTERR_SUCCESS)
-				return rc;
-			self->state = SHOUT_STATE_REQ_PENDING;
-		}
+		/* the name lookup is part of the connect, both driven from CONNECT_PENDING */
+		self->socket = SOCK_ERROR;
+		if (!(self->connect = sock_connect_start(self->host, port, SHOUT_ATTEMPT_TIMEOUT, SHOUT_CONNECT_TIMEOUT)))
+			return self->error = SHOUTERR_MALLOC;
+		self->state = SHOUT_STATE_CONNECT_PENDING;
 
 	case SHOUT_STATE_CONNECT_PENDING:
-		if (shout_get_nonblocking(self)) {
-			if ((rc = sock_connected(self->socket, 0)) < 1) {
-				if (rc == SOCK_ERROR) {
-										rc = SHOUTERR_SOCKET;
-										goto failure;
-				} else
-					return SHOUTERR_BUSY;
-			}
-			if ((rc = create_request(self)) != SHOUTERR_SUCCESS)
-								goto failure;
+		if ((rc = sock_connect_poll(self->connect, &self->socket, shout_get_nonblocking(self) ? 0 : -1)) == 0)
+			return SHOUTERR_BUSY;
+		sock_connect_free(self->connect);
+		self->connect = NULL;
+		if (rc != 1) {
+			rc = SHOUTERR_NOCONNECT;
+			goto failure;
 		}
+		if (!shout_get_nonblocking(self))
+			sock_set_blocking(self->socket, 1);
+		if ((rc = create_request(self)) != SHOUTERR_SUCCESS)
+			goto failure;
 		self->state = SHOUT_STATE_REQ_PENDING;
 
 	case SHOUT_STATE_REQ_PENDING:
@@ -1203,29 +1218,48 @@ static int collect_queue(shout_buf_t *queue, char **buf)
 	return len;
 }
 
+/* write out the queue up to SHOUT_IOVECS buffers at a time */
 static int send_queue(shout_t *self)
 {
+	struct iovec iov[SHOUT_IOVECS];
 	shout_buf_t *buf;
-	int ret;
+	ssize_t ret;
+	size_t want, left, plen;
+	int n;
 
 	if (!self->wqueue.len)
 		return SHOUTERR_SUCCESS;
 
-	buf = self->wqueue.head;
-	while (buf) {
-		ret = try_write (self, buf->data + buf->pos, buf->len - buf->pos);
-		if (ret < 0)
-			return self->error;
+	while (self->wqueue.head) {
+		want = 0;
+		for (n = 0, buf = self->wqueue.head; buf && n < SHOUT_IOVECS; buf = buf->next, n++) {
+			iov[n].iov_base = buf->data + buf->pos;
+			iov[n].iov_len = buf->len - buf->pos;
+			want += iov[n].iov_len;
+		}
+
+		if ((ret = sock_writev(self->socket, iov, n)) < 0) {
+			if (sock_recoverable(sock_error()))
+				return self->error = SHOUTERR_BUSY;
+			return self->error = SHOUTERR_SOCKET;
+		}
 
-		buf->pos += ret;
 		self->wqueue.len -= ret;
-		if (buf->pos == buf->len) {
-			self->wqueue.head = buf->next;
-			free(buf);
+		for (left = ret; left; left -= plen) {
 			buf = self->wqueue.head;
-			if (buf)
-				buf->prev = NULL;
-		} else /* incomplete write */
+			if (left < (plen = buf->len - buf->pos)) {
+				buf->pos += left;
+				break;
+			}
+			if (!(self->wqueue.head = buf->next))
+				self->wqueue.tail = NULL;
+			else
+				self->wqueue.head->prev = NULL;
+			free(buf);
+		}
+
+		/* incomplete write */
+		if ((size_t)ret < want)
 			return SHOUTERR_BUSY;
 	}
 
@@ -1454,3 +1488,185 @@ static int create_icy_request(shout_t *self)
 
 	return ret;
 }
+
+static char *alloc_printf(const char *fmt, ...)
+{
+	va_list ap;
+	char *buf;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (len < 0 || !(buf = malloc(len + 1)))
+		return NULL;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, len + 1, fmt, ap);
+	va_end(ap);
+
+	return buf;
+}
+
+/* drop the admin connection and anything in flight or pending */
+static void meta_close(shout_t *self)
+{
+	sock_connect_free(self->meta.connect);
+	self->meta.connect = NULL;
+	if (self->meta.socket != SOCK_ERROR)
+		sock_close(self->meta.socket);
+	self->meta.socket = SOCK_ERROR;
+	free(self->meta.request);
+	free(self->meta.pending);
+	self->meta.request = self->meta.pending = NULL;
+	self->meta.state = SHOUT_META_IDLE;
+}
+
+/* the update in flight is tried again later unless a newer one is waiting */
+static void meta_fail(shout_t *self)
+{
+	sock_connect_free(self->meta.connect);
+	self->meta.connect = NULL;
+	if (self->meta.socket != SOCK_ERROR)
+		sock_close(self->meta.socket);
+	self->meta.socket = SOCK_ERROR;
+	if (self->meta.pending)
+		free(self->meta.request);
+	else
+		self->meta.pending = self->meta.request;
+	self->meta.request = NULL;
+	self->meta.state = SHOUT_META_IDLE;
+	self->meta.retry = timing_get_time() + SHOUT_META_RETRY;
+}
+
+/* find the end of the response head and what to expect after it */
+static int meta_parse_head(shout_t *self)
+{
+	char *end, *p, *line;
+	long content_length = -1, leftover;
+	int close = 0;
+
+	self->meta.head[self->meta.head_len] = '\0';
+	if (!(end = strstr(self->meta.head, "\r\n\r\n")))
+		return 0;
+	*end = '\0';
+
+	for (line = self->meta.head; line; line = (p = strstr(line, "\r\n")) ? p + 2 : NULL) {
+		if (!strncasecmp(line, "Content-Length:", 15))
+			content_length = atol(line + 15);
+		else if (!strncasecmp(line, "Connection:", 11) && strstr(line + 11, "close"))
+			close = 1;
+	}
+
+	/* anything but a sized HTTP/1.1 response is read to its end by closing */
+	self->meta.keepalive = !strncmp(self->meta.head, "HTTP/1.1", 8) && !close && content_length >= 0;
+	/* unsized bodies e.g. from Shoutcast or Icecast 1 admin.cgi end where the server closes */
+	self->meta.to_eof = content_length < 0;
+	leftover = (long)(self->meta.head_len - (end + 4 - self->meta.head));
+	self->meta.body_left = (self->meta.to_eof || leftover >= content_length) ? 0 : content_length - leftover;
+	return 1;
+}
+
+/* take the admin connection as far as it will go without blocking */
+static void meta_service(shout_t *self)
+{
+	shout_meta_t *meta = &self->meta;
+	char buf[sizeof meta->head];
+	int rc;
+
+	/* the breaks between cases are omitted intentionally */
+	for (;;) {
+		switch (meta->state) {
+		case SHOUT_META_IDLE:
+			if (!meta->pending)
+				return;
+			/* a kept connection the server has since closed reads as end of file */
+			if (meta->socket != SOCK_ERROR) {
+				rc = sock_read_bytes(meta->socket, buf, sizeof buf);
+				if (rc == 0 || (rc < 0 && !sock_recoverable(sock_error()))) {
+					sock_close(meta->socket);
+					meta->socket = SOCK_ERROR;
+				}
+			}
+			if (meta->socket == SOCK_ERROR && timing_get_time() < meta->retry)
+				return;
+			meta->request = meta->pending;
+			meta->pending = NULL;
+			meta->pos = 0;
+			meta->head_len = 0;
+			meta->body_left = -1;
+			meta->to_eof = 0;
+			if (meta->socket != SOCK_ERROR) {
+				meta->state = SHOUT_META_SENDING;
+				break;
+			}
+			if (!(meta->connect = sock_connect_start(self->host, self->port, SHOUT_ATTEMPT_TIMEOUT, SHOUT_CONNECT_TIMEOUT))) {
+				meta_fail(self);
+				return;
+			}
+			meta->state = SHOUT_META_CONNECTING;
+
+		case SHOUT_META_CONNECTING:
+			if ((rc = sock_connect_poll(meta->connect, &meta->socket, 0)) == 0)
+				return;
+			sock_connect_free(meta->connect);
+			meta->connect = NULL;
+			if (rc != 1) {
+				meta_fail(self);
+				return;
+			}
+			meta->state = SHOUT_META_SENDING;
+
+		case SHOUT_META_SENDING:
+			rc = sock_write_bytes(meta->socket, meta->request + meta->pos, strlen(meta->request) - meta->pos);
+			if (rc < 0) {
+				if (!sock_recoverable(sock_error()))
+					meta_fail(self);
+				return;
+			}
+			if ((meta->pos += rc) < strlen(meta->request))
+				return;
+			meta->state = SHOUT_META_RECEIVING;
+
+		case SHOUT_META_RECEIVING:
+			if (meta->body_left < 0)
+				rc = sock_read_bytes(meta->socket, meta->head + meta->head_len, sizeof meta->head - 1 - meta->head_len);
+			else
+				rc = sock_read_bytes(meta->socket, buf, sizeof buf);
+			if (rc < 0) {
+				if (!sock_recoverable(sock_error()))
+					meta_fail(self);
+				return;
+			}
+			if (rc == 0) {
+				/* the server closing after the head is a normal end */
+				if (meta->body_left < 0 || meta->keepalive) {
+					meta_fail(self);
+					return;
+				}
+				meta->body_left = 0;
+			} else if (meta->body_left < 0) {
+				meta->head_len += rc;
+				if (!meta_parse_head(self)) {
+					if (meta->head_len == sizeof meta->head - 1)
+						meta_fail(self);
+					return;
+				}
+			} else if (!meta->to_eof)
+				meta->body_left = rc < meta->body_left ? meta->body_left - rc : 0;
+
+			if (meta->body_left > 0 || (!meta->keepalive && rc > 0))
+				break;
+
+			free(meta->request);
+			meta->request = NULL;
+			if (!meta->keepalive) {
+				sock_close(meta->socket);
+				meta->socket = SOCK_ERROR;
+			}
+			meta->state = SHOUT_META_IDLE;
+			break;
+		}
+	}
+}
+
@@ -30,22 +30,65 @@
 #define LIBSHOUT_DEFAULT_USER "source"
 #define LIBSHOUT_DEFAULT_USERAGENT "libshout/" VERSION
 
+/* the least a queue buffer holds, larger writes get a buffer of their own size */
 #define SHOUT_BUFSIZE 4096
+/* milliseconds before trying the admin connection again after a failure */
+#define SHOUT_META_RETRY 5000
+/* the most queue buffers passed to one writev */
+#define SHOUT_IOVECS 64
+/* milliseconds allowed for a connection, name lookup included, and for
+ * the attempt on any one address */
+#define SHOUT_CONNECT_TIMEOUT 15000
+#define SHOUT_ATTEMPT_TIMEOUT 5000
 
 typedef struct _shout_buf {
-	unsigned char data[SHOUT_BUFSIZE];
 	unsigned int len;
 	unsigned int pos;
+	unsigned int size;
 
 	struct _shout_buf *prev;
 	struct _shout_buf *next;
+
+	unsigned char data[];
 } shout_buf_t;
 
 typedef struct {
 	shout_buf_t *head;
+	shout_buf_t *tail;
 	size_t len;
 } shout_queue_t;
 
+typedef enum {
+	SHOUT_META_IDLE = 0,
+	SHOUT_META_CONNECTING,
+	SHOUT_META_SENDING,
+	SHOUT_META_RECEIVING
+} shout_meta_state_e;
+
+/* the admin connection metadata updates go out on, kept open between
+ * updates where the server allows and worked without blocking */
+typedef struct {
+	sock_t socket;
+	/* the connect in progress */
+	sock_connect_t *connect;
+	shout_meta_state_e state;
+	/* the update in flight and how much of it is sent */
+	char *request;
+	size_t pos;
+	/* the latest update, any before it having been superseded */
+	char *pending;
+	/* the response up to the end of its headers */
+	char head[1024];
+	size_t head_len;
+	/* response body yet to arrive or -1 while reading the head */
+	long body_left;
+	int keepalive;
+	/* no Content-Length so the body runs until the server closes */
+	int to_eof;
+	/* no reconnecting before this time after a failure */
+	uint64_t retry;
+} shout_meta_t;
+
 typedef enum {
 	SHOUT_STATE_UNCONNECTED = 0,
 	SHOUT_STATE_CONNECT_PENDING,
@@ -97,6 +140,8 @@ struct shout {
 
 	/* socket the connection is on */
 	sock_t socket;
+	/* the connect in progress */
+	sock_connect_t *connect;
 	shout_state_e state;
 	int nonblocking;
 
@@ -107,6 +152,8 @@ struct shout {
 	shout_queue_t rqueue;
 	shout_queue_t wqueue;
 
+	shout_meta_t meta;
+
 	/* start of this period's timeclock */
 	uint64_t starttime;
 	/* amout of data we've sent (in milliseconds) */
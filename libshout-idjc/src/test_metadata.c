@@ -0,0 +1,113 @@
+/* test_metadata.c: metadata updates against canned admin responses
+ *
+ * The admin connection is driven directly so this includes shout.c.
+ * Each case serves one response to a listening socket on the loopback
+ * and checks the update completes without being queued for a retry.
+ */
+
+#include "shout.c"
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+struct server {
+	int listener;
+	const char *response;
+	/* close after the response rather than wait for another request */
+	int close_after;
+	int connections;
+	int requests;
+};
+
+static void *serve(void *arg)
+{
+	struct server *srv = arg;
+	char buf[4096];
+	size_t fill;
+	int s, rc;
+
+	while ((s = accept(srv->listener, NULL, NULL)) >= 0) {
+		srv->connections++;
+		for (fill = 0; (rc = recv(s, buf + fill, sizeof buf - 1 - fill, 0)) > 0; ) {
+			buf[fill += rc] = '\0';
+			if (!strstr(buf, "\r\n\r\n"))
+				continue;
+			srv->requests++;
+			fill = 0;
+			send(s, srv->response, strlen(srv->response), 0);
+			if (srv->close_after)
+				break;
+		}
+		close(s);
+	}
+
+	return NULL;
+}
+
+static int run(const char *name, int protocol, const char *response, int close_after, int updates)
+{
+	struct server srv = { .response = response, .close_after = close_after };
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t len = sizeof sin;
+	shout_metadata_t *metadata;
+	shout_t *self;
+	pthread_t thread;
+	char title[32];
+	int i, k, ok;
+
+	srv.listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (bind(srv.listener, (struct sockaddr *)&sin, sizeof sin) || listen(srv.listener, 4) ||
+	    getsockname(srv.listener, (struct sockaddr *)&sin, &len) || pthread_create(&thread, NULL, serve, &srv)) {
+		printf("%s: server setup failed\n", name);
+		return 0;
+	}
+
+	self = shout_new();
+	shout_set_host(self, "127.0.0.1");
+	shout_set_port(self, ntohs(sin.sin_port));
+	shout_set_protocol(self, protocol);
+	shout_set_mount(self, "/test");
+	shout_set_password(self, "hackme");
+	metadata = shout_metadata_new();
+
+	for (i = 0; i < updates; i++) {
+		snprintf(title, sizeof title, "title %d", i);
+		shout_metadata_add(metadata, "song", title);
+		shout_set_metadata(self, metadata);
+		for (k = 0; k < 500 && (self->meta.request || self->meta.pending); k++) {
+			usleep(1000);
+			meta_service(self);
+		}
+	}
+
+	ok = srv.requests == updates && !self->meta.request && !self->meta.pending && self->meta.state == SHOUT_META_IDLE;
+	printf("%s: %s (%d requests on %d connections)\n", name, ok ? "ok" : "FAILED", srv.requests, srv.connections);
+
+	shout_metadata_free(metadata);
+	shout_free(self);
+	shutdown(srv.listener, SHUT_RDWR);
+	close(srv.listener);
+	pthread_join(thread, NULL);
+
+	return ok;
+}
+
+int main()
+{
+	int ok = 1;
+
+	shout_init();
+
+	/* Shoutcast and Icecast 1 admin.cgi send no Content-Length and close */
+	ok &= run("unsized 200 then close", SHOUT_PROTOCOL_ICY,
+	  "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\n\r\n<html><body>Update successful</body></html>", 1, 2);
+	ok &= run("unsized empty 200 then close", SHOUT_PROTOCOL_ICY, "HTTP/1.0 200 OK\r\n\r\n", 1, 2);
+	ok &= run("sized 200 then close", SHOUT_PROTOCOL_HTTP,
+	  "HTTP/1.0 200 OK\r\nContent-Length: 5\r\n\r\n<ok/>", 1, 2);
+	ok &= run("sized 200 kept alive", SHOUT_PROTOCOL_HTTP,
+	  "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n<ok/>", 0, 2);
+
+	shout_shutdown();
+
+	return ok ? 0 : 1;
+}
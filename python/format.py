@@ -785,7 +785,7 @@ class FormatCodecSpeexComplexity(FormatDropdown):
     
     def __init__(self, prev_object):
         FormatDropdown.__init__(self, prev_object, _('Complexity'), "complexity", 
-            tuple(dict(display_text=str(x), value=str(x), chain="FormatMetadataUTF8", default=(x==5))
+            tuple(dict(display_text=str(x), value=str(x), chain="FormatOggPageDuration", default=(x==5))
                                                             for x in range(9, -1, -1)), 0,
             _('A quality setting that affects how heavily the CPU is used.'))
 
@@ -836,12 +836,12 @@ class FormatCodecVorbisVariability(FormatDropdown):
     
     def __init__(self, prev_object):
         FormatDropdown.__init__(self, prev_object, _('Variability'), "variability", (
-            dict(display_text=_("Constant"), value="0", chain="FormatMetadataUTF8"),
-            dict(display_text=_(u"\u00B110%"), value="10", chain="FormatMetadataUTF8"),
-            dict(display_text=_(u"\u00B120%"), value="20", chain="FormatMetadataUTF8"),
-            dict(display_text=_(u"\u00B130%"), value="30", chain="FormatMetadataUTF8"),
-            dict(display_text=_(u"\u00B140%"), value="40", chain="FormatMetadataUTF8"),
-            dict(display_text=_(u"\u00B150%"), value="50", chain="FormatMetadataUTF8")), 0,
+            dict(display_text=_("Constant"), value="0", chain="FormatOggPageDuration"),
+            dict(display_text=_(u"\u00B110%"), value="10", chain="FormatOggPageDuration"),
+            dict(display_text=_(u"\u00B120%"), value="20", chain="FormatOggPageDuration"),
+            dict(display_text=_(u"\u00B130%"), value="30", chain="FormatOggPageDuration"),
+            dict(display_text=_(u"\u00B140%"), value="40", chain="FormatOggPageDuration"),
+            dict(display_text=_(u"\u00B150%"), value="50", chain="FormatOggPageDuration")), 0,
             _('This control is for enabling variable bitrate on Vorbis streams.'))
 
 
@@ -904,19 +904,19 @@ class FormatCodecOpusPostGain(FormatDropdown):
     
     def __init__(self, prev_object):
         FormatDropdown.__init__(self, prev_object, _('Postgain'), "postgain", (
-            dict(display_text=_('3.0 dB'), value="768", chain="FormatMetadataUTF8"),
-            dict(display_text=_('2.5 dB'), value="640", chain="FormatMetadataUTF8"),
-            dict(display_text=_('2.0 dB'), value="512", chain="FormatMetadataUTF8"),
-            dict(display_text=_('1.5 dB'), value="384", chain="FormatMetadataUTF8"),
-            dict(display_text=_('1.0 dB'), value="256", chain="FormatMetadataUTF8"),
-            dict(display_text=_('0.5 dB'), value="128", chain="FormatMetadataUTF8"),
-            dict(display_text=_('0 dB'), value="0", default=True, chain="FormatMetadataUTF8"),
-            dict(display_text=_('-0.5 dB'), value="-128", chain="FormatMetadataUTF8"),
-            dict(display_text=_('-1.0 dB'), value="-256", chain="FormatMetadataUTF8"),
-            dict(display_text=_('-1.5 dB'), value="-384", chain="FormatMetadataUTF8"),
-            dict(display_text=_('-2.0 dB'), value="-512", chain="FormatMetadataUTF8"),
-            dict(display_text=_('-2.5 dB'), value="-640", chain="FormatMetadataUTF8"),
-            dict(display_text=_('-3.0 dB'), value="-768", chain="FormatMetadataUTF8")), 1,
+            dict(display_text=_('3.0 dB'), value="768", chain="FormatOggPageDuration"),
+            dict(display_text=_('2.5 dB'), value="640", chain="FormatOggPageDuration"),
+            dict(display_text=_('2.0 dB'), value="512", chain="FormatOggPageDuration"),
+            dict(display_text=_('1.5 dB'), value="384", chain="FormatOggPageDuration"),
+            dict(display_text=_('1.0 dB'), value="256", chain="FormatOggPageDuration"),
+            dict(display_text=_('0.5 dB'), value="128", chain="FormatOggPageDuration"),
+            dict(display_text=_('0 dB'), value="0", default=True, chain="FormatOggPageDuration"),
+            dict(display_text=_('-0.5 dB'), value="-128", chain="FormatOggPageDuration"),
+            dict(display_text=_('-1.0 dB'), value="-256", chain="FormatOggPageDuration"),
+            dict(display_text=_('-1.5 dB'), value="-384", chain="FormatOggPageDuration"),
+            dict(display_text=_('-2.0 dB'), value="-512", chain="FormatOggPageDuration"),
+            dict(display_text=_('-2.5 dB'), value="-640", chain="FormatOggPageDuration"),
+            dict(display_text=_('-3.0 dB'), value="-768", chain="FormatOggPageDuration")), 1,
             _("A gain adjustment for the player to apply."))
 
 
@@ -973,6 +973,34 @@ class FormatCodecOpusMode(FormatDropdown):
             dict(display_text=_("Stereo"), value="stereo", default=True, chain="FormatCodecOpusBitRate")), 0)
 
 
+class FormatOggPageDuration(FormatDropdown):
+    """How much audio an Ogg page carries."""
+    
+    def __init__(self, prev_object):
+        FormatDropdown.__init__(self, prev_object, _('Page Length'), "page_duration", (
+            dict(display_text=_('Codec Default'), value="0", default=True, chain="FormatOggPagePackets"),
+            dict(display_text=_('20 ms'), value="20", chain="FormatOggPagePackets"),
+            dict(display_text=_('50 ms'), value="50", chain="FormatOggPagePackets"),
+            dict(display_text=_('100 ms'), value="100", chain="FormatOggPagePackets"),
+            dict(display_text=_('250 ms'), value="250", chain="FormatOggPagePackets"),
+            dict(display_text=_('500 ms'), value="500", chain="FormatOggPagePackets"),
+            dict(display_text=_('1 s'), value="1000", chain="FormatOggPagePackets"),
+            dict(display_text=_('2 s'), value="2000", chain="FormatOggPagePackets"),
+            dict(display_text=_('5 s'), value="5000", chain="FormatOggPagePackets")), 1,
+            _("Short pages reach the listener sooner which suits talkback. Long pages waste fewer bytes on page headers which suits archive streams."))
+
+
+class FormatOggPagePackets(FormatDropdown):
+    """How many codec packets an Ogg page carries."""
+    
+    def __init__(self, prev_object):
+        FormatDropdown.__init__(self, prev_object, _('Page Packets'), "page_packets",
+            (dict(display_text=_('By Length'), value="0", default=True, chain="FormatMetadataUTF8"),) +
+            tuple(dict(display_text=str(x), value=str(x), chain="FormatMetadataUTF8")
+                                                    for x in (1, 2, 4, 8, 16, 32, 64, 128, 255)), 1,
+            _("A fixed number of codec packets per page which overrides the page length. One packet per page gives the lowest latency."))
+
+
 class FormatCodecXiphOgg(FormatDropdown):
     """Ogg codec selection."""
     
@@ -1221,7 +1249,10 @@ class FormatControl(Gtk.VBox):
             self.start_encoder_rc()
         else:
             self.stop_encoder_rc()
-            
+
+    # settings added later that older saved formats lack
+    _defaultable = ("page_duration", "page_packets")
+
     _cap_table = {
             "ogg":
             {
@@ -1280,15 +1311,16 @@ class FormatControl(Gtk.VBox):
             try:
                 self._current.value = dict_[self._current.ident]
             except KeyError:
-                print "key error", self._current.ident
-                break
-            else:
-                if self._current.applied or self._current.ident == unapplied or oldcurr == self._current:
-                    break
-                oldcurr = self._current
-                self.apply_button.clicked()
-                if oldcurr.next_element_name is None:
+                # settings saved before these controls existed take the default
+                if self._current.ident not in self._defaultable:
+                    print "key error", self._current.ident
                     break
+            if self._current.applied or self._current.ident == unapplied or oldcurr == self._current:
+                break
+            oldcurr = self._current
+            self.apply_button.clicked()
+            if oldcurr.next_element_name is None:
+                break
 
     def get_settings(self):
         return format_collate(self._current)
@@ -2757,6 +2757,13 @@ class MainWindow(dbus.service.Object):
                     session_ns[key[8:]] = value
                     continue
                  
+                if key == "buffer_memory":
+                    if value != self.buffer_memory:
+                        self.buffer_memory = value
+                        print "player buffer memory is now %d KiB" % (
+                                                            int(value) // 1024)
+                    continue
+
                 if key == "ports_connections_changed":
                     cons_changed = value != "0"
                     
@@ -2973,6 +2980,12 @@ class MainWindow(dbus.service.Object):
                                         'resource_count', 'num_effects')
         except ConfigParser.Error:
             pass
+        # Optional player ringbuffer lengths in seconds.
+        for name in ("main_rb_size", "interlude_rb_size", "effects_rb_size"):
+            try:
+                os.environ[name] = str(config.getfloat('resource_count', name))
+            except (ConfigParser.Error, ValueError):
+                pass
        
         if pm.session_uuid is None:
             if args.jackserver is None:
@@ -3769,6 +3782,7 @@ class MainWindow(dbus.service.Object):
         self.jingles.interlude.silence = SlotObject(0.0)
         self.sample_rate = SlotObject(0)
         self.effects_playing = SlotObject(0)
+        self.buffer_memory = ""
         
         self.feature_set = Gtk.ToggleButton()
         self.feature_set.set_active(True)
@@ -20,6 +20,7 @@ import os
 import shutil
 import gettext
 import itertools
+import ConfigParser
 
 from gi.repository import Gtk
 import glib
@@ -716,12 +717,18 @@ class mixprefs:
 
 
     def save_resource_template(self):
+        # Player ringbuffer sizes have no widgets but must survive a rewrite.
+        config = ConfigParser.RawConfigParser()
+        config.read(pm.basedir / "config")
         try:
             with open(pm.basedir / "config", "w") as f:
                 f.write("[resource_count]\n")
                 for name, widget in self.rrvaluesdict.iteritems():
                     f.write(name + "=" + str(int(widget.get_value())) + "\n")
                 f.write("num_effects=%d\n" % (24 if self.more_effects.get_active() else 12))
+                for name in ("main_rb_size", "interlude_rb_size", "effects_rb_size"):
+                    if config.has_option("resource_count", name):
+                        f.write(name + "=" + config.get("resource_count", name) + "\n")
         except IOError:
             print "Error while writing out player defaults"
 
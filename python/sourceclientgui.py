@@ -1411,6 +1411,7 @@ class StreamTab(Tab):
         self.scg = scg
         self.show_indicator("clear")
         self.tab_type = "streamer"
+        self.latency_report = ""
         self.set_spacing(10)
               
         self.ic_expander = Gtk.Expander(_('Individual Controls'))
@@ -2134,6 +2135,14 @@ class SourceClientGui(dbus.service.Object):
         print "streamstate_cache purge"
         self._streamstate_cache = {}
 
+    def _check_dropped(self, tab, name, frames_dropped):
+        frames_dropped = int(frames_dropped)
+        previous = getattr(tab, "frames_dropped", 0)
+        if frames_dropped > previous:
+            print "sourceclientgui.monitor: %s %d lost %d frames of audio" % (
+                            name, tab.numeric_id, frames_dropped - previous)
+        tab.frames_dropped = frames_dropped
+
     def monitor(self):
         self.led_alternate = not self.led_alternate
         streaming = recording = False
@@ -2146,8 +2155,9 @@ class SourceClientGui(dbus.service.Object):
                 if reply == "succeeded" or reply == "failed":
                     break
                 if reply.startswith("recorder%dreport=" % rectab.numeric_id):
-                    recorder_state, recorded_seconds = reply.split("=")[
-                                                                1].split(":")
+                    recorder_state, recorded_seconds, frames_dropped = \
+                                                reply.split("=")[1].split(":")
+                    self._check_dropped(rectab, "recorder", frames_dropped)
                     rectab.show_indicator(("clear", "red", "amber", "clear")[
                                                         int(recorder_state)])
                     rectab.time_indicator.set_value(int(recorded_seconds))
@@ -2168,8 +2178,15 @@ class SourceClientGui(dbus.service.Object):
             if reply != "failed":
                 self.receive()
                 if reply.startswith("streamer%dreport=" % streamtab.numeric_id):
-                    streamer_state, stream_sendbuffer_pc, brand_new = \
-                                                    reply.split("=")[1].split(":")
+                    streamer_state, stream_sendbuffer_pc, brand_new, \
+                            frames_dropped, latency = \
+                            reply.split("=")[1].split(":")
+                    if latency != streamtab.latency_report:
+                        streamtab.latency_report = latency
+                        print "streamer %d latency ms feed,encode,queue," \
+                                "send,buffer,total: %s" % (
+                                streamtab.numeric_id, latency)
+                    self._check_dropped(streamtab, "streamer", frames_dropped)
                     state = int(streamer_state)
                     self._handle_streamstate(streamtab.numeric_id,
                                             int(state > 1), streamtab)